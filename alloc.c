@@ -0,0 +1,111 @@
+// References:
+// https://www.kernel.org/doc/html/latest/admin-guide/mm/transhuge.html
+// https://www.kernel.org/doc/html/latest/admin-guide/mm/hugetlbpage.html
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "alloc.h"
+
+static void *_defaultAlloc(void *ctx, size_t nbytes, bool *zeroed);
+static void *_defaultRealloc(void *ctx, void *p, size_t old_nbytes, size_t nbytes);
+static void _defaultFree(void *ctx, void *p, size_t nbytes);
+static void *_hugeAlloc(void *ctx, size_t nbytes, bool *zeroed);
+static void *_hugeRealloc(void *ctx, void *p, size_t old_nbytes, size_t nbytes);
+static void _hugeFree(void *ctx, void *p, size_t nbytes);
+static size_t _hugeRound(size_t nbytes);
+
+
+const Allocator allocDefault = {_defaultAlloc, _defaultRealloc, _defaultFree, NULL};
+const Allocator allocHugePages = {_hugeAlloc, _hugeRealloc, _hugeFree, NULL};
+
+static void *_defaultAlloc(void *ctx, size_t nbytes, bool *zeroed) {
+    (void)ctx;
+    *zeroed = false;
+    return malloc(nbytes);
+}
+
+static void *_defaultRealloc(void *ctx, void *p, size_t old_nbytes, size_t nbytes) {
+    (void)ctx;
+    (void)old_nbytes;
+    return realloc(p, nbytes);
+}
+
+static void _defaultFree(void *ctx, void *p, size_t nbytes) {
+    (void)ctx;
+    (void)nbytes;
+    free(p);
+}
+
+static void *_hugeAlloc(void *ctx, size_t nbytes, bool *zeroed) {
+    (void)ctx;
+    if (nbytes < ALLOC_HUGE_PAGE_SIZE) {
+        *zeroed = false;
+        return malloc(nbytes);
+    }
+    size_t len = _hugeRound(nbytes);
+    // anonymous mappings are zero-filled
+    *zeroed = true;
+#ifdef MAP_HUGETLB
+    int huge_flags = MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+    huge_flags |= 21 << MAP_HUGE_SHIFT;
+#endif
+    // fails unless the administrator reserved huge pages
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | huge_flags, -1, 0);
+    if (p != MAP_FAILED) {
+        return p;
+    }
+#endif
+
+    // transparent huge pages only back 2MB aligned ranges,
+    // so map one page more and trim both ends
+    char *raw = mmap(NULL, len + ALLOC_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+    char *aligned = (char *)(((uintptr_t)raw + ALLOC_HUGE_PAGE_SIZE - 1)
+                             & ~(uintptr_t)(ALLOC_HUGE_PAGE_SIZE - 1));
+    if (aligned > raw) {
+        munmap(raw, aligned - raw);
+    }
+    size_t tail = (size_t)(raw + len + ALLOC_HUGE_PAGE_SIZE - (aligned + len));
+    if (tail > 0) {
+        munmap(aligned + len, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    // a hint, the pages stay small if the kernel has THP disabled
+    madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+static void *_hugeRealloc(void *ctx, void *p, size_t old_nbytes, size_t nbytes) {
+    if (old_nbytes < ALLOC_HUGE_PAGE_SIZE && nbytes < ALLOC_HUGE_PAGE_SIZE) {
+        return realloc(p, nbytes);
+    }
+    bool zeroed;
+    void *q = _hugeAlloc(ctx, nbytes, &zeroed);
+    if (q == NULL) {
+        return NULL;
+    }
+    memcpy(q, p, old_nbytes < nbytes ? old_nbytes : nbytes);
+    _hugeFree(ctx, p, old_nbytes);
+    return q;
+}
+
+static void _hugeFree(void *ctx, void *p, size_t nbytes) {
+    (void)ctx;
+    if (nbytes < ALLOC_HUGE_PAGE_SIZE) {
+        free(p);
+        return;
+    }
+    munmap(p, _hugeRound(nbytes));
+}
+
+static size_t _hugeRound(size_t nbytes) {
+    return (nbytes + ALLOC_HUGE_PAGE_SIZE - 1) & ~(ALLOC_HUGE_PAGE_SIZE - 1);
+}
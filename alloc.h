@@ -0,0 +1,49 @@
+// Allocators for the tables of dict and set.
+// An Allocator is a set of alloc/realloc/free hooks and a context pointer
+// handed back to each of them. A table remembers the allocator it came
+// from and passes its size back on free, so the hooks need no bookkeeping
+// of their own. allocHugePages backs the big tables with 2MB pages, one
+// TLB entry then covers what takes 512 of them with 4KB pages.
+
+#ifndef _ALLOC_H_
+#define _ALLOC_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define ALLOC_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+typedef struct {
+    // *zeroed tells whether the memory comes zero-filled,
+    // the caller doesn't need to clear it then
+    void *(*alloc)(void *ctx, size_t nbytes, bool *zeroed);
+    void *(*realloc)(void *ctx, void *p, size_t old_nbytes, size_t nbytes);
+    void (*free)(void *ctx, void *p, size_t nbytes);
+    void *ctx;
+} Allocator;
+
+// >> external API
+// malloc, realloc and free
+extern const Allocator allocDefault;
+// ALLOC_HUGE_PAGE_SIZE bytes and more are mapped anonymously, from the
+// reserved huge pages if there are any, else as transparent huge pages
+// (MADV_HUGEPAGE); smaller ones come from malloc
+extern const Allocator allocHugePages;
+
+static inline void *
+allocBytes(const Allocator *a, size_t nbytes, bool *zeroed) {
+    return a->alloc(a->ctx, nbytes, zeroed);
+}
+
+static inline void *
+allocRealloc(const Allocator *a, void *p, size_t old_nbytes, size_t nbytes) {
+    return a->realloc(a->ctx, p, old_nbytes, nbytes);
+}
+
+static inline void
+allocFree(const Allocator *a, void *p, size_t nbytes) {
+    a->free(a->ctx, p, nbytes);
+}
+// << external API
+
+#endif  // _ALLOC_H_
@@ -0,0 +1,580 @@
+// References:
+// https://en.wikipedia.org/wiki/B%2B_tree
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "bptree.h"
+
+// a full node takes one more key, then splits
+#define LEAF_MAX_KEYS BPTREE_M
+#define LEAF_MIN_KEYS (BPTREE_M / 2)
+#define INNER_MAX_KEYS (BPTREE_M - 1)
+#define INNER_MIN_KEYS ((BPTREE_M + 1) / 2 - 1)
+
+typedef struct _bpnode bpnode;
+typedef struct _bpinner bpinner;
+
+// the head of both kinds of nodes
+struct _bpnode {
+    size_t num_keys;
+    int is_leaf;
+};
+
+struct _bpleaf {
+    bpnode hdr;
+    // the neighbours in key order, NULL at both ends
+    bpleaf *prev;
+    bpleaf *next;
+    bptreeKeyType keys[LEAF_MAX_KEYS + 1];
+    bptreeValueType values[LEAF_MAX_KEYS + 1];
+};
+
+// children[i] holds the keys in [keys[i-1], keys[i])
+struct _bpinner {
+    bpnode hdr;
+    bptreeKeyType keys[INNER_MAX_KEYS + 1];
+    bpnode *children[INNER_MAX_KEYS + 2];
+};
+
+struct _bptree {
+    size_t length;
+    size_t num_nodes;
+    bpnode *root;
+};
+
+// >> internal functions
+static bpleaf* _bptreeNewLeaf(bptree *t);
+static bpinner* _bptreeNewInner(bptree *t);
+static void _bptreeFreeNode(bptree *t, bpnode *node);
+static void _bptreeFreeNodeR(bptree *t, bpnode *node);
+static size_t _bpLowerBound(const bptreeKeyType keys[], size_t len, bptreeKeyType key);
+static size_t _bpUpperBound(const bptreeKeyType keys[], size_t len, bptreeKeyType key);
+static bpleaf* _bptreeFindLeaf(bptree *t, bptreeKeyType key);
+static bpnode* _bpnodeInsert(bptree *t, bpnode *n, bptreeKeyType key, bptreeValueType value,
+                             int *inserted, bptreeKeyType *sep);
+static bpnode* _bpleafInsert(bptree *t, bpleaf *leaf, bptreeKeyType key, bptreeValueType value,
+                             int *inserted, bptreeKeyType *sep);
+static int _bpnodeRemove(bptree *t, bpnode *n, bptreeKeyType key);
+static void _bpinnerFixChild(bptree *t, bpinner *parent, size_t p);
+static void _bpinnerRemoveAt(bpinner *n, size_t p);
+static inline size_t _bpnodeMinKeys(bpnode *n) {
+    return n->is_leaf ? LEAF_MIN_KEYS : INNER_MIN_KEYS;
+}
+// << internal functions
+
+
+extern bptree* bptreeNew(void) {
+    bptree *tree = (bptree *)malloc(sizeof(bptree));
+    assert(tree != NULL);
+    tree->length = 0;
+    tree->num_nodes = 0;
+    tree->root = &_bptreeNewLeaf(tree)->hdr;
+    return tree;
+}
+
+extern void bptreeFree(bptree *tree) {
+    assert(tree != NULL);
+    _bptreeFreeNodeR(tree, tree->root);
+    free(tree);
+}
+
+// returns 1 if inserted a key or 0 if the value of the key was replaced
+extern int bptreeSet(bptree *tree, bptreeKeyType key, bptreeValueType value) {
+    assert(tree != NULL);
+    int inserted;
+    bptreeKeyType sep;
+    bpnode *right = _bpnodeInsert(tree, tree->root, key, value, &inserted, &sep);
+    if (right != NULL) {
+        // the root split, the tree grows by one level
+        bpinner *root = _bptreeNewInner(tree);
+        root->hdr.num_keys = 1;
+        root->keys[0] = sep;
+        root->children[0] = tree->root;
+        root->children[1] = right;
+        tree->root = &root->hdr;
+    }
+    tree->length += inserted;
+    return inserted;
+}
+
+// the key must exists (bptreeHas(key) == 1), or an error will be raised
+extern bptreeValueType bptreeGet(bptree *tree, bptreeKeyType key) {
+    assert(tree != NULL);
+    bpleaf *leaf = _bptreeFindLeaf(tree, key);
+    size_t p = _bpLowerBound(leaf->keys, leaf->hdr.num_keys, key);
+    assert(p < leaf->hdr.num_keys && leaf->keys[p] == key);
+    return leaf->values[p];
+}
+
+// returns 1 or 0
+extern int bptreeHas(bptree *tree, bptreeKeyType key) {
+    assert(tree != NULL);
+    bpleaf *leaf = _bptreeFindLeaf(tree, key);
+    size_t p = _bpLowerBound(leaf->keys, leaf->hdr.num_keys, key);
+    return p < leaf->hdr.num_keys && leaf->keys[p] == key;
+}
+
+// returns whether or not a key is been deleted
+extern int bptreeDel(bptree *tree, bptreeKeyType key) {
+    assert(tree != NULL);
+    int deleted = _bpnodeRemove(tree, tree->root, key);
+    bpnode *root = tree->root;
+    if (!root->is_leaf && root->num_keys == 0) {
+        // the last two children of the root merged
+        tree->root = ((bpinner *)root)->children[0];
+        _bptreeFreeNode(tree, root);
+    }
+    tree->length -= deleted;
+    return deleted;
+}
+
+extern size_t bptreeLen(bptree *tree) {
+    return tree->length;
+}
+
+// iter is set to the first key >= key
+extern void bptreeSeek(bptree *tree, bptreeKeyType key, bptreeIter *iter) {
+    assert(tree != NULL);
+    bpleaf *leaf = _bptreeFindLeaf(tree, key);
+    iter->leaf = leaf;
+    iter->pos = _bpLowerBound(leaf->keys, leaf->hdr.num_keys, key);
+}
+
+// returns 0 past the last key
+extern int bptreeIterNext(bptreeIter *iter, bptreeKeyType *key, bptreeValueType *value) {
+    bpleaf *leaf = iter->leaf;
+    for (; leaf != NULL && iter->pos >= leaf->hdr.num_keys; ) {
+        leaf = leaf->next;
+        iter->pos = 0;
+    }
+    iter->leaf = leaf;
+    if (leaf == NULL) {
+        return 0;
+    }
+    *key = leaf->keys[iter->pos];
+    *value = leaf->values[iter->pos];
+    iter->pos++;
+    return 1;
+}
+
+static bpleaf* _bptreeNewLeaf(bptree *t) {
+    bpleaf *leaf = (bpleaf *)malloc(sizeof(bpleaf));
+    assert(leaf != NULL);
+    leaf->hdr.num_keys = 0;
+    leaf->hdr.is_leaf = 1;
+    leaf->prev = NULL;
+    leaf->next = NULL;
+    t->num_nodes++;
+    return leaf;
+}
+
+static bpinner* _bptreeNewInner(bptree *t) {
+    bpinner *inner = (bpinner *)malloc(sizeof(bpinner));
+    assert(inner != NULL);
+    inner->hdr.num_keys = 0;
+    inner->hdr.is_leaf = 0;
+    t->num_nodes++;
+    return inner;
+}
+
+static void _bptreeFreeNode(bptree *t, bpnode *node) {
+    free(node);
+    t->num_nodes--;
+}
+
+static void _bptreeFreeNodeR(bptree *t, bpnode *node) {
+    if (!node->is_leaf) {
+        bpinner *inner = (bpinner *)node;
+        for (size_t i = 0; i <= node->num_keys; i++) {
+            _bptreeFreeNodeR(t, inner->children[i]);
+        }
+    }
+    _bptreeFreeNode(t, node);
+}
+
+// the first position whose key is >= key
+static size_t _bpLowerBound(const bptreeKeyType keys[], size_t len, bptreeKeyType key) {
+    size_t left_p = 0,
+           right_p = len;
+    for (; right_p > left_p; ) {
+        size_t mid_p = (left_p + right_p) / 2;
+        if (keys[mid_p] < key) {
+            left_p = mid_p + 1;
+        } else {
+            right_p = mid_p;
+        }
+    }
+    return left_p;
+}
+
+// the first position whose key is > key, the child to descend into
+static size_t _bpUpperBound(const bptreeKeyType keys[], size_t len, bptreeKeyType key) {
+    size_t left_p = 0,
+           right_p = len;
+    for (; right_p > left_p; ) {
+        size_t mid_p = (left_p + right_p) / 2;
+        if (keys[mid_p] <= key) {
+            left_p = mid_p + 1;
+        } else {
+            right_p = mid_p;
+        }
+    }
+    return left_p;
+}
+
+// the leaf that holds key, or would
+static bpleaf* _bptreeFindLeaf(bptree *t, bptreeKeyType key) {
+    bpnode *node = t->root;
+    for (; !node->is_leaf; ) {
+        bpinner *inner = (bpinner *)node;
+        node = inner->children[_bpUpperBound(inner->keys, node->num_keys, key)];
+    }
+    return (bpleaf *)node;
+}
+
+// Inserts into the subtree of n. If n splits, returns its new right
+// sibling, and *sep is the smallest key of the right sibling's subtree.
+static bpnode* _bpnodeInsert(bptree *t, bpnode *n, bptreeKeyType key, bptreeValueType value,
+                             int *inserted, bptreeKeyType *sep) {
+    if (n->is_leaf) {
+        return _bpleafInsert(t, (bpleaf *)n, key, value, inserted, sep);
+    }
+    bpinner *inner = (bpinner *)n;
+    size_t p = _bpUpperBound(inner->keys, n->num_keys, key);
+    bptreeKeyType child_sep;
+    bpnode *child_right = _bpnodeInsert(t, inner->children[p], key, value, inserted, &child_sep);
+    if (child_right == NULL) {
+        return NULL;
+    }
+
+    memmove(&inner->keys[p + 1], &inner->keys[p], (n->num_keys - p) * sizeof(inner->keys[0]));
+    memmove(&inner->children[p + 2], &inner->children[p + 1],
+            (n->num_keys - p) * sizeof(inner->children[0]));
+    inner->keys[p] = child_sep;
+    inner->children[p + 1] = child_right;
+    n->num_keys++;
+    if (n->num_keys <= INNER_MAX_KEYS) {
+        return NULL;
+    }
+
+    // the middle key moves up, the keys after it go right
+    size_t mid_p = n->num_keys / 2;
+    bpinner *right = _bptreeNewInner(t);
+    right->hdr.num_keys = n->num_keys - mid_p - 1;
+    memcpy(right->keys, &inner->keys[mid_p + 1], right->hdr.num_keys * sizeof(inner->keys[0]));
+    memcpy(right->children, &inner->children[mid_p + 1],
+           (right->hdr.num_keys + 1) * sizeof(inner->children[0]));
+    *sep = inner->keys[mid_p];
+    n->num_keys = mid_p;
+    return &right->hdr;
+}
+
+static bpnode* _bpleafInsert(bptree *t, bpleaf *leaf, bptreeKeyType key, bptreeValueType value,
+                             int *inserted, bptreeKeyType *sep) {
+    size_t num_keys = leaf->hdr.num_keys;
+    size_t p = _bpLowerBound(leaf->keys, num_keys, key);
+    if (p < num_keys && leaf->keys[p] == key) {
+        leaf->values[p] = value;
+        *inserted = 0;
+        return NULL;
+    }
+    memmove(&leaf->keys[p + 1], &leaf->keys[p], (num_keys - p) * sizeof(leaf->keys[0]));
+    memmove(&leaf->values[p + 1], &leaf->values[p], (num_keys - p) * sizeof(leaf->values[0]));
+    leaf->keys[p] = key;
+    leaf->values[p] = value;
+    leaf->hdr.num_keys = ++num_keys;
+    *inserted = 1;
+    if (num_keys <= LEAF_MAX_KEYS) {
+        return NULL;
+    }
+
+    // the upper half moves to a new leaf, linked after this one
+    bpleaf *right = _bptreeNewLeaf(t);
+    size_t nleft = num_keys - num_keys / 2;
+    right->hdr.num_keys = num_keys - nleft;
+    memcpy(right->keys, &leaf->keys[nleft], right->hdr.num_keys * sizeof(leaf->keys[0]));
+    memcpy(right->values, &leaf->values[nleft], right->hdr.num_keys * sizeof(leaf->values[0]));
+    leaf->hdr.num_keys = nleft;
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next != NULL) {
+        leaf->next->prev = right;
+    }
+    leaf->next = right;
+    *sep = right->keys[0];
+    return &right->hdr;
+}
+
+// Removes key from the subtree of n, returns 1 if it was there.
+// n may be left with too few keys, its parent fixes it.
+static int _bpnodeRemove(bptree *t, bpnode *n, bptreeKeyType key) {
+    if (n->is_leaf) {
+        bpleaf *leaf = (bpleaf *)n;
+        size_t p = _bpLowerBound(leaf->keys, n->num_keys, key);
+        if (p == n->num_keys || leaf->keys[p] != key) {
+            return 0;
+        }
+        size_t nafter = n->num_keys - p - 1;
+        memmove(&leaf->keys[p], &leaf->keys[p + 1], nafter * sizeof(leaf->keys[0]));
+        memmove(&leaf->values[p], &leaf->values[p + 1], nafter * sizeof(leaf->values[0]));
+        n->num_keys--;
+        // a separator equal to key stays valid: it still sorts
+        // between the keys of its two sides
+        return 1;
+    }
+    bpinner *inner = (bpinner *)n;
+    size_t p = _bpUpperBound(inner->keys, n->num_keys, key);
+    int deleted = _bpnodeRemove(t, inner->children[p], key);
+    if (deleted && inner->children[p]->num_keys < _bpnodeMinKeys(inner->children[p])) {
+        _bpinnerFixChild(t, inner, p);
+    }
+    return deleted;
+}
+
+// child p of parent is one key short: borrow one from a sibling,
+// or merge it with one
+static void _bpinnerFixChild(bptree *t, bpinner *parent, size_t p) {
+    bpnode *child = parent->children[p];
+    bpnode *left = (p > 0) ? parent->children[p - 1] : NULL;
+    bpnode *right = (p < parent->hdr.num_keys) ? parent->children[p + 1] : NULL;
+    size_t min_keys = _bpnodeMinKeys(child);
+
+    if (child->is_leaf) {
+        bpleaf *c = (bpleaf *)child;
+        if (left != NULL && left->num_keys > min_keys) {
+            // a) the last key of the left sibling
+            bpleaf *l = (bpleaf *)left;
+            memmove(&c->keys[1], &c->keys[0], child->num_keys * sizeof(c->keys[0]));
+            memmove(&c->values[1], &c->values[0], child->num_keys * sizeof(c->values[0]));
+            c->keys[0] = l->keys[left->num_keys - 1];
+            c->values[0] = l->values[left->num_keys - 1];
+            left->num_keys--;
+            child->num_keys++;
+            parent->keys[p - 1] = c->keys[0];
+        } else if (right != NULL && right->num_keys > min_keys) {
+            // b) the first key of the right sibling
+            bpleaf *r = (bpleaf *)right;
+            c->keys[child->num_keys] = r->keys[0];
+            c->values[child->num_keys] = r->values[0];
+            child->num_keys++;
+            right->num_keys--;
+            memmove(&r->keys[0], &r->keys[1], right->num_keys * sizeof(r->keys[0]));
+            memmove(&r->values[0], &r->values[1], right->num_keys * sizeof(r->values[0]));
+            parent->keys[p] = r->keys[0];
+        } else {
+            // c) merge the right one of the pair into the left one
+            if (left == NULL) {
+                left = child;
+                child = right;
+                p++;
+            }
+            bpleaf *l = (bpleaf *)left;
+            bpleaf *r = (bpleaf *)child;
+            memcpy(&l->keys[left->num_keys], r->keys, child->num_keys * sizeof(r->keys[0]));
+            memcpy(&l->values[left->num_keys], r->values, child->num_keys * sizeof(r->values[0]));
+            left->num_keys += child->num_keys;
+            l->next = r->next;
+            if (r->next != NULL) {
+                r->next->prev = l;
+            }
+            _bpinnerRemoveAt(parent, p);
+            _bptreeFreeNode(t, child);
+        }
+        return;
+    }
+
+    bpinner *c = (bpinner *)child;
+    if (left != NULL && left->num_keys > min_keys) {
+        // a) rotate through the parent: its separator comes down,
+        // the last key of the left sibling goes up
+        bpinner *l = (bpinner *)left;
+        memmove(&c->keys[1], &c->keys[0], child->num_keys * sizeof(c->keys[0]));
+        memmove(&c->children[1], &c->children[0], (child->num_keys + 1) * sizeof(c->children[0]));
+        c->keys[0] = parent->keys[p - 1];
+        c->children[0] = l->children[left->num_keys];
+        parent->keys[p - 1] = l->keys[left->num_keys - 1];
+        left->num_keys--;
+        child->num_keys++;
+    } else if (right != NULL && right->num_keys > min_keys) {
+        // b) the same with the right sibling
+        bpinner *r = (bpinner *)right;
+        c->keys[child->num_keys] = parent->keys[p];
+        c->children[child->num_keys + 1] = r->children[0];
+        child->num_keys++;
+        parent->keys[p] = r->keys[0];
+        right->num_keys--;
+        memmove(&r->keys[0], &r->keys[1], right->num_keys * sizeof(r->keys[0]));
+        memmove(&r->children[0], &r->children[1], (right->num_keys + 1) * sizeof(r->children[0]));
+    } else {
+        // c) merge, with the separator of the pair in between
+        if (left == NULL) {
+            left = child;
+            child = right;
+            p++;
+        }
+        bpinner *l = (bpinner *)left;
+        bpinner *r = (bpinner *)child;
+        l->keys[left->num_keys] = parent->keys[p - 1];
+        memcpy(&l->keys[left->num_keys + 1], r->keys, child->num_keys * sizeof(r->keys[0]));
+        memcpy(&l->children[left->num_keys + 1], r->children,
+               (child->num_keys + 1) * sizeof(r->children[0]));
+        left->num_keys += 1 + child->num_keys;
+        _bpinnerRemoveAt(parent, p);
+        _bptreeFreeNode(t, child);
+    }
+}
+
+// drops child p and the separator before it
+static void _bpinnerRemoveAt(bpinner *n, size_t p) {
+    assert(p > 0 && p <= n->hdr.num_keys);
+    size_t nafter = n->hdr.num_keys - p;
+    memmove(&n->keys[p - 1], &n->keys[p], nafter * sizeof(n->keys[0]));
+    memmove(&n->children[p], &n->children[p + 1], nafter * sizeof(n->children[0]));
+    n->hdr.num_keys--;
+}
+
+#ifdef BPTREE_TEST
+// Checks the order and the fill of the subtree of n, whose keys are all
+// in [lo, hi) (when has_lo, has_hi); returns its depth. *prev is the
+// last leaf seen, the leaves have to be chained in that order.
+static size_t _bpnodeCheck(bptree *t, bpnode *n, int has_lo, bptreeKeyType lo,
+                           int has_hi, bptreeKeyType hi, bpleaf **prev, size_t *count) {
+    if (n != t->root) {
+        assert(n->num_keys >= _bpnodeMinKeys(n));
+    }
+    if (n->is_leaf) {
+        bpleaf *leaf = (bpleaf *)n;
+        assert(n->num_keys <= LEAF_MAX_KEYS);
+        for (size_t i = 0; i < n->num_keys; i++) {
+            assert(i == 0 || leaf->keys[i - 1] < leaf->keys[i]);
+            assert(!has_lo || leaf->keys[i] >= lo);
+            assert(!has_hi || leaf->keys[i] < hi);
+        }
+        assert(leaf->prev == *prev);
+        if (*prev != NULL) {
+            assert((*prev)->next == leaf);
+        }
+        *prev = leaf;
+        *count += n->num_keys;
+        return 1;
+    }
+    bpinner *inner = (bpinner *)n;
+    assert(n->num_keys <= INNER_MAX_KEYS);
+    size_t depth = 0;
+    for (size_t i = 0; i <= n->num_keys; i++) {
+        assert(i == 0 || i == n->num_keys || inner->keys[i - 1] < inner->keys[i]);
+        size_t d = _bpnodeCheck(t, inner->children[i],
+                                i > 0 || has_lo, i > 0 ? inner->keys[i - 1] : lo,
+                                i < n->num_keys || has_hi, i < n->num_keys ? inner->keys[i] : hi,
+                                prev, count);
+        assert(depth == 0 || d == depth);
+        depth = d;
+    }
+    return depth + 1;
+}
+
+static void _bptreeCheck(bptree *t) {
+    bpleaf *prev = NULL;
+    size_t count = 0;
+    _bpnodeCheck(t, t->root, 0, 0, 0, 0, &prev, &count);
+    assert(prev->next == NULL);
+    assert(count == t->length);
+}
+
+extern void bptreeTest1(void) {
+    bptree *tree = bptreeNew();
+    const int n = 100000;
+    // a permutation of [0, n)
+    for (int i = 0; i < n; i++) {
+        int key = (int)(((unsigned)i * 7919u) % (unsigned)n);
+        assert(bptreeSet(tree, key, -key) == 1);
+    }
+    assert(bptreeSet(tree, 5, 55) == 0);
+    assert(bptreeLen(tree) == (size_t)n);
+    _bptreeCheck(tree);
+    for (int i = 0; i < n; i++) {
+        assert(bptreeHas(tree, i));
+        assert(bptreeGet(tree, i) == (i == 5 ? 55 : -i));
+    }
+    assert(!bptreeHas(tree, -1) && !bptreeHas(tree, n));
+
+    // every third key
+    for (int i = 0; i < n; i += 3) {
+        assert(bptreeDel(tree, i) == 1);
+    }
+    assert(bptreeDel(tree, 0) == 0);
+    _bptreeCheck(tree);
+    for (int i = 0; i < n; i++) {
+        assert(bptreeHas(tree, i) == (i % 3 != 0));
+    }
+    printf("bptree: %zu keys in %zu nodes\n", bptreeLen(tree), tree->num_nodes);
+    bptreeFree(tree);
+    tree = NULL;
+}
+
+extern void bptreeTest2(void) {
+    bptree *tree = bptreeNew();
+    for (int i = 0; i < 50000; i++) {
+        bptreeSet(tree, i * 2, i);
+    }
+    bptreeIter iter;
+    bptreeKeyType key;
+    bptreeValueType value;
+    // between two keys, on a key, before the first one, after the last one
+    bptreeSeek(tree, 1001, &iter);
+    for (int i = 0; i < 1000; i++) {
+        assert(bptreeIterNext(&iter, &key, &value));
+        assert(key == 1002 + 2 * i && value == 501 + i);
+    }
+    bptreeSeek(tree, 99990, &iter);
+    for (int k = 99990; k < 100000; k += 2) {
+        assert(bptreeIterNext(&iter, &key, &value) && key == k);
+    }
+    assert(!bptreeIterNext(&iter, &key, &value));
+    bptreeSeek(tree, -5, &iter);
+    assert(bptreeIterNext(&iter, &key, &value) && key == 0);
+    bptreeSeek(tree, 100000, &iter);
+    assert(!bptreeIterNext(&iter, &key, &value));
+
+    // the whole chain
+    size_t count = 0;
+    bptreeSeek(tree, 0, &iter);
+    for (bptreeKeyType last = -1; bptreeIterNext(&iter, &key, &value); last = key) {
+        assert(key > last);
+        count++;
+    }
+    assert(count == bptreeLen(tree));
+    bptreeFree(tree);
+    tree = NULL;
+}
+
+extern void bptreeTest3(void) {
+    bptree *tree = bptreeNew();
+    const int n = 20 * BPTREE_M;
+    for (int i = 0; i < n; i++) {
+        bptreeSet(tree, i, i);
+    }
+    // from both ends and from the middle
+    for (int i = 0; i < n / 2; i++) {
+        int key = (i % 2) ? i / 2 : n - 1 - i / 2;
+        assert(bptreeDel(tree, key) == 1);
+        if (i % 97 == 0) {
+            _bptreeCheck(tree);
+        }
+    }
+    for (int i = n / 4; i < n - n / 4; i++) {
+        assert(bptreeDel(tree, i) == 1);
+    }
+    _bptreeCheck(tree);
+    assert(bptreeLen(tree) == 0 && tree->num_nodes == 1);
+    bptreeIter iter;
+    bptreeKeyType key;
+    bptreeValueType value;
+    bptreeSeek(tree, 0, &iter);
+    assert(!bptreeIterNext(&iter, &key, &value));
+    bptreeFree(tree);
+    tree = NULL;
+}
+#endif  // BPTREE_TEST
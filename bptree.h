@@ -0,0 +1,52 @@
+// References:
+// https://en.wikipedia.org/wiki/B%2B_tree
+// https://github.com/google/btree/blob/master/btree.go  (see btree.c)
+
+// A B+tree: the keys and their values live in the leaves, the internal
+// nodes only hold separator keys. The leaves are chained in key order
+// both ways, an ordered scan reads them one after the other instead of
+// walking the tree.
+
+#ifndef _BPTREE_H_
+#define _BPTREE_H_
+
+#include <stddef.h>
+
+// >> settings
+#define BPTREE_TEST
+// max number of children of an internal node,
+// and max number of keys of a leaf
+#define BPTREE_M 256
+
+typedef int bptreeKeyType;
+typedef int bptreeValueType;
+// << settings
+
+typedef struct _bptree bptree;
+typedef struct _bpleaf bpleaf;
+
+// a position in the chain of leaves, set by bptreeSeek;
+// not valid anymore once the tree is written to
+typedef struct {
+    bpleaf *leaf;
+    size_t pos;
+} bptreeIter;
+
+// >> external API
+extern bptree* bptreeNew(void);
+extern int bptreeSet(bptree *tree, bptreeKeyType key, bptreeValueType value);
+extern bptreeValueType bptreeGet(bptree *tree, bptreeKeyType key);
+extern int bptreeHas(bptree *tree, bptreeKeyType key);
+extern int bptreeDel(bptree *tree, bptreeKeyType key);
+extern size_t bptreeLen(bptree *tree);
+extern void bptreeSeek(bptree *tree, bptreeKeyType key, bptreeIter *iter);
+extern int bptreeIterNext(bptreeIter *iter, bptreeKeyType *key, bptreeValueType *value);
+extern void bptreeFree(bptree *tree);
+#ifdef BPTREE_TEST
+extern void bptreeTest1(void);
+extern void bptreeTest2(void);
+extern void bptreeTest3(void);
+#endif
+// << external API
+
+#endif  // _BPTREE_H_
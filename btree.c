@@ -2,28 +2,83 @@
 // https://github.com/google/btree/blob/master/btree.go
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "btree.h"
+#include "alloc.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define UNUSED(x) (void)(x)
 
+// the in-node search halves the keys down to this many,
+// then compares them all at once
+#define SEARCH_WINDOW 64
+// the vector compares read 4-byte signed keys
+#define SEARCH_VECTOR _Generic((btreeKeyType)0, int: 1, default: 0)
+
+// as malloc would align them
+#define NODE_ALIGN 16
+// the nodes of a slab start past its first cache line
+#define SLAB_HEADER_BYTES 64
+#define SLAB_MIN_NODES 16
+
 typedef struct _btnode btnode;
+typedef struct _btslab btslab;
+typedef struct _btpool btpool;
+
+// A leaf is this header and MaxKeys keys. An internal node is the same
+// followed by MaxKeys+1 child pointers at children_offset; the order is
+// only known at run time, so are the offset and the sizes.
+struct _btnode {
+    uint32_t num_keys;
+    uint32_t num_children;
+    btreeKeyType keys[];
+};
+
+// Nodes of one size, carved out of slabs. A slab is slab_bytes large and
+// aligned to it, so the slab of a node is its address rounded down. The
+// nodes given back to a slab are linked through their first word.
+struct _btslab {
+    btpool *pool;
+    // all the slabs of the pool
+    btslab *prev;
+    btslab *next;
+    // the slabs with free nodes
+    btslab *prev_free;
+    btslab *next_free;
+    void *free_nodes;
+    size_t num_carved;  // the nodes past these were never handed out
+    size_t num_used;
+};
 
-struct __attribute__ ((__packed__)) _btnode {
-    size_t num_keys;
-    size_t num_children;
-    btreeKeyType *keys;
-    btnode **children;
+struct _btpool {
+    size_t node_bytes;
+    size_t slab_bytes;
+    size_t nodes_per_slab;
+    size_t num_slabs;
+    btslab *slabs;
+    btslab *free_slabs;
+    // an empty slab is kept for the next split, the others are freed
+    btslab *empty_slab;
 };
 
-struct __attribute__ ((__packed__)) _btree {
+struct _btree {
     size_t degree;
     size_t length;
     size_t num_nodes;
-    size_t node_bytes;  // size of a node
+    size_t leaf_bytes;      // size of a leaf
+    size_t internal_bytes;  // size of an internal node
+    size_t children_offset;
     btnode *root;
+    // one pool per node size, their slabs have the same size
+    size_t slab_bytes;
+    btpool leaves;
+    btpool internals;
 };
 
 // >> internal functions
@@ -36,44 +91,75 @@ static inline size_t MaxKeys(btree *t) {
 static inline int isLeaf(btnode *n) {
     return (n->num_children == 0);
 }
-static btnode* _btreeNewNode(btree *t);
+static inline btnode** Children(btree *t, btnode *n) {
+    return (btnode**)((char*)n + t->children_offset);
+}
+static btnode* _btreeNewNode(btree *t, int leaf);
 static void _btnodeInit(btnode *node);
 static void _btreeFreeNode(btree *t, btnode *node);
-static void _btreeFreeNodeR(btree *t, btnode *node);
+static void _btpoolInit(btpool *pool, size_t node_bytes, size_t slab_bytes);
+static void* _btpoolAlloc(btpool *pool);
+static void _btpoolFree(btslab *slab, void *node);
+static void _btpoolRelease(btpool *pool);
+static void _btpoolLinkFree(btpool *pool, btslab *slab);
+static void _btpoolUnlinkFree(btpool *pool, btslab *slab);
 static void _btnodeInsertKeyAt(btree *t, btnode *n, size_t p, btreeKeyType key);
 static void _btnodeInsertChildAt(btree *t, btnode *n, size_t p, btnode *child);
 static btreeKeyType _btnodeRemoveKeyAt(btree *t, btnode *n, size_t p);
 static btnode* _btnodeRemoveChildAt(btree *t, btnode *n, size_t p);
 static int _btnodeRemove(btree *t, btnode* n, btreeKeyType key);
-static size_t ArrSearchKey(btreeKeyType keys[], size_t len, btreeKeyType key, int *found);
+static size_t ArrSearchKey(const btreeKeyType keys[], size_t len, btreeKeyType key, int *found);
+#ifndef BTREE_BINARY_SEARCH
+static size_t ArrCountLess(const btreeKeyType keys[], size_t len, btreeKeyType key);
+#endif
 static size_t _btnodeSearchKey(btnode *node, btreeKeyType key, int *found);
 static int _btnodeInsert(btree *t, btnode *node, btreeKeyType key);
 static btreeKeyType _btnodeSplitToRight(btree *t, btnode *node_l, btnode *node_r);
 static btnode* _btnodeMergeToLeft(btree *t, btnode *node_l, btnode *node_r);
 static int _btnodeMaybeSplitChild(btree *t, btnode *node, size_t p);
-static btnode* _btnodeMinSubNode(btnode *node);
-static btnode* _btnodeMaxSubNode(btnode *node);
+static btnode* _btnodeMinSubNode(btree *t, btnode *node);
+static btnode* _btnodeMaxSubNode(btree *t, btnode *node);
 static btnode* _btreeMinNode(btree *tree);
 static btnode* _btreeMaxNode(btree *tree);
+static void _btreeCursorDescend(btreeCursor *c, btnode *node, int rightmost);
+static btnode* _btreeCursorAhead(btreeCursor *c, size_t *level);
+static btnode* _btreeCursorBehind(btreeCursor *c, size_t *level);
 // << internal functions
 
 
 extern btree* btreeNew(void) {
+    return btreeNewWithOrder(BTREE_M);
+}
+
+// order is the max number of children of a node, BTREE_M by default
+extern btree* btreeNewWithOrder(size_t order) {
+    assert(order >= 3);
     btree *tree = (btree *)malloc(sizeof(btree));
-    tree->degree = ((BTREE_M / 2) + (BTREE_M&1));
+    tree->degree = ((order / 2) + (order&1));
     tree->length = 0;
     tree->num_nodes = 0;
-    tree->node_bytes = sizeof(btnode)
-                       + sizeof(btreeKeyType) * MaxKeys(tree)
-                       + sizeof(btnode*) * (MaxKeys(tree) + 1);
-    tree->root = _btreeNewNode(tree);
+    assert(MaxKeys(tree) < UINT32_MAX);
+    tree->leaf_bytes = sizeof(btnode) + sizeof(btreeKeyType) * MaxKeys(tree);
+    tree->children_offset = (tree->leaf_bytes + _Alignof(btnode*) - 1)
+                            & ~(_Alignof(btnode*) - 1);
+    tree->internal_bytes = tree->children_offset + sizeof(btnode*) * (MaxKeys(tree) + 1);
+    tree->slab_bytes = BTREE_SLAB_BYTES;
+    assert((BTREE_SLAB_BYTES & (BTREE_SLAB_BYTES - 1)) == 0);
+    for (; tree->slab_bytes < SLAB_HEADER_BYTES + SLAB_MIN_NODES * tree->internal_bytes; ) {
+        tree->slab_bytes <<= 1;
+    }
+    _btpoolInit(&tree->leaves, tree->leaf_bytes, tree->slab_bytes);
+    _btpoolInit(&tree->internals, tree->internal_bytes, tree->slab_bytes);
+    tree->root = _btreeNewNode(tree, 1);
 
     return tree;
 }
 
 extern void btreeFree(btree *tree) {
     assert(tree != NULL);
-    _btreeFreeNodeR(tree, tree->root);
+    // the nodes all live in the slabs, no need to walk the tree
+    _btpoolRelease(&tree->leaves);
+    _btpoolRelease(&tree->internals);
     free(tree);
 }
 
@@ -83,15 +169,15 @@ extern int btreeSet(btree *tree, btreeKeyType key) {
 
     btnode *root = tree->root;
     if (root == NULL) {
-        root = _btreeNewNode(tree);
+        root = _btreeNewNode(tree, 1);
         _btnodeInsertKeyAt(tree, root, 0, key);
         tree->length++;
         return 1;
     }
     if (root->num_keys >= MaxKeys(tree)) {
-        btnode *new_right = _btreeNewNode(tree);
+        btnode *new_right = _btreeNewNode(tree, isLeaf(root));
         btreeKeyType mid_key = _btnodeSplitToRight(tree, root, new_right);
-        btnode *new_root = _btreeNewNode(tree);
+        btnode *new_root = _btreeNewNode(tree, 0);
         _btnodeInsertKeyAt(tree, new_root, 0, mid_key);
         _btnodeInsertChildAt(tree, new_root, 0, root);
         _btnodeInsertChildAt(tree, new_root, 1, new_right);
@@ -115,7 +201,7 @@ extern int btreeGet(btree *t, btreeKeyType key) {
     btnode *node = t->root;
     do {
         p = _btnodeSearchKey(node, key, &found);
-    } while (!found && !isLeaf(node) && (node = node->children[p]));
+    } while (!found && !isLeaf(node) && (node = Children(t, node)[p]));
 
     assert(found);
     // return node->values[p];
@@ -134,7 +220,7 @@ extern int btreeHas(btree *t, btreeKeyType key) {
     btnode *node = t->root;
     do {
         p = _btnodeSearchKey(node, key, &found);
-    } while (!found && !isLeaf(node) && (node = node->children[p]));
+    } while (!found && !isLeaf(node) && (node = Children(t, node)[p]));
 
     return found;
 }
@@ -151,7 +237,7 @@ extern int btreeDel(btree *t, btreeKeyType key) {
 
     if (t->root->num_keys == 0 && t->root->num_children > 0) {
         btnode* oldroot = t->root;
-        t->root = t->root->children[0];
+        t->root = Children(t, t->root)[0];
         _btreeFreeNode(t, oldroot);
     }
     if (deleted) {
@@ -161,15 +247,115 @@ extern int btreeDel(btree *t, btreeKeyType key) {
     return deleted;
 }
 
-static btnode* _btreeNewNode(btree *t) {
-    btnode* node;
-    node = (btnode *)malloc(t->node_bytes);
+// the cursor is set before the first key >= key
+extern void btreeSeek(btree *tree, btreeKeyType key, btreeCursor *cursor) {
+    assert(tree != NULL && tree->root != NULL);
+    int found = 0;
+    btnode *node = tree->root;
+    cursor->tree = tree;
+    cursor->depth = 0;
+    for (;;) {
+        assert(cursor->depth < BTREE_MAX_HEIGHT);
+        size_t p = _btnodeSearchKey(node, key, &found);
+        cursor->path[cursor->depth].node = node;
+        cursor->path[cursor->depth].pos = p;
+        cursor->depth++;
+        if (isLeaf(node)) {
+            return;
+        }
+        if (found) {
+            // the gap before an internal key is the end of
+            // the rightmost leaf on its left
+            _btreeCursorDescend(cursor, Children(tree, node)[p], 1);
+            return;
+        }
+        node = Children(tree, node)[p];
+    }
+}
+
+// returns 0 past the last key
+extern int btreeCursorNext(btreeCursor *cursor, btreeKeyType *key) {
+    size_t level;
+    btnode *node = _btreeCursorAhead(cursor, &level);
+    if (node == NULL) {
+        return 0;
+    }
+    *key = node->keys[cursor->path[level].pos++];
+    if (level + 1 < cursor->depth) {
+        // right after an internal key: the start of the leftmost leaf on its right
+        cursor->depth = level + 1;
+        _btreeCursorDescend(cursor, Children(cursor->tree, node)[cursor->path[level].pos], 0);
+    }
+    return 1;
+}
+
+// returns 0 before the first key
+extern int btreeCursorPrev(btreeCursor *cursor, btreeKeyType *key) {
+    size_t level;
+    btnode *node = _btreeCursorBehind(cursor, &level);
+    if (node == NULL) {
+        return 0;
+    }
+    *key = node->keys[--cursor->path[level].pos];
+    if (level + 1 < cursor->depth) {
+        cursor->depth = level + 1;
+        _btreeCursorDescend(cursor, Children(cursor->tree, node)[cursor->path[level].pos], 1);
+    }
+    return 1;
+}
+
+// Copies up to max keys < hi from the cursor on into out, and moves the
+// cursor past them. Returns the number of keys copied, less than max once
+// the range ends; calling again gets the next page.
+extern size_t btreeCursorRead(btreeCursor *cursor, btreeKeyType hi,
+                              btreeKeyType out[], size_t max) {
+    size_t n = 0;
+    for (; n < max; ) {
+        // the rest of the leaf in one go
+        btnode *leaf = cursor->path[cursor->depth - 1].node;
+        size_t pos = cursor->path[cursor->depth - 1].pos;
+        size_t end = leaf->num_keys;
+        if (end - pos > max - n) {
+            end = pos + (max - n);
+        }
+        if (end > pos && leaf->keys[end - 1] >= hi) {
+            end = pos + ArrSearchKey(&leaf->keys[pos], end - pos, hi, NULL);
+            memcpy(&out[n], &leaf->keys[pos], (end - pos) * sizeof(out[0]));
+            cursor->path[cursor->depth - 1].pos = end;
+            return n + (end - pos);
+        }
+        memcpy(&out[n], &leaf->keys[pos], (end - pos) * sizeof(out[0]));
+        cursor->path[cursor->depth - 1].pos = end;
+        n += end - pos;
+        if (n == max) {
+            break;
+        }
+
+        // then the internal key that follows the leaf
+        size_t level;
+        btnode *node = _btreeCursorAhead(cursor, &level);
+        if (node == NULL || node->keys[cursor->path[level].pos] >= hi) {
+            break;
+        }
+        btreeCursorNext(cursor, &out[n]);
+        n++;
+    }
+    return n;
+}
+
+// Copies the keys in [lo, hi) into out, up to max of them. Returns the
+// number of keys copied; if it is max, the range goes on after out[max-1].
+extern size_t btreeScanRange(btree *tree, btreeKeyType lo, btreeKeyType hi,
+                             btreeKeyType out[], size_t max) {
+    btreeCursor cursor;
+    btreeSeek(tree, lo, &cursor);
+    return btreeCursorRead(&cursor, hi, out, max);
+}
 
-    size_t _keys_offset = sizeof(btnode);
-    size_t _children_offset = _keys_offset + sizeof(btreeKeyType) * MaxKeys(t);
-    char *node_base = (char*)node;
-    node->keys = (btreeKeyType*)(&node_base[_keys_offset]);
-    node->children = (btnode**)(&node_base[_children_offset]);
+// leaves have no room for children
+static btnode* _btreeNewNode(btree *t, int leaf) {
+    btnode* node;
+    node = (btnode *)_btpoolAlloc(leaf ? &t->leaves : &t->internals);
     _btnodeInit(node);
 
     t->num_nodes++; 
@@ -183,17 +369,125 @@ static void _btnodeInit(btnode *node) {
 }
 
 static void _btreeFreeNode(btree *t, btnode *node) {
-    free(node);
+    btslab *slab = (btslab *)((uintptr_t)node & ~(uintptr_t)(t->slab_bytes - 1));
+    _btpoolFree(slab, node);
     t->num_nodes--;
 }
 
-static void _btreeFreeNodeR(btree *t, btnode *node) {
-    if (isLeaf(node)) {
-        _btreeFreeNode(t, node);
-    } else {
-        for (size_t i = 0; i < node->num_children; i++) {
-            _btreeFreeNodeR(t, node->children[i]);
+static void _btpoolInit(btpool *pool, size_t node_bytes, size_t slab_bytes) {
+    pool->node_bytes = (node_bytes + NODE_ALIGN - 1) & ~(size_t)(NODE_ALIGN - 1);
+    pool->slab_bytes = slab_bytes;
+    assert(sizeof(btslab) <= SLAB_HEADER_BYTES);
+    pool->nodes_per_slab = (slab_bytes - SLAB_HEADER_BYTES) / pool->node_bytes;
+    assert(pool->nodes_per_slab > 0);
+    pool->num_slabs = 0;
+    pool->slabs = NULL;
+    pool->free_slabs = NULL;
+    pool->empty_slab = NULL;
+}
+
+static void* _btpoolAlloc(btpool *pool) {
+    btslab *slab = pool->free_slabs;
+    if (slab == NULL) {
+        slab = (btslab *)aligned_alloc(pool->slab_bytes, pool->slab_bytes);
+        assert(slab != NULL);
+#ifdef MADV_HUGEPAGE
+        if (pool->slab_bytes >= ALLOC_HUGE_PAGE_SIZE) {
+            madvise(slab, pool->slab_bytes, MADV_HUGEPAGE);
+        }
+#endif
+        slab->pool = pool;
+        slab->free_nodes = NULL;
+        slab->num_carved = 0;
+        slab->num_used = 0;
+        slab->prev = NULL;
+        slab->next = pool->slabs;
+        if (pool->slabs != NULL) {
+            pool->slabs->prev = slab;
         }
+        pool->slabs = slab;
+        _btpoolLinkFree(pool, slab);
+        pool->num_slabs++;
+    }
+    if (slab == pool->empty_slab) {
+        pool->empty_slab = NULL;
+    }
+
+    void *node;
+    if (slab->free_nodes != NULL) {
+        node = slab->free_nodes;
+        slab->free_nodes = *(void **)node;
+    } else {
+        node = (char *)slab + SLAB_HEADER_BYTES + slab->num_carved * pool->node_bytes;
+        slab->num_carved++;
+    }
+    slab->num_used++;
+    if (slab->num_used == pool->nodes_per_slab) {
+        _btpoolUnlinkFree(pool, slab);
+    }
+    return node;
+}
+
+static void _btpoolFree(btslab *slab, void *node) {
+    btpool *pool = slab->pool;
+    *(void **)node = slab->free_nodes;
+    slab->free_nodes = node;
+    if (slab->num_used == pool->nodes_per_slab) {
+        _btpoolLinkFree(pool, slab);
+    }
+    slab->num_used--;
+    if (slab->num_used > 0) {
+        return;
+    }
+    if (pool->empty_slab == NULL) {
+        pool->empty_slab = slab;
+        return;
+    }
+
+    // the tree shrank, give the slab back
+    _btpoolUnlinkFree(pool, slab);
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        pool->slabs = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    free(slab);
+    pool->num_slabs--;
+}
+
+// frees all the slabs, and the nodes still in them
+static void _btpoolRelease(btpool *pool) {
+    for (btslab *slab = pool->slabs; slab != NULL; ) {
+        btslab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->free_slabs = NULL;
+    pool->empty_slab = NULL;
+    pool->num_slabs = 0;
+}
+
+static void _btpoolLinkFree(btpool *pool, btslab *slab) {
+    slab->prev_free = NULL;
+    slab->next_free = pool->free_slabs;
+    if (pool->free_slabs != NULL) {
+        pool->free_slabs->prev_free = slab;
+    }
+    pool->free_slabs = slab;
+}
+
+static void _btpoolUnlinkFree(btpool *pool, btslab *slab) {
+    if (slab->prev_free != NULL) {
+        slab->prev_free->next_free = slab->next_free;
+    } else {
+        pool->free_slabs = slab->next_free;
+    }
+    if (slab->next_free != NULL) {
+        slab->next_free->prev_free = slab->prev_free;
     }
 }
 
@@ -216,12 +510,12 @@ static void _btnodeInsertChildAt(btree *t, btnode *n, size_t p, btnode *child) {
     assert(p <= n->num_children);
     if (p < n->num_children) {
         memmove(
-            &n->children[p+1],
-            &n->children[p],
-            (n->num_children - p) * sizeof(n->children[0])
+            &Children(t, n)[p+1],
+            &Children(t, n)[p],
+            (n->num_children - p) * sizeof(btnode*)
         );
     }
-    n->children[p] = child;
+    Children(t, n)[p] = child;
     n->num_children++;
 }
 
@@ -243,12 +537,12 @@ static btreeKeyType _btnodeRemoveKeyAt(btree *t, btnode *n, size_t p) {
 static btnode* _btnodeRemoveChildAt(btree *t, btnode *n, size_t p) {
     UNUSED(t);
     assert(p < n->num_children);
-    btnode *child_removed = n->children[p];
+    btnode *child_removed = Children(t, n)[p];
 
     memmove(
-        &n->children[p],
-        &n->children[p+1],
-        (n->num_children - p - 1) * sizeof(n->children[0])
+        &Children(t, n)[p],
+        &Children(t, n)[p+1],
+        (n->num_children - p - 1) * sizeof(btnode*)
     );
 
     n->num_children--;
@@ -256,24 +550,25 @@ static btnode* _btnodeRemoveChildAt(btree *t, btnode *n, size_t p) {
 }
 
 static void _btnodeGrowChild(btree *t, btnode *n, size_t child_p, btreeKeyType key) {
-    if (child_p > 0 && n->children[child_p-1]->num_keys > MinKeys(t)) {
+    if (child_p > 0 && Children(t, n)[child_p-1]->num_keys > MinKeys(t)) {
         // a) left sibling has node to spare
-        btnode *child = n->children[child_p];
-        btnode *left_sibling = n->children[child_p-1];
+        btnode *child = Children(t, n)[child_p];
+        btnode *left_sibling = Children(t, n)[child_p-1];
         // shifting 2 keys
-        btreeKeyType predecessor_key = _btnodeRemoveKeyAt(t, left_sibling, left_sibling->num_keys);
+        btreeKeyType predecessor_key = _btnodeRemoveKeyAt(t, left_sibling, left_sibling->num_keys - 1);
         btreeKeyType parent_key = n->keys[child_p-1];
+        n->keys[child_p-1] = predecessor_key;
         _btnodeInsertKeyAt(t, child, 0, parent_key);
 
         if (!isLeaf(left_sibling)) {
-            btnode *predecessor_child = _btnodeRemoveChildAt(t, left_sibling, left_sibling->num_children);
+            btnode *predecessor_child = _btnodeRemoveChildAt(t, left_sibling, left_sibling->num_children - 1);
             _btnodeInsertChildAt(t, child, 0, predecessor_child);
         }
 
-    } else if (child_p < n->num_children && n->children[child_p+1]->num_keys > MinKeys(t)) {
+    } else if (child_p < n->num_keys && Children(t, n)[child_p+1]->num_keys > MinKeys(t)) {
         // b) right sibling has node to spare
-        btnode *child = n->children[child_p];
-        btnode *right_sibling = n->children[child_p+1];
+        btnode *child = Children(t, n)[child_p];
+        btnode *right_sibling = Children(t, n)[child_p+1];
         // shifting 2 keys
         btreeKeyType successor_key = _btnodeRemoveKeyAt(t, right_sibling, 0);
         btreeKeyType parent_key = n->keys[child_p];
@@ -287,7 +582,7 @@ static void _btnodeGrowChild(btree *t, btnode *n, size_t child_p, btreeKeyType k
 
     } else {
         // c) we must merge
-        btnode *child = n->children[child_p];
+        btnode *child = Children(t, n)[child_p];
         if (child_p == 0) {
             // merge with right sibling
             btnode *right_sibling = _btnodeRemoveChildAt(t, n, child_p + 1);
@@ -299,7 +594,8 @@ static void _btnodeGrowChild(btree *t, btnode *n, size_t child_p, btreeKeyType k
             _btreeFreeNode(t, right_sibling);
         } else {
             // merge with left sibling
-            btnode *left_sibling = _btnodeRemoveChildAt(t, n, child_p - 1);
+            btnode *left_sibling = Children(t, n)[child_p - 1];
+            _btnodeRemoveChildAt(t, n, child_p);
             btreeKeyType parent_key = _btnodeRemoveKeyAt(t, n, child_p - 1);
 
             _btnodeInsertKeyAt(t, left_sibling, left_sibling->num_keys, parent_key);
@@ -328,7 +624,7 @@ static int _btnodeRemove(btree *t, btnode* n, btreeKeyType key) {
     }
 
     // 2. internal node
-    if (n->children[pos]->num_keys <=  MinKeys(t)) {
+    if (Children(t, n)[pos]->num_keys <=  MinKeys(t)) {
         // B) node doesn't have enough values
         // make sure the child node still have enough keys after a possible deletion
         _btnodeGrowChild(t, n, pos, key);
@@ -338,22 +634,66 @@ static int _btnodeRemove(btree *t, btnode* n, btreeKeyType key) {
 
     // A) node has enough values that it can spare one
     if (found) {
-        btreeKeyType key_deleted = n->keys[pos];
-         // let its predecessor key fill this slot
-        btnode *max_sub = _btnodeMaxSubNode(n->children[pos]);
-        n->keys[pos] = _btnodeRemoveKeyAt(t, max_sub, n->num_keys);
+        // let its predecessor key fill this slot,
+        // then remove the predecessor from the child
+        btnode *max_sub = _btnodeMaxSubNode(t, Children(t, n)[pos]);
+        n->keys[pos] = max_sub->keys[max_sub->num_keys - 1];
 
-        return key_deleted;
+        return _btnodeRemove(t, Children(t, n)[pos], n->keys[pos]);
     } else {
         // final recursive call
-        return _btnodeRemove(t, n->children[pos], key);
+        return _btnodeRemove(t, Children(t, n)[pos], key);
     }
 
     assert(0);
 }
 
+#ifndef BTREE_BINARY_SEARCH
+// Returns the position of the first key >= key. Each halving step picks
+// its half with a conditional move rather than a branch, which would
+// mispredict half of the time; the last SEARCH_WINDOW keys at most are
+// counted with vector compares.
+static size_t ArrSearchKey(const btreeKeyType keys[], size_t len, btreeKeyType key, int *found) {
+    const btreeKeyType *base = keys;
+    size_t n = len;
+    // the position is in [base, base + n], the keys before base are < key
+    // and the keys from base + n on are >= key
+    for (; n > SEARCH_WINDOW; ) {
+        size_t half = n / 2;
+        base = (base[half - 1] < key) ? base + half : base;
+        n -= half;
+    }
+    size_t p = (size_t)(base - keys) + ArrCountLess(base, n, key);
+    if (found != NULL) *found = (p < len && keys[p] == key);
+    return p;
+}
+
+// the number of keys < key
+static size_t ArrCountLess(const btreeKeyType keys[], size_t len, btreeKeyType key) {
+    size_t count = 0,
+           i = 0;
+#ifdef __SSE2__
+    if (SEARCH_VECTOR) {
+        // each lane counts down by one per key < key
+        __m128i k = _mm_set1_epi32((int)key);
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 4 <= len; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)&keys[i]);
+            acc = _mm_add_epi32(acc, _mm_cmplt_epi32(v, k));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        count = (size_t)-_mm_cvtsi128_si32(acc);
+    }
+#endif
+    for (; i < len; i++) {
+        count += (keys[i] < key);
+    }
+    return count;
+}
+#else
 // a general function using binary search
-static size_t ArrSearchKey(btreeKeyType keys[], size_t len, btreeKeyType key, int *found) {
+static size_t ArrSearchKey(const btreeKeyType keys[], size_t len, btreeKeyType key, int *found) {
     if (found != NULL) *found = 0;
     size_t left_p = 0,
            right_p = len,
@@ -373,6 +713,7 @@ static size_t ArrSearchKey(btreeKeyType keys[], size_t len, btreeKeyType key, in
     }
     return left_p;
 }
+#endif  // BTREE_BINARY_SEARCH
 
 static size_t _btnodeSearchKey(btnode *node, btreeKeyType key, int *found) {
     return ArrSearchKey(node->keys, node->num_keys, key, found);
@@ -403,7 +744,7 @@ static int _btnodeInsert(btree *t, btnode *node, btreeKeyType key) {
             return 0;
         }
     }
-    return _btnodeInsert(t, node->children[pos], key);
+    return _btnodeInsert(t, Children(t, node)[pos], key);
 }
 
 static btreeKeyType _btnodeSplitToRight(btree *t, btnode *node_l, btnode *node_r) {
@@ -422,13 +763,14 @@ static btreeKeyType _btnodeSplitToRight(btree *t, btnode *node_l, btnode *node_r
     node_r->num_keys = nkeys - mid_p - 1;
 
     if (!isLeaf(node_l)) {
+        size_t nchildren = node_l->num_children;
         memmove(
-            node_r->children,
-            &node_l->children[mid_p + 2],
-            (node_l->num_children - mid_p - 2) * sizeof(node_l->children[0])
+            Children(t, node_r),
+            &Children(t, node_l)[mid_p + 1],
+            (nchildren - mid_p - 1) * sizeof(btnode*)
         );
         node_l->num_children = mid_p + 1;
-        node_r->num_children = node_l->num_children - mid_p - 2;
+        node_r->num_children = nchildren - mid_p - 1;
     }
 
     return mid_key;
@@ -448,9 +790,9 @@ static btnode* _btnodeMergeToLeft(btree *t, btnode *node_l, btnode *node_r) {
 
     if (node_r->num_children) {
         memmove(
-            &node_l->children[node_l->num_children],
-            &node_r->children[0],
-            node_r->num_children * sizeof(node_r->children[0])
+            &Children(t, node_l)[node_l->num_children],
+            &Children(t, node_r)[0],
+            node_r->num_children * sizeof(btnode*)
         );
         node_l->num_children = new_nchildren;
     }
@@ -460,11 +802,11 @@ static btnode* _btnodeMergeToLeft(btree *t, btnode *node_l, btnode *node_r) {
 
 // Returns whether or not a split occurred.
 static int _btnodeMaybeSplitChild(btree *t, btnode *node, size_t p) {
-    btnode *child = node->children[p];
+    btnode *child = Children(t, node)[p];
     if (child->num_keys < MaxKeys(t)) {
         return 0;
     } else {
-        btnode *new_child_right = _btreeNewNode(t);
+        btnode *new_child_right = _btreeNewNode(t, isLeaf(child));
         btreeKeyType mid_key = _btnodeSplitToRight(t, child, new_child_right);
         _btnodeInsertKeyAt(t, node, p, mid_key);
         _btnodeInsertChildAt(t, node, p + 1, new_child_right);
@@ -472,26 +814,64 @@ static int _btnodeMaybeSplitChild(btree *t, btnode *node, size_t p) {
     }
 }
 
-static btnode* _btnodeMinSubNode(btnode *node) {
+static btnode* _btnodeMinSubNode(btree *t, btnode *node) {
     for (; !isLeaf(node); ) {
-        node = node->children[0];
+        node = Children(t, node)[0];
     }
     return node;
 }
 
-static btnode* _btnodeMaxSubNode(btnode *node) {
+static btnode* _btnodeMaxSubNode(btree *t, btnode *node) {
     for (; !isLeaf(node); ) {
-        node = node->children[node->num_children - 1];
+        node = Children(t, node)[node->num_children - 1];
     }
     return node;
 }
 
 static btnode* _btreeMinNode(btree *tree) {
-    return _btnodeMinSubNode(tree->root);
+    return _btnodeMinSubNode(tree, tree->root);
 }
 
 static btnode* _btreeMaxNode(btree *tree) {
-    return _btnodeMaxSubNode(tree->root);
+    return _btnodeMaxSubNode(tree, tree->root);
+}
+
+// pushes the path from node down to its leftmost or rightmost leaf
+static void _btreeCursorDescend(btreeCursor *c, btnode *node, int rightmost) {
+    for (;;) {
+        assert(c->depth < BTREE_MAX_HEIGHT);
+        c->path[c->depth].node = node;
+        c->path[c->depth].pos = rightmost ? node->num_keys : 0;
+        c->depth++;
+        if (isLeaf(node)) {
+            return;
+        }
+        node = Children(c->tree, node)[c->path[c->depth - 1].pos];
+    }
+}
+
+// The node holding the key right after the cursor, the leaf or the
+// closest ancestor the path has not gone past yet; NULL at the end.
+static btnode* _btreeCursorAhead(btreeCursor *c, size_t *level) {
+    for (size_t i = c->depth; i > 0; i--) {
+        btnode *node = c->path[i - 1].node;
+        if (c->path[i - 1].pos < node->num_keys) {
+            *level = i - 1;
+            return node;
+        }
+    }
+    return NULL;
+}
+
+// the same for the key right before the cursor
+static btnode* _btreeCursorBehind(btreeCursor *c, size_t *level) {
+    for (size_t i = c->depth; i > 0; i--) {
+        if (c->path[i - 1].pos > 0) {
+            *level = i - 1;
+            return c->path[i - 1].node;
+        }
+    }
+    return NULL;
 }
 
 #ifdef BTREE_TEST
@@ -522,7 +902,7 @@ extern void btreePrint(btree *tree) {
         node = nodes_list[left_p];
         if (!isLeaf(node)) {
             for (size_t i = 0; i < node->num_keys + 1; i++) {
-                nodes_list[right_p] = node->children[i];
+                nodes_list[right_p] = Children(tree, node)[i];
                 right_p++;
             }
         }
@@ -605,4 +985,143 @@ extern void btreeTestDelAll(void) {
     btreeFree(tree);
     tree = NULL;
 }
+
+extern void btreeTest4(void) {
+    btree *tree = btreeNew();
+    const int n = 200000;
+    // the even numbers in [0, 2n), then every third of them removed
+    for (int i = 0; i < n; i++) {
+        btreeSet(tree, (int)(((unsigned)i * 7919u) % (unsigned)n) * 2);
+    }
+    for (int i = 0; i < n; i += 3) {
+        assert(btreeDel(tree, i * 2) == 1);
+    }
+    assert(btreeHas(tree, 6) == 0 && btreeHas(tree, 8) == 1);
+
+    btreeCursor cursor;
+    btreeKeyType key;
+    // forward over everything, then back
+    size_t count = 0;
+    btreeSeek(tree, -1, &cursor);
+    assert(btreeCursorPrev(&cursor, &key) == 0);
+    for (int k = 0; k < 2 * n; k += 2) {
+        if (k % 6 != 0) {
+            assert(btreeCursorNext(&cursor, &key) && key == k);
+            count++;
+        }
+    }
+    assert(btreeCursorNext(&cursor, &key) == 0);
+    assert(count == tree->length);
+    for (int k = 2 * n - 2; k >= 0; k -= 2) {
+        if (k % 6 != 0) {
+            assert(btreeCursorPrev(&cursor, &key) && key == k);
+        }
+    }
+    assert(btreeCursorPrev(&cursor, &key) == 0);
+
+    // on a key, between keys, and back and forth
+    btreeSeek(tree, 1000, &cursor);
+    assert(btreeCursorNext(&cursor, &key) && key == 1000);
+    assert(btreeCursorPrev(&cursor, &key) && key == 1000);
+    assert(btreeCursorPrev(&cursor, &key) && key == 998);
+    btreeSeek(tree, 1001, &cursor);
+    assert(btreeCursorNext(&cursor, &key) && key == 1004);
+    btreeSeek(tree, 2 * n, &cursor);
+    assert(btreeCursorNext(&cursor, &key) == 0);
+    assert(btreeCursorPrev(&cursor, &key) && key == 2 * n - 2);
+
+    // a range in pages of 100
+    btreeKeyType page[100];
+    int expect = 1001;
+    btreeSeek(tree, 1001, &cursor);
+    for (size_t got; (got = btreeCursorRead(&cursor, 90001, page, 100)) > 0; ) {
+        for (size_t i = 0; i < got; i++) {
+            for (expect++; expect % 2 != 0 || expect % 6 == 0; expect++) {}
+            assert(page[i] == expect);
+        }
+        if (got < 100) {
+            break;
+        }
+    }
+    assert(expect == 89998);
+    assert(btreeScanRange(tree, 10, 20, page, 100) == 3);
+    assert(page[0] == 10 && page[1] == 14 && page[2] == 16);
+    assert(btreeScanRange(tree, 10, 2 * n, page, 2) == 2 && page[1] == 14);
+    assert(btreeScanRange(tree, 2 * n, 3 * n, page, 100) == 0);
+
+    btreeFree(tree);
+    tree = NULL;
+}
+
+extern void btreeTest5(void) {
+    btreeKeyType keys[100];
+    for (int i = 0; i < 100; i++) {
+        keys[i] = 2 * i - 50;
+    }
+    // every length around the window, every key and every gap
+    for (size_t len = 0; len <= 100; len++) {
+        for (int key = -52; key <= 150; key++) {
+            int found;
+            size_t p = ArrSearchKey(keys, len, key, &found);
+            size_t expect = 0;
+            for (; expect < len && keys[expect] < key; expect++) {}
+            assert(p == expect);
+            assert(found == (p < len && keys[p] == key));
+        }
+    }
+
+    // the same trees at other orders
+    size_t orders[] = {3, 4, 33, 1024};
+    for (size_t i = 0; i < sizeof(orders) / sizeof(orders[0]); i++) {
+        btree *tree = btreeNewWithOrder(orders[i]);
+        for (int k = 0; k < 50000; k++) {
+            btreeSet(tree, (int)(((unsigned)k * 7919u) % 50000u));
+        }
+        for (int k = 0; k < 50000; k += 2) {
+            assert(btreeDel(tree, k) == 1);
+        }
+        for (int k = -1; k <= 50000; k++) {
+            assert(btreeHas(tree, k) == (k >= 0 && k < 50000 && (k & 1)));
+        }
+        btreeFree(tree);
+    }
+}
+
+extern void btreeTest6(void) {
+    btree *tree = btreeNew();
+    assert(((uintptr_t)tree->root & (NODE_ALIGN - 1)) == 0);
+    const int n = 200000;
+    for (int i = 0; i < n; i++) {
+        btreeSet(tree, (int)(((unsigned)i * 7919u) % (unsigned)n));
+    }
+    size_t num_slabs = tree->leaves.num_slabs + tree->internals.num_slabs;
+    size_t capacity = tree->leaves.num_slabs * tree->leaves.nodes_per_slab
+                      + tree->internals.num_slabs * tree->internals.nodes_per_slab;
+    assert(tree->num_nodes <= capacity);
+    printf("%zu nodes in %zu slabs of %zu KB\n",
+           tree->num_nodes, num_slabs, tree->slab_bytes >> 10);
+
+    // the freed nodes are used again before a new slab
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < n; i += 2) {
+            btreeDel(tree, i);
+        }
+        for (int i = 0; i < n; i += 2) {
+            btreeSet(tree, i);
+        }
+    }
+    assert(tree->leaves.num_slabs + tree->internals.num_slabs <= num_slabs + 2);
+
+    // back to one leaf: at most one empty slab stays in each pool
+    for (int i = 0; i < n; i++) {
+        assert(btreeDel(tree, i) == 1);
+    }
+    assert(tree->num_nodes == 1);
+    assert(tree->leaves.num_slabs <= 2 && tree->internals.num_slabs <= 1);
+    btreeSet(tree, 1);
+    assert(btreeHas(tree, 1));
+
+    btreeFree(tree);
+    tree = NULL;
+}
 #endif  // BTREE_TEST
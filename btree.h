@@ -2,9 +2,18 @@
 #ifndef _BTREE_H_
 #define _BTREE_H_
 
+#include <stddef.h>
+
 // >> settings
 #define BTREE_TEST
+// the default order: max number of children of a node
 #define BTREE_M 400
+// the deepest path a cursor can hold, a taller tree would need
+// more than 2^32 keys even at the smallest degree
+#define BTREE_MAX_HEIGHT 32
+// the smallest slab the nodes are carved out of; from 2MB on,
+// slabs are backed by transparent huge pages
+#define BTREE_SLAB_BYTES ((size_t)64 << 10)
 
 typedef int btreeKeyType;
 // << settings
@@ -12,12 +21,32 @@ typedef int btreeKeyType;
 // #define BTREE_MinKeys ((BTREE_M / 2) + (BTREE_M&1) - 1)
 typedef struct _btree btree;
 
+// A position between two keys, kept as the path from the root down to a
+// leaf: pos is the child taken in the internal nodes and the key index in
+// the leaf. Set by btreeSeek, not valid anymore once the tree is written to.
+typedef struct {
+    btree *tree;
+    size_t depth;
+    struct {
+        struct _btnode *node;
+        size_t pos;
+    } path[BTREE_MAX_HEIGHT];
+} btreeCursor;
+
 // >> external API
 extern btree* btreeNew(void);
+extern btree* btreeNewWithOrder(size_t order);
 extern int btreeSet(btree *tree, btreeKeyType key);
 extern int btreeGet(btree *tree, btreeKeyType key);
 extern int btreeHas(btree *tree, btreeKeyType key);
 extern int btreeDel(btree *tree, btreeKeyType key);
+extern void btreeSeek(btree *tree, btreeKeyType key, btreeCursor *cursor);
+extern int btreeCursorNext(btreeCursor *cursor, btreeKeyType *key);
+extern int btreeCursorPrev(btreeCursor *cursor, btreeKeyType *key);
+extern size_t btreeCursorRead(btreeCursor *cursor, btreeKeyType hi,
+                              btreeKeyType out[], size_t max);
+extern size_t btreeScanRange(btree *tree, btreeKeyType lo, btreeKeyType hi,
+                             btreeKeyType out[], size_t max);
 extern void btreeFree(btree *tree);
 #ifdef BTREE_TEST
 extern void btreePrint(btree *tree);
@@ -25,6 +54,9 @@ extern void btreeTest1(void);
 extern void btreeTest2(void);
 extern void btreeTest3(void);
 extern void btreeTestDelAll(void);
+extern void btreeTest4(void);
+extern void btreeTest5(void);
+extern void btreeTest6(void);
 #endif
 // << external API
 
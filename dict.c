@@ -2,9 +2,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "dict.h"
+#include "epoch.h"
 
 typedef int32_t ix_t;
 
@@ -20,6 +31,107 @@ typedef int32_t ix_t;
 
 #define PERTURB_SHIFT 5
 
+// marks a deleted entry in dk_entries,
+// _DictKeys_Hash never returns it for a live key
+#define DKE_HASH_DELETED ((hash_t)-1)
+
+// access to the hash and the liveness of entry ix of DICT_KIND_COMBINED keys
+#ifdef DICT_COMPACT_ENTRIES
+#define DKE_HASH(dk, ep) _DictKeys_Hash((dk), (ep)->key)
+#define DKE_SET_HASH(ep, h) ((void)(h))
+#define DKE_IS_DELETED(dk, ix) \
+    (((DK_LIVE(dk)[(size_t)(ix) >> 6] >> ((size_t)(ix) & 63)) & 1) == 0)
+#define DKE_SET_LIVE(dk, ix) \
+    (DK_LIVE(dk)[(size_t)(ix) >> 6] |= (uint64_t)1 << ((size_t)(ix) & 63))
+#define DKE_SET_DELETED(dk, ix) \
+    (DK_LIVE(dk)[(size_t)(ix) >> 6] &= ~((uint64_t)1 << ((size_t)(ix) & 63)))
+// entries [0, n) are live, the others not
+#define DKE_SET_LIVE_RANGE(dk, n) _DictKeys_SetLiveRange((dk), (n))
+#define DK_LIVE_BYTES(nentries) ((((nentries) + 63) >> 6) * sizeof(uint64_t))
+#else
+#define DKE_HASH(dk, ep) ((ep)->hash)
+#define DKE_SET_HASH(ep, h) ((ep)->hash = (h))
+#define DKE_IS_DELETED(dk, ix) (DK_ENTRIES(dk)[ix].hash == DKE_HASH_DELETED)
+#define DKE_SET_LIVE(dk, ix) ((void)0)
+#define DKE_SET_DELETED(dk, ix) (DK_ENTRIES(dk)[ix].hash = DKE_HASH_DELETED)
+#define DKE_SET_LIVE_RANGE(dk, n) ((void)0)
+#define DK_LIVE_BYTES(nentries) 0
+#endif
+
+#define DICT_PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+
+// after the entries of DICT_KIND_FROZEN keys
+typedef struct {
+    uint64_t nbuckets;
+    uint64_t nslots;
+    // of the positions, the one of the attempt that succeeded
+    uint64_t pilot_seed;
+    // buckets with a pilot >= FROZEN_PILOT_BIG, a few percent
+    uint64_t nbig;
+    // uint8_t pilots[nbuckets], padded to 4 bytes,
+    // then uint32_t big_buckets[nbig] (sorted), uint32_t big_pilots[nbig]
+    // and uint32_t remap[nslots - nentries]
+    uint8_t pilots[];
+} DictFrozen;
+
+// a key of a home group of a swiss table, see _dictScanSwiss
+typedef struct {
+    hash_t hash;
+    DictKeyType key;
+    size_t slot;
+} DictScanSlot;
+
+// shrink when less than 1/DICT_SHRINK_RATIO of the slots are used
+#define DICT_SHRINK_RATIO 8
+
+// swiss engine
+// a control byte is either a 7-bit tag of the hash (full slot),
+// SWISS_CTRL_EMPTY or SWISS_CTRL_DELETED; the latter two have the high bit set
+#define SWISS_GROUP_SHIFT 4
+#define SWISS_GROUP_WIDTH (1 << SWISS_GROUP_SHIFT)
+#define SWISS_LOG_MINSIZE SWISS_GROUP_SHIFT
+#define SWISS_CTRL_EMPTY   ((int8_t)-128)
+#define SWISS_CTRL_DELETED ((int8_t)-2)
+#define SWISS_USABLE_FRACTION(n) ((n) - ((n) >> 3))
+// fibonacci hashing, so that the identity hash of int keys spreads over groups
+#define SWISS_MIX(hash) ((hash) * 0x9E3779B97F4A7C15ull)
+#define SWISS_H1(dk, h) ((size_t)((h) >> (64 - DK_LOG_SIZE(dk))))
+#define SWISS_H2(dk, h) ((int8_t)(((h) >> (57 - DK_LOG_SIZE(dk))) & 0x7f))
+
+// frozen engine, see dictFreeze
+// keys per bucket on average, each bucket has a 1-byte pilot
+#define FROZEN_BUCKET_KEYS 3
+// in the pilot byte of the buckets whose pilot is in the big pilots
+#define FROZEN_PILOT_BIG 0xff
+// pilots tried for a bucket
+#define FROZEN_MAX_PILOT (1 << 16)
+// the pilots place the keys in n + n/FROZEN_SLACK_RATIO slots,
+// the slots past n are remapped to the free ones below n
+#define FROZEN_SLACK_RATIO 64
+// builds with another pilot seed before dictFreeze gives up
+#define FROZEN_ATTEMPTS 4
+// x * n / 2^64, maps a hash to [0, n) without a division
+#define FROZEN_REDUCE(x, n) ((size_t)(((__uint128_t)(x) * (n)) >> 64))
+// mixed again: the sizes of the buckets have to vary, which the
+// fibonacci hashing of SWISS_MIX doesn't do for sequential int keys
+#define FROZEN_BUCKET(nbuckets, h) FROZEN_REDUCE(hashMix64((h), 0), (nbuckets))
+
+// hot path statistics, nothing unless DICT_STATS
+#ifdef DICT_STATS
+#define DICT_STAT_ADD(counter, n) \
+    __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+#define DICT_STAT_PROBE_BEGIN size_t nprobes_ = 1
+#define DICT_STAT_PROBE_NEXT nprobes_++
+#define DICT_STAT_PROBE_END(dk) _DictKeys_CountProbes((dk), nprobes_)
+// new keys object of a resize, count into the same dict
+#define DICT_STAT_LINK(dk, olddk) ((dk)->dk_stats = (olddk)->dk_stats)
+#else
+#define DICT_STAT_PROBE_BEGIN
+#define DICT_STAT_PROBE_NEXT
+#define DICT_STAT_PROBE_END(dk)
+#define DICT_STAT_LINK(dk, olddk)
+#endif
+
 // >> internal functions
 static inline DictKeyEntry*
 DK_ENTRIES(DictKeys* dk) {
@@ -27,39 +139,334 @@ DK_ENTRIES(DictKeys* dk) {
     size_t index = dk->dk_index_bytes * DK_SIZE(dk);
     return (DictKeyEntry*)(&indices[index]);
 }
+
+static inline DictFrozen*
+DK_FROZEN(DictKeys* dk) {
+    size_t entry_bytes = dk->dk_nentries * sizeof(DictKeyEntry);
+    return (DictFrozen*)((char*)DK_ENTRIES(dk) + ((entry_bytes + 7) & ~(size_t)7));
+}
+
+static inline uint32_t*
+FROZEN_BIG(DictFrozen* fz) {
+    return (uint32_t*)&fz->pilots[(fz->nbuckets + 3) & ~(size_t)3];
+}
+
+static inline uint32_t*
+FROZEN_REMAP(DictFrozen* fz) {
+    return &FROZEN_BIG(fz)[2 * fz->nbig];
+}
+
+// slot of a key of the bucket with the given pilot, in [0, nslots)
+static inline size_t
+_frozenPosition(uint64_t pilot_seed, size_t nslots, hash_t hash, uint32_t pilot) {
+    return FROZEN_REDUCE(hashMix64(hash, pilot_seed + pilot * 0x9E3779B97F4A7C15ull), nslots);
+}
+
+static inline uint32_t
+_frozenPilot(DictFrozen* fz, size_t b) {
+    uint32_t pilot = fz->pilots[b];
+    if (pilot != FROZEN_PILOT_BIG) {
+        return pilot;
+    }
+    const uint32_t* big = FROZEN_BIG(fz);
+    size_t lo = 0;
+    size_t hi = fz->nbig;
+    while (lo < hi) {
+        size_t mid = (lo + hi) >> 1;
+        if (big[mid] < b) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return big[fz->nbig + lo];
+}
+
+// the entry a key of DICT_KIND_FROZEN keys is in, if present
+static inline size_t
+_DictKeys_FrozenSlot(DictKeys* dk, hash_t hash) {
+    DictFrozen* fz = DK_FROZEN(dk);
+    uint32_t pilot = _frozenPilot(fz, FROZEN_BUCKET(fz->nbuckets, hash));
+    size_t i = _frozenPosition(fz->pilot_seed, fz->nslots, hash, pilot);
+    if (i >= dk->dk_nentries) {
+        i = FROZEN_REMAP(fz)[i - dk->dk_nentries];
+    }
+    return i;
+}
+
+#ifdef DICT_COMPACT_ENTRIES
+// after the entries of DICT_KIND_COMBINED keys, one bit per entry
+static inline uint64_t*
+DK_LIVE(DictKeys* dk) {
+    return (uint64_t*)&DK_ENTRIES(dk)[USABLE_FRACTION(DK_SIZE(dk))];
+}
+
+static void
+_DictKeys_SetLiveRange(DictKeys* dk, size_t n) {
+    uint64_t* live = DK_LIVE(dk);
+    size_t nwords = DK_LIVE_BYTES(USABLE_FRACTION(DK_SIZE(dk))) / sizeof(uint64_t);
+    memset(live, 0, nwords * sizeof(uint64_t));
+    memset(live, 0xff, (n >> 6) * sizeof(uint64_t));
+    if (n & 63) {
+        live[n >> 6] = ((uint64_t)1 << (n & 63)) - 1;
+    }
+}
+#endif
 static uint8_t
 calc_log2_keysize(size_t minsize);
+static uint8_t
+_dictResizeLog2(Dict* mp);
 static void
 _dictResize(Dict* mp);
+static void
+_dictDoResize(Dict* mp);
+static void
+_dictResizeIncremental(Dict* mp, uint8_t log2_size);
+static void
+_dictRehashStep(Dict* mp, size_t n);
+static ix_t
+_dictLookup(Dict* mp, DictKeyType key, hash_t hash, DictKeys** dk_found);
+static DictValueType*
+_dictUpsert(Dict* mp, DictKeyType key, DictValueType dflt, bool* inserted);
+static bool
+_dictPop(Dict* mp, DictKeyType key, DictValueType* value);
+static void
+_dictUnshare(Dict* mp);
+static inline int
+_dictSmallIndex(Dict* mp, DictKeyType key);
+static DictValueType*
+_dictSmallUpsert(Dict* mp, DictKeyType key, DictValueType dflt, bool* inserted);
+static bool
+_dictSmallPop(Dict* mp, DictKeyType key, DictValueType* value);
+static size_t
+_dictSmallGetMany(Dict* mp, const DictKeyType* keys, size_t n, DictValueType* values, bool* found);
+static void
+_dictMaterialize(Dict* mp);
+static void
+_dictScanMoved(Dict* mp);
+static void
+_dictScanRemap(Dict* mp, DictKeys* dk);
+static size_t
+_dictScanMigrating(Dict* mp, size_t* pos, size_t end, DictKeyType* keys, DictValueType* values, size_t n);
+static size_t
+_dictScanSwiss(Dict* mp, DictCursor* cursor, DictKeyType* keys, DictValueType* values, size_t n);
+static void
+_dictScanMovedBy(Dict* mp, DictScanBlock* map, size_t end, size_t tail);
+static DictKeys*
+_DictKeys_New(uint8_t log2_size, uint8_t kind, hash_t seed, const Allocator* alloc);
+static size_t
+_DictKeys_Bytes(DictKeys* dk);
+static uint8_t
+_DictKeys_IndexBytes(uint8_t log2_size, uint8_t kind);
+static bool
+_DictKeys_MappedValid(DictKeys* dk, size_t nbytes, uint64_t used);
 static DictKeys*
-_DictKeys_New(uint8_t log2_size);
+_DictKeys_Copy(DictKeys* dk, const Allocator* alloc);
+static void
+_DictKeys_FreeRetired(void* dk);
+static uint64_t
+_dictChecksum(const void* data, size_t nbytes, uint64_t h);
 static int
 _DictKeys_Get(DictKeys* dk, DictKeyType key, DictValueType* value);
 static int
 _DictKeys_Set(DictKeys* dk, DictKeyType key, DictValueType value);
+static DictKeyEntry*
+_DictKeys_Insert(DictKeys* dk, DictKeyType key, hash_t hash, DictValueType value);
+static DictKeyEntry*
+_DictKeys_InsertAt(DictKeys* dk, size_t slot, DictKeyType key, hash_t hash, DictValueType value);
+static void
+_DictKeys_DelAt(DictKeys* dk, size_t slot, ix_t ix);
 static void
 _DictKeys_Free(DictKeys* dk);
-static ix_t
+static void
+_DictKeys_Compact(DictKeys* dk);
+static inline ix_t
 _DictKeys_Lookup(DictKeys* dk, DictKeyType key, hash_t hash);
+#ifdef DICT_GENERIC_PROBES
+static ix_t
+_DictKeys_LookupGeneric(DictKeys* dk, DictKeyType key, hash_t hash);
+#endif
+static inline ix_t
+_DictKeys_LookupSlot(DictKeys* dk, DictKeyType key, hash_t hash, size_t* slot);
+#ifdef DICT_GENERIC_PROBES
+static ix_t
+_DictKeys_LookupSlotGeneric(DictKeys* dk, DictKeyType key, hash_t hash, size_t* slot);
+#endif
 static ix_t
 _DictKeys_GetIndex(const DictKeys* dk, size_t i);
 static void
 _DictKeys_SetIndex(DictKeys* dk, size_t i, ix_t ix);
+static inline ix_t
+_DictKeys_LoadIndex(const DictKeys* dk, size_t i);
+static inline bool
+_DictKeys_CasIndex(DictKeys* dk, size_t i, ix_t* expected, ix_t ix);
+static ix_t
+_DictKeys_CasInsert(DictKeys* dk, ix_t ix, hash_t hash, bool dups);
 static size_t
+_DictKeys_BuildParallel(DictKeys* dk, const DictKeyType* keys, const DictValueType* values,
+                        size_t n, size_t nthreads, ix_t** dups);
+static void*
+_DictKeys_BuildWorker(void* arg);
+static int
+_dictCompareIx(const void* a, const void* b);
+static inline size_t
 _DictKeys_FindEmptySlot(DictKeys* dk, hash_t hash);
-static void
+#ifdef DICT_GENERIC_PROBES
+static size_t
+_DictKeys_FindEmptySlotGeneric(DictKeys* dk, hash_t hash);
+#endif
+static inline void
 _DictKeys_BuildIndices(DictKeys* dk, DictKeyEntry* newentries, size_t nentries);
+#ifdef DICT_GENERIC_PROBES
+static void
+_DictKeys_BuildIndicesGeneric(DictKeys* dk, DictKeyEntry* newentries, size_t nentries);
+#endif
+static const struct _DictKeysOps*
+_DictKeys_SelectOps(DictKeys* dk);
+static inline uint32_t
+_swissGroupMatch(const int8_t* group, int8_t tag);
+static ix_t
+_DictKeys_SwissLookup(DictKeys* dk, DictKeyType key, hash_t hash);
+static ix_t
+_DictKeys_SwissLookup_default(DictKeys* dk, DictKeyType key, hash_t hash);
+static ix_t
+_DictKeys_SwissLookupSlot(DictKeys* dk, DictKeyType key, hash_t hash, size_t* slot);
+static ix_t
+_DictKeys_SwissLookupSlot_default(DictKeys* dk, DictKeyType key, hash_t hash, size_t* slot);
+static size_t
+_DictKeys_SwissFindInsertSlot(DictKeys* dk, hash_t hash);
+static void
+_DictKeys_SwissSetCtrl(DictKeys* dk, size_t i, hash_t hash);
+static void
+_DictKeys_SwissDelete(DictKeys* dk, size_t i);
+static size_t
+_DictKeys_SwissHomeSlots(DictKeys* dk, size_t g, hash_t hash, DictKeyType key, DictScanSlot* slots, size_t cap);
+static void
+_dictResizeSwiss(Dict* mp);
+static DictKeys*
+_DictKeys_NewFrozen(const DictKeyEntry* entries, const hash_t* hashes, size_t n, hash_t seed,
+                    const Allocator* alloc);
 static size_t
-_DictKeys_GetHashPosition(DictKeys* dk, hash_t hash, ix_t index);
+_DictKeys_FrozenBytes(size_t nentries, size_t nbuckets, size_t nbig, size_t nslots);
+static bool
+_frozenPlaceBucket(uint64_t pilot_seed, size_t nslots, uint64_t* taken, const hash_t* hashes,
+                   const uint32_t* keys, size_t size, size_t* pos, uint32_t* pilot);
+static ix_t
+_DictKeys_FrozenLookup(DictKeys* dk, DictKeyType key, hash_t hash);
+static ix_t
+_DictKeys_FrozenLookup_default(DictKeys* dk, DictKeyType key, hash_t hash);
+static void
+_DictKeys_Prefetch(DictKeys* dk, const DictKeyType* keys, hash_t* hashes, size_t n);
+
+// mp->extra, allocated by the first caller that needs it
+static DictExtra*
+_dictExtra(Dict* mp) {
+    if (mp->extra == NULL) {
+        mp->extra = (DictExtra*)calloc(1, sizeof(DictExtra));
+        assert(mp->extra != NULL);
+        mp->extra->alloc = &allocDefault;
+    }
+    return mp->extra;
+}
+// the allocator of the next keys objects of mp
+static inline const Allocator*
+_dictAlloc(Dict* mp) {
+    return (mp->extra != NULL) ? mp->extra->alloc : &allocDefault;
+}
+// mapped with DICT_MAP_READONLY
+static inline bool
+_dictReadonly(Dict* mp) {
+    return mp->extra != NULL && mp->extra->mapping_readonly;
+}
+// a copy of the extra of mp for a new dict, without the scan map and
+// the mapping that stay with mp; NULL if mp has none
+static DictExtra*
+_dictExtraCopy(Dict* mp) {
+    if (mp->extra == NULL) {
+        return NULL;
+    }
+    DictExtra* extra = (DictExtra*)malloc(sizeof(DictExtra));
+    assert(extra != NULL);
+    memcpy(extra, mp->extra, sizeof(DictExtra));
+    extra->scan_map = NULL;
+    extra->mapping = NULL;
+    extra->mapping_bytes = 0;
+    extra->mapping_readonly = false;
+    return extra;
+}
+
+// the dict a read section of this thread is in, and the keys it saw
+static __thread Dict* _dictRcuDict = NULL;
+static __thread DictKeys* _dictRcuKeys = NULL;
+
+// readers that don't lock see mp->keys published by dictRcuWriteCommit,
+// the same keys object for the whole read section
+static inline DictKeys*
+_dictLoadKeys(Dict* mp) {
+    if (mp == _dictRcuDict) {
+        return _dictRcuKeys;
+    }
+    return __atomic_load_n(&mp->keys, __ATOMIC_ACQUIRE);
+}
+// the value of entry ix of dk, mp->keys or mp->oldkeys
+static inline DictValueType*
+_dictValue(Dict* mp, DictKeys* dk, ix_t ix) {
+    if (mp->split) {
+        return &mp->values[ix];
+    }
+    return &DK_ENTRIES(dk)[ix].value;
+}
+#ifdef DICT_STATS
+static inline void
+_DictKeys_CountProbes(DictKeys* dk, size_t nprobes) {
+    DictStatsCounters* st = dk->dk_stats;
+    if (st == NULL) {
+        // shared keys of split dicts
+        return;
+    }
+    size_t bucket = (nprobes < DICT_STATS_PROBE_BUCKETS) ? nprobes - 1 : DICT_STATS_PROBE_BUCKETS - 1;
+    DICT_STAT_ADD(st->probe_hist[bucket], 1);
+    DICT_STAT_ADD(st->lookups, 1);
+    DICT_STAT_ADD(st->probes, nprobes);
+}
+
+static inline uint64_t
+_dictNowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
 
 static inline hash_t
-_DictKeys_DefaultKeyHashFunc(DictKeyType key) {
-    return (hash_t)key;
+_DictKeys_DefaultKeyHashFunc(DictKeyType key, hash_t seed) {
+    return DICT_KEY_HASH((uint64_t)key, seed);
+}
+static inline hash_t
+_DictKeys_Hash(DictKeys* dk, DictKeyType key) {
+#ifdef DICT_GENERIC_PROBES
+    hash_t hash = dk->keyHashFunc(key, dk->dk_seed);
+#else
+    // the default hash is inlined, not called through the pointer
+    hash_t hash = (dk->keyHashFunc == _DictKeys_DefaultKeyHashFunc)
+                  ? DICT_KEY_HASH((uint64_t)key, dk->dk_seed)
+                  : dk->keyHashFunc(key, dk->dk_seed);
+#endif
+    return (hash == DKE_HASH_DELETED) ? hash - 1 : hash;
 }
 static int
 _DictKeys_DefaultKeyCmpFunc(DictKeyType key1, DictKeyType key2) {
     return key1 == key2;
 }
+
+struct _DictKeysOps {
+    ix_t (*lookup)(DictKeys* dk, DictKeyType key, hash_t hash);
+    size_t (*find_empty_slot)(DictKeys* dk, hash_t hash);
+    void (*build_indices)(DictKeys* dk, DictKeyEntry* ep, size_t nentries);
+    // like lookup, also sets *slot to the slot of the key,
+    // or to the one it would be inserted in
+    ix_t (*lookup_slot)(DictKeys* dk, DictKeyType key, hash_t hash, size_t* slot);
+};
 // << internal functions
 
 
@@ -70,233 +477,2252 @@ dictNew(void) {
 
 extern Dict*
 dictNewPresized(size_t size) {
+    return dictNewPresizedKind(size, DICT_KIND_COMBINED);
+}
+
+extern Dict*
+dictNewKind(uint8_t kind) {
+    return dictNewPresizedKind(1, kind);
+}
+
+extern Dict*
+dictNewPresizedKind(size_t size, uint8_t kind) {
+    assert(kind == DICT_KIND_COMBINED || kind == DICT_KIND_SWISS);
     Dict* mp = (Dict*)malloc(sizeof(Dict));
+    assert(mp != NULL);
     mp->used = 0;
-    mp->keys = _DictKeys_New(calc_log2_keysize(size));
+    mp->seed = hashRandomSeed();
+    mp->kind = kind;
+    mp->small_used = 0;
+    memset(mp->small_keys, 0, sizeof(mp->small_keys));
+    mp->extra = NULL;
+    // the keys object is allocated by the insert that overflows
+    // the inline entries
+    mp->keys = NULL;
+    mp->min_log2_size = 0;
+    if (size > DICT_SMALL_SIZE) {
+        mp->min_log2_size = calc_log2_keysize(size);
+        mp->keys = _DictKeys_New(mp->min_log2_size, kind, mp->seed, &allocDefault);
+    }
+    mp->split = false;
+    mp->oldkeys = NULL;
+#ifdef DICT_STATS
+    DictStatsCounters* st = &_dictExtra(mp)->stats;
+    if (mp->keys != NULL) {
+        st->bytes_allocated = _DictKeys_Bytes(mp->keys);
+        mp->keys->dk_stats = st;
+    }
+#endif
+    return mp;
+}
+
+// A dict of the n pairs, the same as setting them in order with dictSet
+// (a repeated key keeps its first position and gets its last value).
+// With nthreads threads, each one fills a range of the entries, then
+// inserts it into the indices; the index slots are taken by
+// compare-and-swap, since probe sequences cross the whole table.
+// DICT_KIND_COMBINED.
+extern Dict*
+dictNewFromArrays(const DictKeyType* keys, const DictValueType* values, size_t n, size_t nthreads) {
+    if (nthreads <= 1 || n < DICT_PARALLEL_MIN) {
+        Dict* mp = dictNewPresized(n);
+        dictSetMany(mp, keys, values, n);
+        return mp;
+    }
+    Dict* mp = dictNewPresized(n + (n >> 1) + 1);
+    DictKeys* dk = mp->keys;
+    assert(dk->dk_usable >= n);
+    DKE_SET_LIVE_RANGE(dk, n);
+    ix_t* dups;
+    size_t ndups = _DictKeys_BuildParallel(dk, keys, values, n, nthreads, &dups);
+    dk->dk_usable -= n;
+    dk->dk_nentries = n;
+    // The first entry of a key is in the indices, the following ones are
+    // left deleted, in increasing order so that the last value stays.
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);
+    for (size_t k = 0; k < ndups; k++) {
+        DictKeyEntry* ep = &ep0[dups[k]];
+        ix_t ix = _DictKeys_Lookup(dk, ep->key, DKE_HASH(dk, ep));
+        assert(ix >= 0 && ix < dups[k]);
+        ep0[ix].value = ep->value;
+        DKE_SET_DELETED(dk, dups[k]);
+    }
+    free(dups);
+    mp->used = n - ndups;
     return mp;
 }
 
 extern DictValueType
 dictGet(Dict* mp, DictKeyType key) {
-    DictValueType value;
-    int ret = _DictKeys_Get(mp->keys, key, &value);
-    assert(ret == 0);
-    return value;
+    if (_dictLoadKeys(mp) == NULL) {
+        int i = _dictSmallIndex(mp, key);
+        assert(i >= 0);
+        return mp->small_values[i];
+    }
+    if (mp->split) {
+        DictKeys* dk = mp->keys;
+        ix_t ix = _DictKeys_Lookup(dk, key, _DictKeys_Hash(dk, key));
+        assert(ix >= 0);
+        return mp->values[ix];
+    }
+    if (mp->oldkeys == NULL) {
+        DictValueType value;
+        int ret = _DictKeys_Get(_dictLoadKeys(mp), key, &value);
+        assert(ret == 0);
+        return value;
+    }
+    _dictRehashStep(mp, DICT_REHASH_STEP);
+    DictKeys* dk;
+    ix_t ix = _dictLookup(mp, key, _DictKeys_Hash(mp->keys, key), &dk);
+    assert(ix >= 0);
+    return DK_ENTRIES(dk)[ix].value;
 }
 
 extern void
 dictSet(Dict* mp, DictKeyType key, DictValueType value) {
+    assert(!_dictReadonly(mp));
+    assert(mp->kind != DICT_KIND_FROZEN);
+    if (mp->keys == NULL) {
+        bool inserted;
+        DictValueType* slot = _dictSmallUpsert(mp, key, value, &inserted);
+        if (slot != NULL) {
+            *slot = value;
+            return;
+        }
+        _dictMaterialize(mp);
+    }
+    if (mp->split) {
+        DictKeys* dk = mp->keys;
+        ix_t ix = _DictKeys_Lookup(dk, key, _DictKeys_Hash(dk, key));
+        if (ix >= 0) {
+            mp->values[ix] = value;
+            return;
+        }
+        // a new key
+        _dictUnshare(mp);
+    }
+    if (mp->oldkeys != NULL) {
+        _dictRehashStep(mp, DICT_REHASH_STEP);
+    }
     if (mp->keys->dk_usable <= 0) {
         _dictResize(mp);
     }
-    int8_t ret = _DictKeys_Set(mp->keys, key, value);
-    assert(ret == 0 || ret == 1);
-    mp->used += ret;
+    if (mp->oldkeys == NULL) {
+        int8_t ret = _DictKeys_Set(mp->keys, key, value);
+        assert(ret == 0 || ret == 1);
+        mp->used += ret;
+        return;
+    }
+    DictKeys* dk;
+    hash_t hash = _DictKeys_Hash(mp->keys, key);
+    ix_t ix = _dictLookup(mp, key, hash, &dk);
+    if (ix >= 0) {
+        DK_ENTRIES(dk)[ix].value = value;
+    } else {
+        _DictKeys_Insert(mp->keys, key, hash, value);
+        mp->used++;
+    }
 }
 
 extern int
 dictHas(Dict* mp, DictKeyType key) {
-    DictKeys* dk = mp->keys;
-    ix_t ix = _DictKeys_Lookup(dk, key, dk->keyHashFunc(key));
+    if (mp->oldkeys == NULL) {
+        DictKeys* dk = _dictLoadKeys(mp);
+        if (dk == NULL) {
+            return (_dictSmallIndex(mp, key) >= 0);
+        }
+        return (_DictKeys_Lookup(dk, key, _DictKeys_Hash(dk, key)) >= 0);
+    }
+    _dictRehashStep(mp, DICT_REHASH_STEP);
+    DictKeys* dk;
+    ix_t ix = _dictLookup(mp, key, _DictKeys_Hash(mp->keys, key), &dk);
     return (ix >= 0);
 }
 
 extern int
 dictDel(Dict* mp, DictKeyType key) {
-    DictKeys* dk = mp->keys;
-    ix_t ix = _DictKeys_Lookup(dk, key, dk->keyHashFunc(key));
-    if (ix >= 0) {
-        // Delete Key
-        size_t hashpos = _DictKeys_GetHashPosition(dk, dk->keyHashFunc(key), ix);
-        _DictKeys_SetIndex(dk, hashpos, DKIX_DUMMY);
-        mp->used--;
-    } else {
-        // do nothing
-    }
+    _dictPop(mp, key, NULL);
     return 0;
 }
 
-extern size_t
-dictLen(Dict* mp) {
-    return mp->used;
+// >> upsert
+// One hash and one probe sequence per call: the lookup also finds the
+// slot to insert in (or to clear), see _DictKeys_LookupSlot.
+
+// Pointer to the value of key, key is inserted with value dflt first
+// if absent. The pointer is valid until mp is changed again.
+extern DictValueType*
+dictGetOrInsert(Dict* mp, DictKeyType key, DictValueType dflt, bool* inserted) {
+    bool is_new;
+    DictValueType* value = _dictUpsert(mp, key, dflt, &is_new);
+    if (inserted != NULL) {
+        *inserted = is_new;
+    }
+    return value;
 }
 
-extern void
-dictFree(Dict* d) {
-    _DictKeys_Free(d->keys);
-    free(d);
+// the value of key, inserting dflt if absent
+extern DictValueType
+dictSetDefault(Dict* mp, DictKeyType key, DictValueType dflt) {
+    bool inserted;
+    return *_dictUpsert(mp, key, dflt, &inserted);
 }
 
-extern bool
-dictIterNext(DictIter *iter, DictKeyType *key_, DictValueType *val_) {
-    DictKeys* dk = iter->mp->keys;
-    DictKeyEntry* entries = DK_ENTRIES(dk);
-    size_t i = iter->pos;
-    for (; i < dk->dk_nentries; i++, iter->pos++) {
-        if (entries[i].hash != 0) {
-            *key_ = entries[i].key;
-            *val_ = entries[i].value;
-            iter->pos++;
-            return 1;
+// sets key to func(value, present, arg), returns the new value
+extern DictValueType
+dictUpdateWith(Dict* mp, DictKeyType key, DictUpdateFunc func, void* arg) {
+    bool inserted;
+    DictValueType* value = _dictUpsert(mp, key, 0, &inserted);
+    *value = func(*value, !inserted, arg);
+    return *value;
+}
+
+// delete key and store its value, returns -1 if absent
+extern int
+dictPop(Dict* mp, DictKeyType key, DictValueType* value) {
+    return _dictPop(mp, key, value) ? 0 : -1;
+}
+
+static DictValueType*
+_dictUpsert(Dict* mp, DictKeyType key, DictValueType dflt, bool* inserted) {
+    assert(!_dictReadonly(mp));
+    assert(mp->kind != DICT_KIND_FROZEN);
+    if (mp->keys == NULL) {
+        DictValueType* value = _dictSmallUpsert(mp, key, dflt, inserted);
+        if (value != NULL) {
+            return value;
         }
+        _dictMaterialize(mp);
     }
-    return 0;
+    if (mp->split) {
+        DictKeys* dk = mp->keys;
+        ix_t ix = _DictKeys_Lookup(dk, key, _DictKeys_Hash(dk, key));
+        *inserted = (ix < 0);
+        if (ix >= 0) {
+            return &mp->values[ix];
+        }
+        _dictUnshare(mp);
+    }
+    if (mp->oldkeys != NULL) {
+        _dictRehashStep(mp, DICT_REHASH_STEP);
+    }
+    if (mp->keys->dk_usable <= 0) {
+        _dictResize(mp);
+    }
+    DictKeys* dk = mp->keys;
+    hash_t hash = _DictKeys_Hash(dk, key);
+    ix_t ix;
+    if (mp->oldkeys != NULL) {
+        // the key may not be migrated yet, probe both tables
+        ix = _dictLookup(mp, key, hash, &dk);
+        *inserted = (ix < 0);
+        if (ix >= 0) {
+            return &DK_ENTRIES(dk)[ix].value;
+        }
+        mp->used++;
+        return &_DictKeys_Insert(mp->keys, key, hash, dflt)->value;
+    }
+    size_t slot;
+    ix = _DictKeys_LookupSlot(dk, key, hash, &slot);
+    *inserted = (ix < 0);
+    if (ix >= 0) {
+        return &DK_ENTRIES(dk)[ix].value;
+    }
+    mp->used++;
+    return &_DictKeys_InsertAt(dk, slot, key, hash, dflt)->value;
 }
 
-static uint8_t
-calc_log2_keysize(size_t minsize) {
-    uint8_t new_log2_size = DICT_LOG_MINSIZE;
-    for (; ((size_t)1 << new_log2_size) < minsize; ) {
-        new_log2_size++;
+static bool
+_dictPop(Dict* mp, DictKeyType key, DictValueType* value) {
+    assert(!_dictReadonly(mp));
+    assert(mp->kind != DICT_KIND_FROZEN);
+    if (mp->keys == NULL) {
+        return _dictSmallPop(mp, key, value);
     }
-    return new_log2_size;
+    if (mp->split) {
+        DictKeys* dk = mp->keys;
+        if (_DictKeys_Lookup(dk, key, _DictKeys_Hash(dk, key)) < 0) {
+            return false;
+        }
+        _dictUnshare(mp);
+    }
+    if (mp->oldkeys != NULL) {
+        _dictRehashStep(mp, DICT_REHASH_STEP);
+    }
+    DictKeys* dk = mp->keys;
+    hash_t hash = _DictKeys_Hash(dk, key);
+    size_t slot;
+    ix_t ix = _DictKeys_LookupSlot(dk, key, hash, &slot);
+    if (ix < 0 && mp->oldkeys != NULL) {
+        size_t old_slot;
+        ix_t old_ix = _DictKeys_LookupSlot(mp->oldkeys, key, hash, &old_slot);
+        if (old_ix >= 0 && (size_t)old_ix >= mp->extra->rehash_pos) {
+            dk = mp->oldkeys;
+            ix = old_ix;
+            slot = old_slot;
+        }
+    }
+    if (ix < 0) {
+        return false;
+    }
+    if (value != NULL) {
+        *value = DK_ENTRIES(dk)[ix].value;
+    }
+    _DictKeys_DelAt(dk, slot, ix);
+    mp->used--;
+
+    // never below the size the dict was created for
+    dk = mp->keys;
+    uint8_t log2_minsize = (dk->dk_kind == DICT_KIND_SWISS) ? SWISS_LOG_MINSIZE : DICT_LOG_MINSIZE;
+    if (log2_minsize < mp->min_log2_size) {
+        log2_minsize = mp->min_log2_size;
+    }
+    if (mp->used * DICT_SHRINK_RATIO < DK_SIZE(dk)
+            && DK_LOG_SIZE(dk) > log2_minsize
+            && mp->oldkeys == NULL) {
+        _dictResize(mp);
+    }
+    return true;
 }
+// << upsert
 
-static void
-_dictResize(Dict* mp) {
-    DictKeys* oldkeys = mp->keys;
-    size_t nentries = mp->used;
+// >> split tables
+// Dicts with the same keys can share one keys object (indices, hashes
+// and keys), each keeping its own array of values, like cpython's split
+// dicts. Setting the value of a present key keeps the table split,
+// inserting or deleting a key gives the dict its own copy of the keys
+// first (_dictUnshare).
 
-    uint8_t new_log2_size = calc_log2_keysize(GROWTH_RATE(mp));
+// A new dict with the keys and values of mp, sharing its keys object.
+// mp becomes a split table too. DICT_KIND_COMBINED only.
+extern Dict*
+dictNewSharedKeys(Dict* mp) {
+    assert(mp->kind == DICT_KIND_COMBINED);
+    assert(mp->extra == NULL || mp->extra->mapping == NULL);
+    if (mp->keys == NULL) {
+        _dictMaterialize(mp);
+    }
+    if (mp->oldkeys != NULL) {
+        _dictRehashStep(mp, SIZE_MAX);
+    }
+    DictKeys* dk = mp->keys;
+    size_t nbytes = dk->dk_nentries * sizeof(DictValueType);
+    if (!mp->split) {
+        mp->split = true;
+        // one spare byte keeps malloc from returning NULL for no entries
+        mp->values = (DictValueType*)malloc(nbytes + 1);
+        assert(mp->values != NULL);
+        DictKeyEntry* ep0 = DK_ENTRIES(dk);
+        for (size_t i = 0; i < dk->dk_nentries; i++) {
+            mp->values[i] = ep0[i].value;
+        }
+#ifdef DICT_STATS
+        // the counters of one dict would see the lookups of all
+        dk->dk_stats = NULL;
+#endif
+    }
+    Dict* copy = (Dict*)malloc(sizeof(Dict));
+    assert(copy != NULL);
+    memcpy(copy, mp, sizeof(Dict));
+    copy->extra = _dictExtraCopy(mp);
+    copy->values = (DictValueType*)malloc(nbytes + 1);
+    assert(copy->values != NULL);
+    memcpy(copy->values, mp->values, nbytes);
+#ifdef DICT_STATS
+    memset(&copy->extra->stats, 0, sizeof(copy->extra->stats));
+#endif
+    __atomic_fetch_add(&dk->dk_refcnt, 1, __ATOMIC_RELAXED);
+    return copy;
+}
 
-    mp->keys = _DictKeys_New(new_log2_size);
-    // if (mp->keys == NULL) {
-    //     mp->keys = oldkeys;
-    //     return;
-    // }
-    assert(mp->keys != NULL);
+// turn a split table back into a combined one
+static void
+_dictUnshare(Dict* mp) {
+    DictKeys* dk = mp->keys;
+    if (__atomic_load_n(&dk->dk_refcnt, __ATOMIC_ACQUIRE) != 1) {
+        dk = _DictKeys_Copy(dk, _dictAlloc(mp));
+        _DictKeys_Free(mp->keys);
+        mp->keys = dk;
+    }
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);
+    for (size_t i = 0; i < dk->dk_nentries; i++) {
+        ep0[i].value = mp->values[i];
+    }
+    free(mp->values);
+    mp->split = false;
+#ifdef DICT_STATS
+    dk->dk_stats = &mp->extra->stats;
+#endif
+}
+// << split tables
 
-    assert(mp->keys->dk_usable >= nentries);
+// >> small dict
+// The entries of a dict without keys object, see Dict. Small dicts
+// always have the default key functions, keys are compared with ==.
 
-    DictKeyEntry* old_entries = DK_ENTRIES(oldkeys);
-    DictKeyEntry* new_entries = DK_ENTRIES(mp->keys);
-    if (oldkeys->dk_nentries == nentries) {
-        memcpy(new_entries, old_entries, nentries * sizeof(DictKeyEntry));
-        _DictKeys_BuildIndices(mp->keys, new_entries, nentries);
-    } else {
-        DictKeyEntry* ep = old_entries;
-        for (ix_t ix = 0; ix < nentries; ix++, ep++) {
-            for (; _DictKeys_Lookup(oldkeys, ep->key, ep->hash) < 0;) {
-                ep++;
-            }
-            size_t i = _DictKeys_FindEmptySlot(mp->keys, ep->hash);
-            memcpy(&new_entries[ix], ep, sizeof(DictKeyEntry));
-            _DictKeys_SetIndex(mp->keys, i, ix);
+// position of key in small_keys, -1 if absent
+static inline int
+_dictSmallIndex(Dict* mp, DictKeyType key) {
+    int n = mp->small_used;
+#ifdef DICT_STATS
+    // counted as a single probe
+    DICT_STAT_ADD(mp->extra->stats.probe_hist[0], 1);
+    DICT_STAT_ADD(mp->extra->stats.lookups, 1);
+    DICT_STAT_ADD(mp->extra->stats.probes, 1);
+#endif
+#ifdef __SSE2__
+    if (sizeof(DictKeyType) == 4) {
+        // 4 keys per compare, the matches past small_used are masked off
+        // (the unused keys are zeroed by the constructors, never garbage)
+        __m128i k = _mm_set1_epi32((int32_t)key);
+        uint32_t m = 0;
+        for (int i = 0; i + 4 <= DICT_SMALL_SIZE; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)&mp->small_keys[i]);
+            m |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, k))) << i;
         }
+        m &= ((uint32_t)1 << n) - 1;
+        return (m != 0) ? __builtin_ctz(m) : -1;
     }
-
-    _DictKeys_Free(oldkeys);
-
-    mp->keys->dk_usable -= nentries;
-    mp->keys->dk_nentries = nentries;
+#endif
+    for (int i = 0; i < n; i++) {
+        if (mp->small_keys[i] == key) {
+            return i;
+        }
+    }
+    return -1;
 }
 
-static void
-_DictKeys_BuildIndices(DictKeys* dk, DictKeyEntry* ep, size_t nentries) {
-    size_t mask = DK_MASK(dk);
-    for (ix_t ix = 0; ix < nentries; ix++, ep++) {
-        size_t i = _DictKeys_FindEmptySlot(dk, ep->hash);
-        _DictKeys_SetIndex(dk, i, ix);
+// like _dictUpsert, NULL if key is absent and the inline entries are full
+static DictValueType*
+_dictSmallUpsert(Dict* mp, DictKeyType key, DictValueType dflt, bool* inserted) {
+    int i = _dictSmallIndex(mp, key);
+    *inserted = (i < 0);
+    if (i >= 0) {
+        return &mp->small_values[i];
+    }
+    if (mp->small_used == DICT_SMALL_SIZE) {
+        return NULL;
     }
+    i = mp->small_used++;
+    mp->small_keys[i] = key;
+    mp->small_values[i] = dflt;
+    mp->used++;
+    return &mp->small_values[i];
 }
 
-static int
-_DictKeys_Get(DictKeys* dk, DictKeyType key, DictValueType* value) {
-    int err = 0;
-    ix_t ix = _DictKeys_Lookup(dk, key, dk->keyHashFunc(key));
-    if (ix >= 0) {
-        *value = DK_ENTRIES(dk)[ix].value;
-    } else {
-        err = -1;
+// the following entries move down, keeping the insertion order
+static bool
+_dictSmallPop(Dict* mp, DictKeyType key, DictValueType* value) {
+    int i = _dictSmallIndex(mp, key);
+    if (i < 0) {
+        return false;
     }
-    return err;
+    if (value != NULL) {
+        *value = mp->small_values[i];
+    }
+    size_t nafter = mp->small_used - i - 1;
+    if (nafter > 0) {
+        DictScanBlock* map = (DictScanBlock*)malloc(sizeof(DictScanBlock));
+        assert(map != NULL);
+        map->base = 0;
+        map->live = (((uint64_t)1 << mp->small_used) - 1) & ~((uint64_t)1 << i);
+        _dictScanMovedBy(mp, map, mp->small_used, mp->small_used - 1);
+    }
+    memmove(&mp->small_keys[i], &mp->small_keys[i + 1], nafter * sizeof(DictKeyType));
+    memmove(&mp->small_values[i], &mp->small_values[i + 1], nafter * sizeof(DictValueType));
+    mp->small_used--;
+    mp->used--;
+    return true;
 }
 
-static int
-_DictKeys_Set(DictKeys* dk, DictKeyType key, DictValueType value) {
-    hash_t hash = dk->keyHashFunc(key);
-    int ret = 0;
-    assert(dk->dk_usable > 0);
+// dictGetMany, and dictHasMany if values is NULL
+static size_t
+_dictSmallGetMany(Dict* mp, const DictKeyType* keys, size_t n, DictValueType* values, bool* found) {
+    size_t nfound = 0;
+    for (size_t j = 0; j < n; j++) {
+        int i = _dictSmallIndex(mp, keys[j]);
+        if (i >= 0) {
+            if (values != NULL) {
+                values[j] = mp->small_values[i];
+            }
+            nfound++;
+        }
+        if (found != NULL) {
+            found[j] = (i >= 0);
+        }
+    }
+    return nfound;
+}
+
+// move the inline entries to a keys object, in the same order
+static void
+_dictMaterialize(Dict* mp) {
+    DictKeys* dk = _DictKeys_New(calc_log2_keysize(GROWTH_RATE(mp)), mp->kind, mp->seed, _dictAlloc(mp));
+    assert(dk->dk_usable > mp->used);
+    for (size_t i = 0; i < mp->small_used; i++) {
+        DictKeyType key = mp->small_keys[i];
+        _DictKeys_Insert(dk, key, _DictKeys_Hash(dk, key), mp->small_values[i]);
+    }
+#ifdef DICT_STATS
+    dk->dk_stats = &mp->extra->stats;
+    DICT_STAT_ADD(mp->extra->stats.bytes_allocated, _DictKeys_Bytes(dk));
+#endif
+    if (dk->dk_kind != DICT_KIND_COMBINED) {
+        // a combined table keeps the inline positions
+        _dictScanMoved(mp);
+    }
+    mp->keys = dk;
+}
+// << small dict
+
+// >> frozen tables
+// dictFreeze rebuilds a dict that is only read from then on around a
+// minimal perfect hash of its keys (see the frozen engine): a lookup
+// reads one pilot and one entry, whether the key is present or not.
+// The entries are packed, with about 3.4 bits per key on top of them.
+// A frozen dict can't be written to, and is iterated in the order of
+// its table instead of the insertion order. It can be saved with
+// dictSave and mapped back like any other.
+
+// returns 0, or -1 if no perfect hash was found (mp is left as it was)
+extern int
+dictFreeze(Dict* mp) {
+    if (mp->kind == DICT_KIND_FROZEN) {
+        return 0;
+    }
+    if (mp->oldkeys != NULL) {
+        _dictRehashStep(mp, SIZE_MAX);
+    }
+    size_t n = mp->used;
+    DictKeyEntry* entries = (DictKeyEntry*)malloc((n + 1) * sizeof(DictKeyEntry));
+    hash_t* hashes = (hash_t*)malloc((n + 1) * sizeof(hash_t));
+    assert(entries != NULL && hashes != NULL);
+    DictIter iter = {mp, 0};
+    DictKeyType key;
+    DictValueType value;
+    size_t i = 0;
+    while (dictIterNext(&iter, &key, &value)) {
+        hashes[i] = dictHash(mp, key);
+        entries[i].key = key;
+        entries[i].value = value;
+        DKE_SET_HASH(&entries[i], hashes[i]);
+        i++;
+    }
+    assert(i == n);
+    hash_t seed = (mp->keys != NULL) ? mp->keys->dk_seed : mp->seed;
+    DictKeys* dk = _DictKeys_NewFrozen(entries, hashes, n, seed, _dictAlloc(mp));
+    free(entries);
+    free(hashes);
+    if (dk == NULL) {
+        return -1;
+    }
+
+    if (mp->keys != NULL) {
+        _DictKeys_Free(mp->keys);
+    }
+    if (mp->split) {
+        free(mp->values);
+        mp->split = false;
+    }
+    mp->keys = dk;
+    mp->kind = DICT_KIND_FROZEN;
+    _dictScanMoved(mp);
+    mp->small_used = 0;
+    if (mp->extra != NULL) {
+        mp->extra->incremental_resize = false;
+    }
+#ifdef DICT_STATS
+    dk->dk_stats = &mp->extra->stats;
+    DICT_STAT_ADD(mp->extra->stats.bytes_allocated, _DictKeys_Bytes(dk));
+#endif
+    return 0;
+}
+// << frozen tables
+
+extern size_t
+dictLen(Dict* mp) {
+    return mp->used;
+}
+
+// the hash mp uses for key
+extern hash_t
+dictHash(Dict* mp, DictKeyType key) {
+    DictKeys* dk = _dictLoadKeys(mp);
+    if (dk == NULL) {
+        // what the keys object will use
+        hash_t hash = _DictKeys_DefaultKeyHashFunc(key, mp->seed);
+        return (hash == DKE_HASH_DELETED) ? hash - 1 : hash;
+    }
+    return _DictKeys_Hash(dk, key);
+}
+
+extern void
+dictFree(Dict* d) {
+    if (d->oldkeys != NULL) {
+        _DictKeys_Free(d->oldkeys);
+    }
+    if (d->keys != NULL) {
+        _DictKeys_Free(d->keys);
+    }
+    if (d->split) {
+        free(d->values);
+    }
+    if (d->extra != NULL) {
+        free(d->extra->scan_map);
+        free(d->extra->rehash_map);
+        if (d->extra->mapping != NULL) {
+            munmap(d->extra->mapping, d->extra->mapping_bytes);
+        }
+        free(d->extra);
+    }
+    free(d);
+}
+
+// In incremental mode a resize allocates the new keys object and then
+// migrates DICT_REHASH_STEP entries on every following operation,
+// instead of re-inserting all of them at once.
+// Only DICT_KIND_COMBINED dicts support it.
+extern void
+dictSetIncrementalResize(Dict* mp, bool enable) {
+    assert(!enable || mp->kind == DICT_KIND_COMBINED);
+    if (!enable && mp->oldkeys != NULL) {
+        _dictRehashStep(mp, SIZE_MAX);
+    }
+    if (enable || mp->extra != NULL) {
+        _dictExtra(mp)->incremental_resize = enable;
+    }
+}
+
+// The resizes of a DICT_KIND_COMBINED dict with at least
+// DICT_PARALLEL_MIN entries build the new indices with nthreads threads,
+// like dictNewFromArrays. 0 or 1 for the calling thread only.
+// Incremental resizes are not parallel.
+extern void
+dictSetResizeThreads(Dict* mp, size_t nthreads) {
+    if (nthreads > 1 || mp->extra != NULL) {
+        _dictExtra(mp)->resize_threads = (uint32_t)nthreads;
+    }
+}
+
+// The keys objects of mp come from alloc from now on (allocDefault if
+// NULL), the current one is moved there unless it is shared with split
+// dicts or mapped from a file. Not safe with concurrent RCU readers.
+extern void
+dictSetAllocator(Dict* mp, const Allocator* alloc) {
+    _dictExtra(mp)->alloc = (alloc != NULL) ? alloc : &allocDefault;
+    if (mp->oldkeys != NULL) {
+        _dictRehashStep(mp, SIZE_MAX);
+    }
+    DictKeys* dk = mp->keys;
+    if (dk == NULL || dk->dk_alloc == _dictAlloc(mp) || dk->dk_mapped
+            || __atomic_load_n(&dk->dk_refcnt, __ATOMIC_ACQUIRE) != 1) {
+        return;
+    }
+    mp->keys = _DictKeys_Copy(dk, _dictAlloc(mp));
+    _DictKeys_Free(dk);
+}
+
+// Batched lookups: the hashes of DICT_BATCH_SIZE keys are computed first,
+// then their index slots and entries are prefetched, so that the cache
+// misses of the whole batch overlap instead of following each other.
+// found[i] (if found is not NULL) tells whether keys[i] is present,
+// values[i] is left untouched for missing keys.
+// Returns the number of keys found.
+extern size_t
+dictGetMany(Dict* mp, const DictKeyType* keys, size_t n, DictValueType* values, bool* found) {
+    if (_dictLoadKeys(mp) == NULL) {
+        return _dictSmallGetMany(mp, keys, n, values, found);
+    }
+    hash_t hashes[DICT_BATCH_SIZE];
+    size_t nfound = 0;
+    for (size_t base = 0; base < n; base += DICT_BATCH_SIZE) {
+        size_t batch = n - base < DICT_BATCH_SIZE ? n - base : DICT_BATCH_SIZE;
+        if (mp->oldkeys != NULL) {
+            _dictRehashStep(mp, DICT_REHASH_STEP);
+        }
+        _DictKeys_Prefetch(_dictLoadKeys(mp), &keys[base], hashes, batch);
+        for (size_t j = 0; j < batch; j++) {
+            DictKeys* dk;
+            ix_t ix = _dictLookup(mp, keys[base + j], hashes[j], &dk);
+            if (ix >= 0) {
+                values[base + j] = *_dictValue(mp, dk, ix);
+                nfound++;
+            }
+            if (found != NULL) {
+                found[base + j] = (ix >= 0);
+            }
+        }
+    }
+    return nfound;
+}
+
+extern size_t
+dictHasMany(Dict* mp, const DictKeyType* keys, size_t n, bool* found) {
+    if (_dictLoadKeys(mp) == NULL) {
+        return _dictSmallGetMany(mp, keys, n, NULL, found);
+    }
+    hash_t hashes[DICT_BATCH_SIZE];
+    size_t nfound = 0;
+    for (size_t base = 0; base < n; base += DICT_BATCH_SIZE) {
+        size_t batch = n - base < DICT_BATCH_SIZE ? n - base : DICT_BATCH_SIZE;
+        if (mp->oldkeys != NULL) {
+            _dictRehashStep(mp, DICT_REHASH_STEP);
+        }
+        _DictKeys_Prefetch(_dictLoadKeys(mp), &keys[base], hashes, batch);
+        for (size_t j = 0; j < batch; j++) {
+            DictKeys* dk;
+            ix_t ix = _dictLookup(mp, keys[base + j], hashes[j], &dk);
+            nfound += (ix >= 0);
+            if (found != NULL) {
+                found[base + j] = (ix >= 0);
+            }
+        }
+    }
+    return nfound;
+}
+
+// Same as calling dictSet on every pair in order,
+// each batch is prefetched before it is inserted.
+extern void
+dictSetMany(Dict* mp, const DictKeyType* keys, const DictValueType* values, size_t n) {
+    hash_t hashes[DICT_BATCH_SIZE];
+    for (size_t base = 0; base < n; base += DICT_BATCH_SIZE) {
+        size_t batch = n - base < DICT_BATCH_SIZE ? n - base : DICT_BATCH_SIZE;
+        // a resize in the middle of the batch only wastes the prefetches
+        if (mp->keys != NULL) {
+            _DictKeys_Prefetch(mp->keys, &keys[base], hashes, batch);
+        }
+        for (size_t j = 0; j < batch; j++) {
+            dictSet(mp, keys[base + j], values[base + j]);
+        }
+    }
+}
+
+// >> rcu
+// A dict can be read without locks while a writer updates it:
+// readers wrap dictGet/dictHas/dictGetMany/dictHasMany calls in
+// dictRcuReadBegin/dictRcuReadEnd, and see the dict as one commit left it
+// until the section ends. The writer applies its changes to
+// a private copy from dictRcuWriteBegin, then publishes the copied keys
+// object with dictRcuWriteCommit. The replaced keys object is freed once
+// no reader can still be using it (see epoch.h).
+// Writers must be serialized by the caller, and a dict read this way
+// must not be written to directly.
+
+// sections of a thread don't nest
+extern void
+dictRcuReadBegin(Dict* mp) {
+    assert(_dictRcuDict == NULL);
+    epochEnter();
+    _dictRcuKeys = __atomic_load_n(&mp->keys, __ATOMIC_ACQUIRE);
+    _dictRcuDict = mp;
+}
+
+extern void
+dictRcuReadEnd(void) {
+    assert(_dictRcuDict != NULL);
+    _dictRcuDict = NULL;
+    _dictRcuKeys = NULL;
+    epochExit();
+}
+
+extern Dict*
+dictRcuWriteBegin(Dict* mp) {
+    assert(mp->oldkeys == NULL);
+    // readers only look at the keys
+    assert(!mp->split);
+    assert(mp->kind != DICT_KIND_FROZEN);
+    Dict* copy = (Dict*)malloc(sizeof(Dict));
+    assert(copy != NULL);
+    memcpy(copy, mp, sizeof(Dict));
+    // the scan map is recorded again by the moves of the copy
+    copy->extra = _dictExtraCopy(mp);
+    if (mp->keys == NULL) {
+        // readers keep scanning the inline entries of mp,
+        // the copy publishes a keys object
+        _dictMaterialize(copy);
+#ifdef DICT_STATS
+        copy->keys->dk_stats = &mp->extra->stats;
+#endif
+        return copy;
+    }
+    copy->keys = _DictKeys_Copy(mp->keys, _dictAlloc(mp));
+    return copy;
+}
+
+// publish the keys of copy in mp, copy is freed
+extern void
+dictRcuWriteCommit(Dict* mp, Dict* copy) {
+    // readers only look at mp->keys
+    _dictRehashStep(copy, SIZE_MAX);
+    DictKeys* oldkeys = mp->keys;
+    mp->used = copy->used;
+    __atomic_store_n(&mp->keys, copy->keys, __ATOMIC_RELEASE);
+    if (copy->extra != NULL) {
+        DictExtra* extra = _dictExtra(mp);
+        free(extra->scan_map);
+        extra->scan_epoch = copy->extra->scan_epoch;
+        extra->scan_remap = copy->extra->scan_remap;
+        extra->scan_map = copy->extra->scan_map;
+        extra->scan_map_end = copy->extra->scan_map_end;
+        extra->scan_map_tail = copy->extra->scan_map_tail;
+        free(copy->extra);
+    }
+    free(copy);
+
+    if (oldkeys != NULL) {
+        epochRetire(oldkeys, _DictKeys_FreeRetired);
+    }
+    epochReclaim();
+}
+// << rcu
+
+// Counters of the hot paths (with DICT_STATS) and the shape of the table,
+// tells clustering (long probes), tombstones (dummies) and resize churn apart.
+extern void
+dictStats(Dict* mp, DictStats* stats) {
+    memset(stats, 0, sizeof(DictStats));
+    DictKeys* dk = _dictLoadKeys(mp);
+#ifdef DICT_STATS
+    DictStatsCounters* st = (dk != NULL && dk->dk_stats != NULL) ? dk->dk_stats : &mp->extra->stats;
+    stats->counters.lookups = __atomic_load_n(&st->lookups, __ATOMIC_RELAXED);
+    stats->counters.probes = __atomic_load_n(&st->probes, __ATOMIC_RELAXED);
+    stats->counters.resizes = __atomic_load_n(&st->resizes, __ATOMIC_RELAXED);
+    stats->counters.resize_ns = __atomic_load_n(&st->resize_ns, __ATOMIC_RELAXED);
+    stats->counters.bytes_allocated = __atomic_load_n(&st->bytes_allocated, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < DICT_STATS_PROBE_BUCKETS; i++) {
+        stats->counters.probe_hist[i] = __atomic_load_n(&st->probe_hist[i], __ATOMIC_RELAXED);
+    }
+    stats->counted = true;
+#endif
+    stats->used = mp->used;
+    if (dk == NULL) {
+        // inline entries, nothing deleted stays behind
+        stats->size = DICT_SMALL_SIZE;
+        stats->nentries = mp->small_used;
+        stats->load_factor = (double)stats->nentries / stats->size;
+        return;
+    }
+    stats->size = DK_SIZE(dk);
+    if (dk->dk_kind == DICT_KIND_FROZEN) {
+        stats->size = DK_FROZEN(dk)->nslots;
+    }
+    stats->nentries = dk->dk_nentries;
+    // while resizing incrementally, entries not migrated yet have
+    // a slot reserved in the new keys, and a deleted one wastes it
+    stats->dummies = dk->dk_nentries - stats->used;
+    stats->load_factor = (double)stats->nentries / stats->size;
+    stats->bytes = _DictKeys_Bytes(dk);
+    if (mp->oldkeys != NULL) {
+        stats->bytes += _DictKeys_Bytes(mp->oldkeys);
+    }
+    if (mp->split) {
+        // the shared keys are counted in full for every dict
+        stats->bytes += dk->dk_nentries * sizeof(DictValueType);
+    }
+}
+
+// >> snapshots
+// A snapshot file is a page of DictFileHeader followed by the keys
+// object exactly as _DictKeys_New lays it out, with its pointers cleared.
+// dictLoadMapped serves lookups straight from the mapped file.
+
+#define DICT_FILE_MAGIC "DSADICT"
+#define DICT_FILE_HEADER_BYTES 4096
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    // layout of the keys object, a file from another build is rejected
+    uint16_t sizeof_keys;
+    uint16_t sizeof_entry;
+    uint16_t sizeof_key;
+    uint16_t sizeof_value;
+    uint64_t used;
+    uint64_t keys_bytes;
+    // of the keys object, as written
+    uint64_t checksum;
+} DictFileHeader;
+
+// returns 0 on success, -1 on failure
+extern int
+dictSave(Dict* mp, const char* path) {
+    if (mp->keys == NULL) {
+        _dictMaterialize(mp);
+    }
+    if (mp->keys->keyCmpFunc != _DictKeys_DefaultKeyCmpFunc
+            || mp->keys->keyHashFunc != _DictKeys_DefaultKeyHashFunc) {
+        // functions can't be stored
+        return -1;
+    }
+    if (mp->oldkeys != NULL) {
+        _dictRehashStep(mp, SIZE_MAX);
+    }
+    if (mp->split) {
+        _dictUnshare(mp);
+    }
+    DictKeys* dk = mp->keys;
+    size_t keys_bytes = _DictKeys_Bytes(dk);
+    DictKeys cleared;
+    memcpy(&cleared, dk, sizeof(DictKeys));
+    cleared.dk_mapped = 0;
+    cleared.dk_alloc = NULL;
+    cleared.keyCmpFunc = NULL;
+    cleared.keyHashFunc = NULL;
+    cleared.dk_ops = NULL;
+#ifdef DICT_STATS
+    cleared.dk_stats = NULL;
+#endif
+
+    char page[DICT_FILE_HEADER_BYTES];
+    memset(page, 0, sizeof(page));
+    DictFileHeader* header = (DictFileHeader*)page;
+    memcpy(header->magic, DICT_FILE_MAGIC, sizeof(header->magic));
+    header->version = DICT_FILE_VERSION;
+    header->sizeof_keys = sizeof(DictKeys);
+    header->sizeof_entry = sizeof(DictKeyEntry);
+    header->sizeof_key = sizeof(DictKeyType);
+    header->sizeof_value = sizeof(DictValueType);
+    header->used = mp->used;
+    header->keys_bytes = keys_bytes;
+    header->checksum = _dictChecksum(&cleared, sizeof(DictKeys), 0);
+    header->checksum = _dictChecksum(&dk->dk_indices[0], keys_bytes - sizeof(DictKeys), header->checksum);
+
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    int ok = fwrite(page, sizeof(page), 1, f) == 1
+             && fwrite(&cleared, sizeof(DictKeys), 1, f) == 1
+             && fwrite(&dk->dk_indices[0], keys_bytes - sizeof(DictKeys), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    return ok ? 0 : -1;
+}
+
+// Returns NULL if the file can't be mapped, or if it is not a snapshot
+// of this build (or, with DICT_MAP_VERIFY, if it is corrupt).
+// Only the page holding the keys header gets a private copy, to restore
+// the function pointers; with DICT_MAP_READONLY it is then write protected.
+extern Dict*
+dictLoadMapped(const char* path, int flags) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < DICT_FILE_HEADER_BYTES + sizeof(DictKeys)) {
+        close(fd);
+        return NULL;
+    }
+    size_t nbytes = (size_t)st.st_size;
+    char* base = mmap(NULL, nbytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    DictFileHeader* header = (DictFileHeader*)base;
+    DictKeys* dk = (DictKeys*)&base[DICT_FILE_HEADER_BYTES];
+    bool valid = memcmp(header->magic, DICT_FILE_MAGIC, sizeof(header->magic)) == 0
+                 && header->version == DICT_FILE_VERSION
+                 && header->sizeof_keys == sizeof(DictKeys)
+                 && header->sizeof_entry == sizeof(DictKeyEntry)
+                 && header->sizeof_key == sizeof(DictKeyType)
+                 && header->sizeof_value == sizeof(DictValueType)
+                 && header->keys_bytes == nbytes - DICT_FILE_HEADER_BYTES
+                 && _DictKeys_MappedValid(dk, header->keys_bytes, header->used);
+    // the checksum reads the whole file, the checks above only the headers
+    if (valid && (flags & DICT_MAP_VERIFY)) {
+        valid = (_dictChecksum(dk, header->keys_bytes, 0) == header->checksum);
+    }
+    if (!valid) {
+        munmap(base, nbytes);
+        return NULL;
+    }
+
+    Dict* mp = (Dict*)malloc(sizeof(Dict));
+    assert(mp != NULL);
+    dk->dk_mapped = 1;
+    dk->dk_alloc = &allocDefault;
+    dk->dk_refcnt = 1;
+    dk->keyCmpFunc = _DictKeys_DefaultKeyCmpFunc;
+    dk->keyHashFunc = _DictKeys_DefaultKeyHashFunc;
+    dk->dk_ops = _DictKeys_SelectOps(dk);
+    mp->extra = NULL;
+    DictExtra* extra = _dictExtra(mp);
+#ifdef DICT_STATS
+    dk->dk_stats = &extra->stats;
+#endif
+    bool readonly = !(flags & DICT_MAP_COPY_ON_WRITE);
+    if (readonly) {
+        mprotect(base, nbytes, PROT_READ);
+    }
+
+    mp->used = header->used;
+    mp->kind = dk->dk_kind;
+    mp->small_used = 0;
+    mp->min_log2_size = 0;
+    mp->keys = dk;
+    mp->split = false;
+    mp->oldkeys = NULL;
+    extra->mapping = base;
+    extra->mapping_bytes = nbytes;
+    extra->mapping_readonly = readonly;
+    return mp;
+}
+
+// Whether the header of mapped keys describes a keys object of nbytes
+// holding used keys. Each field is checked before anything is derived
+// from it, so a truncated or corrupt file is rejected without reading
+// past the mapping; the contents of the tables are not checked.
+static bool
+_DictKeys_MappedValid(DictKeys* dk, size_t nbytes, uint64_t used) {
+    if (dk->dk_kind == DICT_KIND_FROZEN) {
+        if (dk->dk_log2_size != 0 || dk->dk_index_bytes != 0
+                || dk->dk_nentries > nbytes / sizeof(DictKeyEntry) || used != dk->dk_nentries
+                // the size of frozen keys is read after their entries
+                || _DictKeys_FrozenBytes(dk->dk_nentries, 0, 0, 0) > nbytes) {
+            return false;
+        }
+        DictFrozen* fz = DK_FROZEN(dk);
+        if (fz->nbuckets > nbytes || fz->nbig > fz->nbuckets
+                || fz->nslots < dk->dk_nentries || fz->nslots - dk->dk_nentries > nbytes) {
+            return false;
+        }
+        return _DictKeys_Bytes(dk) == nbytes;
+    }
+    if (dk->dk_kind != DICT_KIND_COMBINED && dk->dk_kind != DICT_KIND_SWISS) {
+        return false;
+    }
+    if (dk->dk_log2_size < DICT_LOG_MINSIZE || dk->dk_log2_size >= 8 * sizeof(size_t)
+            || DK_SIZE(dk) > nbytes
+            || dk->dk_index_bytes != _DictKeys_IndexBytes(dk->dk_log2_size, dk->dk_kind)
+            || _DictKeys_Bytes(dk) != nbytes) {
+        return false;
+    }
+    size_t nslots = (dk->dk_kind == DICT_KIND_SWISS) ? DK_SIZE(dk) : USABLE_FRACTION(DK_SIZE(dk));
+    return dk->dk_nentries <= nslots && dk->dk_usable <= nslots && used <= dk->dk_nentries;
+}
+
+// not cryptographic, 8 bytes per step
+static uint64_t
+_dictChecksum(const void* data, size_t nbytes, uint64_t h) {
+    const unsigned char* p = (const unsigned char*)data;
+    size_t i = 0;
+    for (; i + 8 <= nbytes; i += 8) {
+        uint64_t w;
+        memcpy(&w, &p[i], 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    for (; i < nbytes; i++) {
+        h = (h ^ p[i]) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+// << snapshots
+
+extern bool
+dictIterNext(DictIter *iter, DictKeyType *key_, DictValueType *val_) {
+    if (iter->mp->keys == NULL) {
+        // the inline entries keep their positions in a combined
+        // keys object, if one is allocated between the calls
+        if (iter->pos >= iter->mp->small_used) {
+            return 0;
+        }
+        *key_ = iter->mp->small_keys[iter->pos];
+        *val_ = iter->mp->small_values[iter->pos];
+        iter->pos++;
+        return 1;
+    }
+    if (iter->mp->oldkeys != NULL) {
+        // positions are only meaningful in a single keys object
+        _dictRehashStep(iter->mp, SIZE_MAX);
+    }
+    DictKeys* dk = iter->mp->keys;
+    DictKeyEntry* entries = DK_ENTRIES(dk);
+    size_t i = iter->pos;
+    if (dk->dk_kind == DICT_KIND_FROZEN) {
+        // no deleted entries
+        if (i >= dk->dk_nentries) {
+            return 0;
+        }
+        *key_ = entries[i].key;
+        *val_ = entries[i].value;
+        iter->pos++;
+        return 1;
+    }
+    if (dk->dk_kind == DICT_KIND_SWISS) {
+        const int8_t* ctrl = (const int8_t*)dk->dk_indices;
+        for (; i < DK_SIZE(dk); i++, iter->pos++) {
+            if (ctrl[i] >= 0) {
+                *key_ = entries[i].key;
+                *val_ = entries[i].value;
+                iter->pos++;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (; i < dk->dk_nentries; i++, iter->pos++) {
+        if (!DKE_IS_DELETED(dk, i)) {
+            *key_ = entries[i].key;
+            *val_ = *_dictValue(iter->mp, dk, i);
+            iter->pos++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// >> scans
+// Whole-table aggregates over the values, for the scans that would
+// otherwise walk the dict with dictIterNext. The entries are read in
+// place, 4 at a time: SSE2 shuffles pick the values (and the hashes that
+// mark deleted entries) out of the entries, and the dead slots are
+// masked out lane by lane. A split table reads its values array instead.
+// An incremental resize in progress is not completed: the entries left
+// in mp->oldkeys are read there (see _dictScanRanges).
+
+// the vector loops read 4-byte keys and int32 values
+#define DICT_SCAN_VECTOR \
+    (_Generic((DictValueType)0, int32_t: 1, default: 0) && sizeof(DictKeyType) == 4)
+
+// entries [start, end) of dk
+typedef struct {
+    DictKeys* dk;
+    size_t start;
+    size_t end;
+} DictScanRange;
+
+// end of the entry positions to scan
+static inline size_t
+_DictKeys_ScanEnd(DictKeys* dk) {
+    return (dk->dk_kind == DICT_KIND_SWISS) ? DK_SIZE(dk) : dk->dk_nentries;
+}
+
+// The entries holding the keys of mp, in iteration order: all of keys,
+// or while resizing incrementally the migrated entries, the ones left
+// in oldkeys and the ones inserted since. The reserved entries between
+// rehash_ix and rehash_end are skipped, they aren't marked deleted.
+static size_t
+_dictScanRanges(Dict* mp, DictScanRange ranges[3]) {
+    DictKeys* dk = mp->keys;
+    if (mp->oldkeys == NULL) {
+        ranges[0].dk = dk;
+        ranges[0].start = 0;
+        ranges[0].end = _DictKeys_ScanEnd(dk);
+        return 1;
+    }
+    DictExtra* extra = mp->extra;
+    ranges[0].dk = dk;
+    ranges[0].start = 0;
+    ranges[0].end = extra->rehash_ix;
+    ranges[1].dk = mp->oldkeys;
+    ranges[1].start = extra->rehash_pos;
+    ranges[1].end = mp->oldkeys->dk_nentries;
+    ranges[2].dk = dk;
+    ranges[2].start = extra->rehash_end;
+    ranges[2].end = dk->dk_nentries;
+    return 3;
+}
+
+static inline bool
+_DictKeys_ScanLive(DictKeys* dk, size_t i) {
+    if (dk->dk_kind == DICT_KIND_FROZEN) {
+        return true;
+    }
+    if (dk->dk_kind == DICT_KIND_SWISS) {
+        return ((const int8_t*)dk->dk_indices)[i] >= 0;
+    }
+    return !DKE_IS_DELETED(dk, i);
+}
+
+#ifdef __SSE2__
+// all ones in the lanes of entries [i, i + 4) that hold a key
+static inline __m128i
+_DictKeys_ScanLive4(DictKeys* dk, size_t i) {
+    __m128i ones = _mm_set1_epi32(-1);
+    if (dk->dk_kind == DICT_KIND_FROZEN) {
+        return ones;
+    }
+    if (dk->dk_kind == DICT_KIND_SWISS) {
+        // each control byte spread to the top of a lane, full slots are >= 0
+        int32_t ctrl;
+        memcpy(&ctrl, &dk->dk_indices[i], sizeof(ctrl));
+        __m128i x = _mm_cvtsi32_si128(ctrl);
+        x = _mm_unpacklo_epi8(x, x);
+        x = _mm_unpacklo_epi16(x, x);
+        return _mm_cmpgt_epi32(x, ones);
+    }
+#ifdef DICT_COMPACT_ENTRIES
+    // i is a multiple of 4, the nibble doesn't cross a word
+    uint32_t nibble = (uint32_t)(DK_LIVE(dk)[i >> 6] >> (i & 63)) & 0xf;
+    __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+    return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int32_t)nibble), bits), bits);
+#else
+    const __m128i* ep = (const __m128i*)&DK_ENTRIES(dk)[i];
+    __m128i a = _mm_unpacklo_epi32(_mm_loadu_si128(&ep[0]), _mm_loadu_si128(&ep[1]));
+    __m128i b = _mm_unpacklo_epi32(_mm_loadu_si128(&ep[2]), _mm_loadu_si128(&ep[3]));
+    // the low and high halves of the 4 hashes
+    __m128i lo = _mm_cmpeq_epi32(_mm_unpacklo_epi64(a, b), ones);
+    __m128i hi = _mm_cmpeq_epi32(_mm_unpackhi_epi64(a, b), ones);
+    return _mm_andnot_si128(_mm_and_si128(lo, hi), ones);
+#endif
+}
+
+// the values of entries [i, i + 4), whether live or not
+static inline __m128i
+_dictScanValues4(Dict* mp, DictKeys* dk, size_t i) {
+    if (mp->split) {
+        return _mm_loadu_si128((const __m128i*)&mp->values[i]);
+    }
+#ifdef DICT_COMPACT_ENTRIES
+    // key, value pairs
+    __m128 a = _mm_loadu_ps((const float*)&DK_ENTRIES(dk)[i]);
+    __m128 b = _mm_loadu_ps((const float*)&DK_ENTRIES(dk)[i + 2]);
+    return _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+#else
+    // hash, key, value
+    const __m128i* ep = (const __m128i*)&DK_ENTRIES(dk)[i];
+    __m128i a = _mm_unpackhi_epi32(_mm_loadu_si128(&ep[0]), _mm_loadu_si128(&ep[1]));
+    __m128i b = _mm_unpackhi_epi32(_mm_loadu_si128(&ep[2]), _mm_loadu_si128(&ep[3]));
+    return _mm_unpackhi_epi64(a, b);
+#endif
+}
+
+// a where mask is set, else b
+static inline __m128i
+_dictScanSelect(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// _DictKeys_ScanLive4 without the lanes of the entries before start,
+// for a range that doesn't begin on a multiple of 4
+static inline __m128i
+_DictKeys_ScanLive4From(DictKeys* dk, size_t i, size_t start) {
+    __m128i live = _DictKeys_ScanLive4(dk, i);
+    if (start > i) {
+        __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+        live = _mm_and_si128(live, _mm_cmpgt_epi32(lanes, _mm_set1_epi32((int32_t)(start - i) - 1)));
+    }
+    return live;
+}
+#endif
+
+static int64_t
+_dictSumRange(Dict* mp, const DictScanRange* range) {
+    DictKeys* dk = range->dk;
+    size_t n = range->end;
+    size_t i = range->start;
+    int64_t sum = 0;
+#ifdef __SSE2__
+    if (DICT_SCAN_VECTOR) {
+        // sign extended to two 64-bit lanes
+        __m128i acc = _mm_setzero_si128();
+        for (size_t j = i & ~(size_t)3; j + 4 <= n; j += 4) {
+            __m128i v = _mm_and_si128(_dictScanValues4(mp, dk, j), _DictKeys_ScanLive4From(dk, j, i));
+            __m128i sign = _mm_srai_epi32(v, 31);
+            acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+            acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+            i = j + 4;
+        }
+        int64_t lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        sum = lanes[0] + lanes[1];
+    }
+#endif
+    for (; i < n; i++) {
+        if (_DictKeys_ScanLive(dk, i)) {
+            sum += *_dictValue(mp, dk, i);
+        }
+    }
+    return sum;
+}
+
+extern int64_t
+dictSumValues(Dict* mp) {
+    int64_t sum = 0;
+    if (mp->keys == NULL) {
+        for (size_t i = 0; i < mp->small_used; i++) {
+            sum += mp->small_values[i];
+        }
+        return sum;
+    }
+    DictScanRange ranges[3];
+    size_t nranges = _dictScanRanges(mp, ranges);
+    for (size_t r = 0; r < nranges; r++) {
+        sum += _dictSumRange(mp, &ranges[r]);
+    }
+    return sum;
+}
+
+// the bounds of the live values of range folded into *lo and *hi,
+// which only hold bounds yet if *found
+static void
+_dictMinMaxRange(Dict* mp, const DictScanRange* range, DictValueType* lo, DictValueType* hi, bool* found) {
+    DictKeys* dk = range->dk;
+    size_t n = range->end;
+    size_t i = range->start;
+#ifdef __SSE2__
+    if (DICT_SCAN_VECTOR && n >= 4) {
+        // the dead lanes hold the bounds, any tells if a lane was live
+        __m128i vmin = _mm_set1_epi32(INT32_MAX);
+        __m128i vmax = _mm_set1_epi32(INT32_MIN);
+        __m128i any = _mm_setzero_si128();
+        for (size_t j = i & ~(size_t)3; j + 4 <= n; j += 4) {
+            __m128i live = _DictKeys_ScanLive4From(dk, j, i);
+            __m128i v = _dictScanValues4(mp, dk, j);
+            __m128i lt = _mm_and_si128(_mm_cmplt_epi32(v, vmin), live);
+            __m128i gt = _mm_and_si128(_mm_cmpgt_epi32(v, vmax), live);
+            vmin = _dictScanSelect(lt, v, vmin);
+            vmax = _dictScanSelect(gt, v, vmax);
+            any = _mm_or_si128(any, live);
+            i = j + 4;
+        }
+        if (_mm_movemask_epi8(any) != 0) {
+            int32_t lmin[4], lmax[4];
+            _mm_storeu_si128((__m128i*)lmin, vmin);
+            _mm_storeu_si128((__m128i*)lmax, vmax);
+            for (int j = 0; j < 4; j++) {
+                *lo = (!*found || lmin[j] < *lo) ? (DictValueType)lmin[j] : *lo;
+                *hi = (!*found || lmax[j] > *hi) ? (DictValueType)lmax[j] : *hi;
+                *found = true;
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (_DictKeys_ScanLive(dk, i)) {
+            DictValueType v = *_dictValue(mp, dk, i);
+            *lo = (!*found || v < *lo) ? v : *lo;
+            *hi = (!*found || v > *hi) ? v : *hi;
+            *found = true;
+        }
+    }
+}
+
+// false (min and max untouched) if mp is empty
+extern bool
+dictMinMaxValues(Dict* mp, DictValueType* min, DictValueType* max) {
+    if (mp->used == 0) {
+        return false;
+    }
+    DictValueType lo = 0, hi = 0;
+    bool found = false;
+    if (mp->keys == NULL) {
+        for (size_t i = 0; i < mp->small_used; i++) {
+            DictValueType v = mp->small_values[i];
+            lo = (!found || v < lo) ? v : lo;
+            hi = (!found || v > hi) ? v : hi;
+            found = true;
+        }
+        *min = lo;
+        *max = hi;
+        return true;
+    }
+    DictScanRange ranges[3];
+    size_t nranges = _dictScanRanges(mp, ranges);
+    for (size_t r = 0; r < nranges; r++) {
+        _dictMinMaxRange(mp, &ranges[r], &lo, &hi, &found);
+    }
+    *min = lo;
+    *max = hi;
+    return true;
+}
+
+// the keys of range whose value is in [lo, hi] go to keys[count], up to
+// keys[n - 1]; returns count plus how many there are
+static size_t
+_dictSelectRange(Dict* mp, const DictScanRange* range, DictValueType lo, DictValueType hi,
+                 DictKeyType* keys, size_t n, size_t count) {
+    DictKeys* dk = range->dk;
+    DictKeyEntry* entries = DK_ENTRIES(dk);
+    size_t end = range->end;
+    size_t i = range->start;
+#ifdef __SSE2__
+    if (DICT_SCAN_VECTOR) {
+        __m128i vlo = _mm_set1_epi32((int32_t)lo);
+        __m128i vhi = _mm_set1_epi32((int32_t)hi);
+        for (size_t j = i & ~(size_t)3; j + 4 <= end; j += 4) {
+            __m128i v = _dictScanValues4(mp, dk, j);
+            __m128i out = _mm_or_si128(_mm_cmplt_epi32(v, vlo), _mm_cmpgt_epi32(v, vhi));
+            __m128i in = _mm_andnot_si128(out, _DictKeys_ScanLive4From(dk, j, i));
+            uint32_t bits = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(in));
+            for (; bits != 0; bits &= bits - 1) {
+                if (count < n) {
+                    keys[count] = entries[j + __builtin_ctz(bits)].key;
+                }
+                count++;
+            }
+            i = j + 4;
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        if (_DictKeys_ScanLive(dk, i)) {
+            DictValueType v = *_dictValue(mp, dk, i);
+            if (v >= lo && v <= hi) {
+                if (count < n) {
+                    keys[count] = entries[i].key;
+                }
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// The keys whose value is in [lo, hi], in iteration order. The first n
+// of them are written to keys; returns how many there are.
+extern size_t
+dictSelectKeys(Dict* mp, DictValueType lo, DictValueType hi, DictKeyType* keys, size_t n) {
+    size_t count = 0;
+    if (mp->keys == NULL) {
+        for (size_t i = 0; i < mp->small_used; i++) {
+            DictValueType v = mp->small_values[i];
+            if (v >= lo && v <= hi) {
+                if (count < n) {
+                    keys[count] = mp->small_keys[i];
+                }
+                count++;
+            }
+        }
+        return count;
+    }
+    DictScanRange ranges[3];
+    size_t nranges = _dictScanRanges(mp, ranges);
+    for (size_t r = 0; r < nranges; r++) {
+        count = _dictSelectRange(mp, &ranges[r], lo, hi, keys, n, count);
+    }
+    return count;
+}
+// << scans
+
+// >> cursors
+// dictScan walks the entry positions like dictIterNext, but keeps going
+// across resizes: the cursor remembers the epoch of its position, and
+// the moves of a combined table (resizes, compaction, incremental
+// migration, the deletes of inline entries) keep the live entries in
+// order, only closing the gaps of the deleted ones. The move records in
+// scan_map, for every 64 old positions, the live ones among them and
+// where the first of those went, so a position of the previous epoch
+// maps exactly to a new one. Further moves before a cursor comes back
+// are composed into scan_map. Once a move has recorded scan_map, the
+// following ones keep it up to date until a scan completes: an
+// abandoned scan costs a composition per move.
+// An incremental migration only moves the entries once it is complete:
+// until then the cursors keep the positions of oldkeys, followed by the
+// entries inserted in keys since, and rehash_map tells where the
+// migrated ones are (_dictScanMigrating).
+// The scan stops at the end of the entries of its first call, or keys
+// appended as fast as they are scanned would keep it going.
+// A swiss table is walked in hash order instead, which doesn't depend
+// on the slots (_dictScanSwiss). A frozen table doesn't move.
+
+// the keys of a home group that _dictScanSwiss sorts without allocating
+#define DICT_SCAN_SLOTS 64
+
+// the end of the positions of the cursors
+static size_t
+_dictScanLimit(Dict* mp) {
+    DictKeys* dk = mp->keys;
+    if (dk == NULL) {
+        return mp->small_used;
+    }
+    if (mp->oldkeys != NULL) {
+        return mp->oldkeys->dk_nentries + (dk->dk_nentries - mp->extra->rehash_end);
+    }
+    return _DictKeys_ScanEnd(dk);
+}
+
+// where position pos went with map, see DictExtra.scan_map
+static inline size_t
+_dictScanMapPos(const DictScanBlock* map, size_t end, size_t tail, size_t pos) {
+    if (pos >= end) {
+        return tail + (pos - end);
+    }
+    const DictScanBlock* block = &map[pos >> 6];
+    return block->base + (size_t)__builtin_popcountll(block->live & (((uint64_t)1 << (pos & 63)) - 1));
+}
+
+// Each call returns up to n more keys (and their values, if values is
+// not NULL), 0 once the scan is complete. Every key that is present from
+// the first call to the last is returned at least once, a key added or
+// removed meanwhile may or may not be. Writes may go on between the
+// calls.
+extern size_t
+dictScan(Dict* mp, DictCursor* cursor, DictKeyType* keys, DictValueType* values, size_t n) {
+    DictExtra* extra = _dictExtra(mp);
+    DictKeys* dk = mp->keys;
+    if (dk != NULL && dk->dk_kind == DICT_KIND_SWISS) {
+        return _dictScanSwiss(mp, cursor, keys, values, n);
+    }
+    size_t limit = _dictScanLimit(mp);
+    size_t pos = cursor->pos;
+    size_t end = cursor->end;
+    if (pos == 0 && end == 0) {
+        // a new scan
+        end = limit;
+    } else if (cursor->epoch != extra->scan_epoch) {
+        if (extra->scan_map != NULL && cursor->epoch == extra->scan_map_epoch) {
+            pos = _dictScanMapPos(extra->scan_map, extra->scan_map_end, extra->scan_map_tail, pos);
+            end = _dictScanMapPos(extra->scan_map, extra->scan_map_end, extra->scan_map_tail, end);
+        } else {
+            pos = 0;
+            end = limit;
+        }
+    }
+    if (end > limit) {
+        end = limit;
+    }
+    cursor->epoch = extra->scan_epoch;
+
+    size_t count = 0;
+    if (dk == NULL) {
+        for (; pos < end && count < n; pos++, count++) {
+            keys[count] = mp->small_keys[pos];
+            if (values != NULL) {
+                values[count] = mp->small_values[pos];
+            }
+        }
+    } else if (mp->oldkeys != NULL) {
+        count = _dictScanMigrating(mp, &pos, end, keys, values, n);
+    } else {
+        DictKeyEntry* entries = DK_ENTRIES(dk);
+        for (; pos < end && count < n; pos++) {
+            if (_DictKeys_ScanLive(dk, pos)) {
+                keys[count] = entries[pos].key;
+                if (values != NULL) {
+                    values[count] = *_dictValue(mp, dk, pos);
+                }
+                count++;
+            }
+        }
+    }
+    cursor->pos = pos;
+    cursor->end = end;
+    if (count > 0) {
+        // the cursor will be back, at this epoch
+        extra->scan_remap = true;
+    } else if (pos >= end) {
+        // complete, the moves need not be followed any more
+        extra->scan_remap = false;
+        free(extra->scan_map);
+        extra->scan_map = NULL;
+    }
+    return count;
+}
+
+// dictScan from *pos while resizing incrementally. An entry of oldkeys
+// below rehash_pos is found in keys through rehash_map; the deletes
+// made since its migration only mark the keys entry.
+static size_t
+_dictScanMigrating(Dict* mp, size_t* pos, size_t end, DictKeyType* keys, DictValueType* values, size_t n) {
+    DictExtra* extra = mp->extra;
+    DictKeys* oldkeys = mp->oldkeys;
+    DictKeys* dk = mp->keys;
+    size_t nold = oldkeys->dk_nentries;
+    size_t i = *pos;
+    size_t count = 0;
+    if (i < extra->rehash_pos) {
+        size_t ix = _dictScanMapPos(extra->rehash_map, extra->rehash_pos, extra->rehash_ix, i);
+        for (; i < extra->rehash_pos && i < end && count < n; i++) {
+            if ((extra->rehash_map[i >> 6].live & ((uint64_t)1 << (i & 63))) == 0) {
+                continue;
+            }
+            if (!DKE_IS_DELETED(dk, ix)) {
+                keys[count] = DK_ENTRIES(dk)[ix].key;
+                if (values != NULL) {
+                    values[count] = DK_ENTRIES(dk)[ix].value;
+                }
+                count++;
+            }
+            ix++;
+        }
+    }
+    for (; i < nold && i < end && count < n; i++) {
+        if (!DKE_IS_DELETED(oldkeys, i)) {
+            keys[count] = DK_ENTRIES(oldkeys)[i].key;
+            if (values != NULL) {
+                values[count] = DK_ENTRIES(oldkeys)[i].value;
+            }
+            count++;
+        }
+    }
+    // the entries inserted during the migration
+    for (; i < end && count < n; i++) {
+        size_t ix = extra->rehash_end + (i - nold);
+        if (!DKE_IS_DELETED(dk, ix)) {
+            keys[count] = DK_ENTRIES(dk)[ix].key;
+            if (values != NULL) {
+                values[count] = DK_ENTRIES(dk)[ix].value;
+            }
+            count++;
+        }
+    }
+    *pos = i;
+    return count;
+}
+
+static int
+_dictScanSlotCmp(const void* a, const void* b) {
+    const DictScanSlot* x = (const DictScanSlot*)a;
+    const DictScanSlot* y = (const DictScanSlot*)b;
+    if (x->hash != y->hash) {
+        return (x->hash < y->hash) ? -1 : 1;
+    }
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+// dictScan of a swiss table. The home groups are walked in order, which
+// is the order of the mixed hashes (SWISS_H1 is their top bits): the
+// cursor stays valid through rehashes to any size. A home group whose
+// keys don't all fit in the call is cut in the order of (hash, key).
+// Unlike with the entry positions, the keys inserted ahead of the cursor
+// are returned too: a table that grows by more than n keys per call
+// takes that much longer to scan.
+// The cursor keeps end at 1 while the scan goes on, pos at 1 once it is
+// complete.
+static size_t
+_dictScanSwiss(Dict* mp, DictCursor* cursor, DictKeyType* keys, DictValueType* values, size_t n) {
+    DictExtra* extra = mp->extra;
+    DictKeys* dk = mp->keys;
+    if ((cursor->pos == 0 && cursor->end == 0) || cursor->epoch != extra->scan_epoch) {
+        // a new scan, or the table wasn't swiss at the epoch of the cursor
+        cursor->pos = 0;
+        cursor->end = 1;
+        cursor->hash = 0;
+        cursor->key = INT_MIN;
+    }
+    cursor->epoch = extra->scan_epoch;
+    if (cursor->pos != 0) {
+        return 0;
+    }
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);
+    size_t ngroups = DK_SIZE(dk) >> SWISS_GROUP_SHIFT;
+    uint8_t group_bits = DK_LOG_SIZE(dk) - SWISS_GROUP_SHIFT;
+    DictScanSlot buf[DICT_SCAN_SLOTS];
+    size_t count = 0;
+    for (size_t g = SWISS_H1(dk, cursor->hash) >> SWISS_GROUP_SHIFT; g < ngroups; g++) {
+        DictScanSlot* slots = buf;
+        size_t m = _DictKeys_SwissHomeSlots(dk, g, cursor->hash, cursor->key, slots, DICT_SCAN_SLOTS);
+        if (m > DICT_SCAN_SLOTS) {
+            slots = (DictScanSlot*)malloc(m * sizeof(DictScanSlot));
+            assert(slots != NULL);
+            _DictKeys_SwissHomeSlots(dk, g, cursor->hash, cursor->key, slots, m);
+        }
+        bool cut = (count + m > n);
+        if (cut) {
+            // the call ends with the first keys of the group
+            qsort(slots, m, sizeof(DictScanSlot), _dictScanSlotCmp);
+            m = n - count;
+            cursor->hash = slots[m].hash;
+            cursor->key = slots[m].key;
+        }
+        for (size_t j = 0; j < m; j++) {
+            keys[count] = ep0[slots[j].slot].key;
+            if (values != NULL) {
+                values[count] = *_dictValue(mp, dk, slots[j].slot);
+            }
+            count++;
+        }
+        if (slots != buf) {
+            free(slots);
+        }
+        if (cut) {
+            return count;
+        }
+        if (g + 1 == ngroups) {
+            break;
+        }
+        cursor->hash = (hash_t)(g + 1) << (64 - group_bits);
+        cursor->key = INT_MIN;
+        if (count == n) {
+            return count;
+        }
+    }
+    cursor->pos = 1;
+    return count;
+}
+
+// the entries are moving, the positions of the current epoch
+// are not valid afterwards, and no cursor is at the new one yet
+static void
+_dictScanMoved(Dict* mp) {
+    DictExtra* extra = mp->extra;
+    if (extra == NULL) {
+        // no cursor was ever used
+        return;
+    }
+    extra->scan_epoch++;
+    extra->scan_remap = false;
+    free(extra->scan_map);
+    extra->scan_map = NULL;
+}
+
+// a cursor may be back at the current epoch or at scan_map_epoch
+static inline bool
+_dictScanTracked(Dict* mp) {
+    return mp->extra != NULL && (mp->extra->scan_remap || mp->extra->scan_map != NULL);
+}
+
+// The entries are moving as map tells (see scan_map), map is taken.
+// If no cursor came since the last move, the one before it is
+// composed with this one for the cursors still at scan_map_epoch.
+static void
+_dictScanMovedBy(Dict* mp, DictScanBlock* map, size_t end, size_t tail) {
+    DictExtra* extra = mp->extra;
+    if (!_dictScanTracked(mp)) {
+        free(map);
+        _dictScanMoved(mp);
+        return;
+    }
+    uint64_t epoch = extra->scan_epoch;
+    if (!extra->scan_remap) {
+        DictScanBlock* prev = extra->scan_map;
+        size_t prev_end = extra->scan_map_end;
+        size_t prev_tail = extra->scan_map_tail;
+        // both moves only shift the positions from there on
+        size_t composed_end = prev_end + ((end > prev_tail) ? end - prev_tail : 0);
+        DictScanBlock* composed = (DictScanBlock*)malloc(((composed_end >> 6) + 1) * sizeof(DictScanBlock));
+        assert(composed != NULL);
+        size_t at = _dictScanMapPos(map, end, tail, _dictScanMapPos(prev, prev_end, prev_tail, 0));
+        for (size_t i = 0; i < composed_end; i++) {
+            if ((i & 63) == 0) {
+                composed[i >> 6].base = at;
+                composed[i >> 6].live = 0;
+            }
+            size_t next = _dictScanMapPos(map, end, tail, _dictScanMapPos(prev, prev_end, prev_tail, i + 1));
+            if (next > at) {
+                // live through both moves
+                composed[i >> 6].live |= (uint64_t)1 << (i & 63);
+            }
+            at = next;
+        }
+        free(map);
+        map = composed;
+        end = composed_end;
+        tail = at;
+        epoch = extra->scan_map_epoch;
+    }
+    _dictScanMoved(mp);
+    extra->scan_map = map;
+    extra->scan_map_epoch = epoch;
+    extra->scan_map_end = end;
+    extra->scan_map_tail = tail;
+}
+
+// the live entries of dk are about to slide down in order
+static void
+_dictScanRemap(Dict* mp, DictKeys* dk) {
+    if (!_dictScanTracked(mp)) {
+        _dictScanMoved(mp);
+        return;
+    }
+    size_t nentries = dk->dk_nentries;
+    DictScanBlock* map = (DictScanBlock*)malloc(((nentries >> 6) + 1) * sizeof(DictScanBlock));
+    assert(map != NULL);
+    size_t nlive = 0;
+    for (size_t i = 0; i < nentries; i++) {
+        if ((i & 63) == 0) {
+            map[i >> 6].base = nlive;
+            map[i >> 6].live = 0;
+        }
+        if (!DKE_IS_DELETED(dk, i)) {
+            map[i >> 6].live |= (uint64_t)1 << (i & 63);
+            nlive++;
+        }
+    }
+    _dictScanMovedBy(mp, map, nentries, nlive);
+}
+// << cursors
+
+static uint8_t
+calc_log2_keysize(size_t minsize) {
+    uint8_t new_log2_size = DICT_LOG_MINSIZE;
+    for (; ((size_t)1 << new_log2_size) < minsize; ) {
+        new_log2_size++;
+    }
+    return new_log2_size;
+}
+
+// the size of the table a resize of mp builds, grown or shrunk
+static uint8_t
+_dictResizeLog2(Dict* mp) {
+    uint8_t log2_size = calc_log2_keysize(GROWTH_RATE(mp));
+    return (log2_size < mp->min_log2_size) ? mp->min_log2_size : log2_size;
+}
+
+static void
+_dictResize(Dict* mp) {
+#ifdef DICT_STATS
+    DictKeys* keys = mp->keys;
+    DictStatsCounters* st = keys->dk_stats;
+    uint64_t t0 = _dictNowNs();
+    _dictDoResize(mp);
+    DICT_STAT_ADD(st->resize_ns, _dictNowNs() - t0);
+    DICT_STAT_ADD(st->resizes, 1);
+    if (mp->keys != keys) {
+        DICT_STAT_ADD(st->bytes_allocated, _DictKeys_Bytes(mp->keys));
+    }
+#else
+    _dictDoResize(mp);
+#endif
+}
+
+static void
+_dictDoResize(Dict* mp) {
+    if (mp->keys->dk_kind == DICT_KIND_SWISS) {
+        _dictResizeSwiss(mp);
+        return;
+    }
+    if (mp->oldkeys != NULL) {
+        // the previous resize has to complete first
+        _dictRehashStep(mp, SIZE_MAX);
+        if (mp->keys->dk_usable > 0) {
+            return;
+        }
+    }
+    uint8_t new_log2_size = _dictResizeLog2(mp);
+    if (mp->extra != NULL && mp->extra->incremental_resize) {
+        _dictResizeIncremental(mp, new_log2_size);
+        return;
+    }
+    // both below keep the order of the live entries
+    _dictScanRemap(mp, mp->keys);
+    if (new_log2_size == DK_LOG_SIZE(mp->keys)) {
+        // the deleted entries take up at least half of the usable ones
+        _DictKeys_Compact(mp->keys);
+        return;
+    }
+
+    DictKeys* oldkeys = mp->keys;
+    size_t nentries = mp->used;
+
+    mp->keys = _DictKeys_New(new_log2_size, DICT_KIND_COMBINED, oldkeys->dk_seed, _dictAlloc(mp));
+    DICT_STAT_LINK(mp->keys, oldkeys);
+    // if (mp->keys == NULL) {
+    //     mp->keys = oldkeys;
+    //     return;
+    // }
+    assert(mp->keys != NULL);
+
+    assert(mp->keys->dk_usable >= nentries);
+
+    DictKeyEntry* old_entries = DK_ENTRIES(oldkeys);
+    DictKeyEntry* new_entries = DK_ENTRIES(mp->keys);
+    uint32_t nthreads = (mp->extra != NULL) ? mp->extra->resize_threads : 0;
+    bool parallel = (nthreads > 1 && nentries >= DICT_PARALLEL_MIN);
+    if (oldkeys->dk_nentries == nentries && !parallel) {
+        memcpy(new_entries, old_entries, nentries * sizeof(DictKeyEntry));
+        _DictKeys_BuildIndices(mp->keys, new_entries, nentries);
+    } else if (parallel) {
+        // the copy streams, the scattered index writes are shared out
+        size_t j = 0;
+        for (size_t ix = 0; ix < nentries; ix++, j++) {
+            for (; DKE_IS_DELETED(oldkeys, j);) {
+                j++;
+            }
+            memcpy(&new_entries[ix], &old_entries[j], sizeof(DictKeyEntry));
+        }
+        DKE_SET_LIVE_RANGE(mp->keys, nentries);
+        _DictKeys_BuildParallel(mp->keys, NULL, NULL, nentries, nthreads, NULL);
+    } else {
+        size_t j = 0;
+        for (ix_t ix = 0; ix < nentries; ix++, j++) {
+            for (; DKE_IS_DELETED(oldkeys, j);) {
+                j++;
+            }
+            DictKeyEntry* ep = &old_entries[j];
+            size_t i = _DictKeys_FindEmptySlot(mp->keys, DKE_HASH(oldkeys, ep));
+            memcpy(&new_entries[ix], ep, sizeof(DictKeyEntry));
+            _DictKeys_SetIndex(mp->keys, i, ix);
+        }
+    }
+    DKE_SET_LIVE_RANGE(mp->keys, nentries);
+
+    _DictKeys_Free(oldkeys);
+
+    mp->keys->dk_usable -= nentries;
+    mp->keys->dk_nentries = nentries;
+}
+
+// Start an incremental resize. The live entries keep their order:
+// they are migrated to the front of the new entries (rehash_ix),
+// while new keys are appended after the reserved range.
+static void
+_dictResizeIncremental(Dict* mp, uint8_t new_log2_size) {
+    DictKeys* oldkeys = mp->keys;
+    size_t nlive = mp->used;
+
+    // The new keys have to take inserts for as long as the migration
+    // of the old entries lasts, which matters when shrinking.
+    size_t nsteps = oldkeys->dk_nentries / DICT_REHASH_STEP + 1;
+    for (; USABLE_FRACTION((size_t)1 << new_log2_size) <= nlive + nsteps; ) {
+        new_log2_size++;
+    }
+    mp->keys = _DictKeys_New(new_log2_size, DICT_KIND_COMBINED, oldkeys->dk_seed, _dictAlloc(mp));
+    DICT_STAT_LINK(mp->keys, oldkeys);
+    assert(mp->keys != NULL);
+    assert(mp->keys->dk_usable > nlive);
+
+    DictExtra* extra = mp->extra;
+    mp->keys->dk_usable -= nlive;
+    mp->keys->dk_nentries = nlive;
+    mp->oldkeys = oldkeys;
+    extra->rehash_pos = 0;
+    extra->rehash_ix = 0;
+    extra->rehash_end = nlive;
+
+    // filled in as the migration goes, the positions depend on
+    // the deletes made in the meantime. Cursors keep the positions
+    // of oldkeys until the migration is complete, see _dictScanMigrating.
+    extra->rehash_map = (DictScanBlock*)malloc(((oldkeys->dk_nentries >> 6) + 1) * sizeof(DictScanBlock));
+    assert(extra->rehash_map != NULL);
+}
+
+// migrate up to n entries from mp->oldkeys
+static void
+_dictRehashStep(Dict* mp, size_t n) {
+    DictKeys* oldkeys = mp->oldkeys;
+    if (oldkeys == NULL) {
+        return;
+    }
+    DictExtra* extra = mp->extra;
+    DictKeyEntry* old_entries = DK_ENTRIES(oldkeys);
+    DictKeyEntry* new_entries = DK_ENTRIES(mp->keys);
+    size_t end = oldkeys->dk_nentries;
+    for (; n > 0 && extra->rehash_pos < end; n--, extra->rehash_pos++) {
+        if ((extra->rehash_pos & 63) == 0) {
+            extra->rehash_map[extra->rehash_pos >> 6].base = extra->rehash_ix;
+            extra->rehash_map[extra->rehash_pos >> 6].live = 0;
+        }
+        DictKeyEntry* ep = &old_entries[extra->rehash_pos];
+        if (DKE_IS_DELETED(oldkeys, extra->rehash_pos)) {
+            continue;
+        }
+        assert(extra->rehash_ix < extra->rehash_end);
+        size_t i = _DictKeys_FindEmptySlot(mp->keys, DKE_HASH(oldkeys, ep));
+        memcpy(&new_entries[extra->rehash_ix], ep, sizeof(DictKeyEntry));
+        _DictKeys_SetIndex(mp->keys, i, extra->rehash_ix);
+        DKE_SET_LIVE(mp->keys, extra->rehash_ix);
+        extra->rehash_map[extra->rehash_pos >> 6].live |= (uint64_t)1 << (extra->rehash_pos & 63);
+        extra->rehash_ix++;
+    }
+    if (extra->rehash_pos == end) {
+        // keys deleted before being migrated leave their reserved
+        // entries unused
+        for (size_t ix = extra->rehash_ix; ix < extra->rehash_end; ix++) {
+            DKE_SET_DELETED(mp->keys, ix);
+        }
+        // the positions of the cursors become those of keys
+        _dictScanMovedBy(mp, extra->rehash_map, end, extra->rehash_end);
+        extra->rehash_map = NULL;
+        _DictKeys_Free(oldkeys);
+        mp->oldkeys = NULL;
+    }
+}
+
+// Look the key up in mp->keys and, while resizing incrementally,
+// in the entries of mp->oldkeys that are not migrated yet.
+static ix_t
+_dictLookup(Dict* mp, DictKeyType key, hash_t hash, DictKeys** dk_found) {
+    DictKeys* dk = _dictLoadKeys(mp);
+    ix_t ix = _DictKeys_Lookup(dk, key, hash);
+    if (ix < 0 && mp->oldkeys != NULL) {
+        ix_t old_ix = _DictKeys_Lookup(mp->oldkeys, key, hash);
+        if (old_ix >= 0 && (size_t)old_ix >= mp->extra->rehash_pos) {
+            dk = mp->oldkeys;
+            ix = old_ix;
+        }
+    }
+    *dk_found = dk;
+    return ix;
+}
+
+// Hash the keys, then prefetch their first index slots (control groups),
+// then the entries those slots point to.
+static void
+_DictKeys_Prefetch(DictKeys* dk, const DictKeyType* keys, hash_t* hashes, size_t n) {
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);
+    size_t mask = DK_MASK(dk);
+    for (size_t j = 0; j < n; j++) {
+        hashes[j] = _DictKeys_Hash(dk, keys[j]);
+    }
+    if (dk->dk_kind == DICT_KIND_FROZEN) {
+        if (dk->dk_nentries == 0) {
+            return;
+        }
+        DictFrozen* fz = DK_FROZEN(dk);
+        for (size_t j = 0; j < n; j++) {
+            DICT_PREFETCH(&fz->pilots[FROZEN_BUCKET(fz->nbuckets, hashes[j])]);
+        }
+        for (size_t j = 0; j < n; j++) {
+            DICT_PREFETCH(&ep0[_DictKeys_FrozenSlot(dk, hashes[j])]);
+        }
+        return;
+    }
+    if (dk->dk_kind == DICT_KIND_SWISS) {
+        const int8_t* ctrl = (const int8_t*)dk->dk_indices;
+        size_t groups[DICT_BATCH_SIZE];
+        for (size_t j = 0; j < n; j++) {
+            size_t g = SWISS_H1(dk, SWISS_MIX(hashes[j])) >> SWISS_GROUP_SHIFT;
+            groups[j] = g << SWISS_GROUP_SHIFT;
+            DICT_PREFETCH(&ctrl[groups[j]]);
+        }
+        for (size_t j = 0; j < n; j++) {
+            int8_t tag = SWISS_H2(dk, SWISS_MIX(hashes[j]));
+            uint32_t m = _swissGroupMatch(&ctrl[groups[j]], tag);
+            if (m != 0) {
+                DICT_PREFETCH(&ep0[groups[j] + __builtin_ctz(m)]);
+            }
+        }
+        return;
+    }
+    for (size_t j = 0; j < n; j++) {
+        DICT_PREFETCH(&dk->dk_indices[(hashes[j] & mask) * dk->dk_index_bytes]);
+    }
+    for (size_t j = 0; j < n; j++) {
+        ix_t ix = _DictKeys_GetIndex(dk, hashes[j] & mask);
+        if (ix >= 0) {
+            DICT_PREFETCH(&ep0[ix]);
+        }
+    }
+}
+
+static int
+_DictKeys_Get(DictKeys* dk, DictKeyType key, DictValueType* value) {
+    int err = 0;
+    ix_t ix = _DictKeys_Lookup(dk, key, _DictKeys_Hash(dk, key));
+    if (ix >= 0) {
+        *value = DK_ENTRIES(dk)[ix].value;
+    } else {
+        err = -1;
+    }
+    return err;
+}
+
+static int
+_DictKeys_Set(DictKeys* dk, DictKeyType key, DictValueType value) {
+    hash_t hash = _DictKeys_Hash(dk, key);
+    int ret = 0;
+    assert(dk->dk_usable > 0);
     ix_t ix = _DictKeys_Lookup(dk, key, hash);
-    DictKeyEntry* ep;
     if (ix < 0) {
         // Insert Key
-        size_t i = _DictKeys_FindEmptySlot(dk, hash);
-        _DictKeys_SetIndex(dk, i, dk->dk_nentries);
+        _DictKeys_Insert(dk, key, hash, value);
+    } else {
+        // Update Key
+        DictKeyEntry* ep = &DK_ENTRIES(dk)[ix];
+        ep->key = key;
+        ep->value = value;
+    }
+    return (ix < 0);
+}
+
+/* Insert a key that is known not to be present. */
+static DictKeyEntry*
+_DictKeys_Insert(DictKeys* dk, DictKeyType key, hash_t hash, DictValueType value) {
+    size_t slot;
+    if (dk->dk_kind == DICT_KIND_SWISS) {
+        slot = _DictKeys_SwissFindInsertSlot(dk, hash);
+    } else {
+        slot = _DictKeys_FindEmptySlot(dk, hash);
+    }
+    return _DictKeys_InsertAt(dk, slot, key, hash, value);
+}
+
+/* Insert a key into a free slot of its probe sequence. */
+static DictKeyEntry*
+_DictKeys_InsertAt(DictKeys* dk, size_t slot, DictKeyType key, hash_t hash, DictValueType value) {
+    assert(dk->dk_usable > 0);
+    DictKeyEntry* ep;
+    if (dk->dk_kind == DICT_KIND_SWISS) {
+        _DictKeys_SwissSetCtrl(dk, slot, hash);
+        ep = &DK_ENTRIES(dk)[slot];
+    } else {
+        _DictKeys_SetIndex(dk, slot, dk->dk_nentries);
         ep = &DK_ENTRIES(dk)[dk->dk_nentries];
+        DKE_SET_LIVE(dk, dk->dk_nentries);
         dk->dk_usable--;
         dk->dk_nentries++;
-    } else {
-        // Update Key
-        ep = &DK_ENTRIES(dk)[ix];
     }
     ep->key = key;
-    ep->hash = hash;
+    DKE_SET_HASH(ep, hash);
     ep->value = value;
-    return (ix < 0);
+    return ep;
 }
 
-static DictKeys*
-_DictKeys_New(uint8_t log2_size) {
-    DictKeys* dk;
-    uint8_t index_bytes;
-    if (log2_size < 8) {
-        index_bytes = 1;
+/* Delete entry ix, found in slot by _DictKeys_LookupSlot. */
+static void
+_DictKeys_DelAt(DictKeys* dk, size_t slot, ix_t ix) {
+    if (dk->dk_kind == DICT_KIND_SWISS) {
+        // entries are slot-aligned, ix is the slot itself
+        _DictKeys_SwissDelete(dk, ix);
+    } else {
+        _DictKeys_SetIndex(dk, slot, DKIX_DUMMY);
+        DKE_SET_DELETED(dk, ix);
+    }
+}
+
+// width of the indices of a table of 1 << log2_size slots
+static uint8_t
+_DictKeys_IndexBytes(uint8_t log2_size, uint8_t kind) {
+    if (kind == DICT_KIND_SWISS) {
+        // one control byte per slot
+        return 1;
+    } else if (log2_size < 8) {
+        return 1;
     } else if (log2_size < 16) {
-        index_bytes = 2;
+        return 2;
     } else if (log2_size >= 32) {
-        index_bytes = 8;
-    } else {
-        // 16 <= log2_size < 32
-        index_bytes = 4;
+        return 8;
+    }
+    // 16 <= log2_size < 32
+    return 4;
+}
+
+static DictKeys*
+_DictKeys_New(uint8_t log2_size, uint8_t kind, hash_t seed, const Allocator* alloc) {
+    DictKeys* dk;
+    if (kind == DICT_KIND_SWISS && log2_size < SWISS_LOG_MINSIZE) {
+        log2_size = SWISS_LOG_MINSIZE;
     }
+    uint8_t index_bytes = _DictKeys_IndexBytes(log2_size, kind);
     size_t dk_size = (size_t)1 << log2_size;
     size_t entry_bytes = sizeof(DictKeyEntry);
+    // keep in sync with _DictKeys_Bytes
     size_t usable = USABLE_FRACTION(dk_size);
+    size_t nslots = usable;
+    if (kind == DICT_KIND_SWISS) {
+        usable = SWISS_USABLE_FRACTION(dk_size);
+        nslots = dk_size;
+    }
+    size_t live_bytes = (kind == DICT_KIND_SWISS) ? 0 : DK_LIVE_BYTES(nslots);
     size_t total_bytes = sizeof(DictKeys)
                          + dk_size * index_bytes
-                         + usable * entry_bytes;
-    dk = (DictKeys*)malloc(total_bytes);
+                         + nslots * entry_bytes
+                         + live_bytes;
+    bool zeroed;
+    dk = (DictKeys*)allocBytes(alloc, total_bytes, &zeroed);
     assert(dk != NULL);
     dk->dk_log2_size = log2_size;
     dk->dk_index_bytes = index_bytes;
+    dk->dk_kind = kind;
+    dk->dk_mapped = 0;
+    dk->dk_alloc = alloc;
+    dk->dk_refcnt = 1;
     dk->dk_usable = usable;
     dk->dk_nentries = 0;
     dk->keyCmpFunc = _DictKeys_DefaultKeyCmpFunc;
     dk->keyHashFunc = _DictKeys_DefaultKeyHashFunc;
+    dk->dk_seed = seed;
+    dk->dk_ops = _DictKeys_SelectOps(dk);
+#ifdef DICT_STATS
+    // linked by the caller
+    dk->dk_stats = NULL;
+#endif
+    if (kind == DICT_KIND_SWISS) {
+        // the control bytes tell which slots are full,
+        // entries don't need to be cleared
+        memset(&dk->dk_indices[0], (uint8_t)SWISS_CTRL_EMPTY, dk_size);
+        return dk;
+    }
     memset(&dk->dk_indices[0], 0xff, dk_size * index_bytes);
-    memset(DK_ENTRIES(dk), 0, usable * entry_bytes);
+    if (!zeroed) {
+        memset(DK_ENTRIES(dk), 0, usable * entry_bytes + live_bytes);
+    }
     return dk;
 }
 
-static ix_t
+static inline ix_t
 _DictKeys_Lookup(DictKeys* dk, DictKeyType key, hash_t hash) {
-    ix_t ix;
+    return dk->dk_ops->lookup(dk, key, hash);
+}
+
+static inline ix_t
+_DictKeys_LookupSlot(DictKeys* dk, DictKeyType key, hash_t hash, size_t* slot) {
+    return dk->dk_ops->lookup_slot(dk, key, hash, slot);
+}
+
+/* Internal function to find slot for an item from its hash
+   when it is known that the key is not present in the dict. */
+static inline size_t
+_DictKeys_FindEmptySlot(DictKeys* dk, hash_t hash) {
+    return dk->dk_ops->find_empty_slot(dk, hash);
+}
+
+static inline void
+_DictKeys_BuildIndices(DictKeys* dk, DictKeyEntry* ep, size_t nentries) {
+    dk->dk_ops->build_indices(dk, ep, nentries);
+}
+
+#ifdef DICT_GENERIC_PROBES
+// The generic routines read the indices through _DictKeys_GetIndex,
+// which branches on dk_index_bytes at every probe, and compare keys
+// through keyCmpFunc.
+static ix_t
+_DictKeys_LookupGeneric(DictKeys* dk, DictKeyType key, hash_t hash) {
     DictKeyEntry* ep0 = DK_ENTRIES(dk);
     size_t perturb = (size_t)hash;
     size_t size = DK_SIZE(dk);
     // size_t i = hash % size;
     size_t mask = DK_MASK(dk);
     size_t i = (size_t)hash & mask;
+    DICT_STAT_PROBE_BEGIN;
     for (; ; ) {
         ix_t ix = _DictKeys_GetIndex(dk, i);
         if (ix >= 0) {
             DictKeyEntry* ep = &ep0[ix];
             if (dk->keyCmpFunc(ep->key, key) == 1) {
+                DICT_STAT_PROBE_END(dk);
                 return ix;
             }
-        } else {
+        } else if (ix == DKIX_EMPTY) {
+            DICT_STAT_PROBE_END(dk);
             return ix;
         }
+        // a DKIX_DUMMY slot doesn't end the probe sequence
+        DICT_STAT_PROBE_NEXT;
         perturb >>= PERTURB_SHIFT;
         i = (i * 5 + perturb + 1) % size;
     }
 }
 
-/* Internal function to find slot for an item from its hash
-   when it is known that the key is not present in the dict. */
+// the first DKIX_DUMMY slot is reused for an insert
+static ix_t
+_DictKeys_LookupSlotGeneric(DictKeys* dk, DictKeyType key, hash_t hash, size_t* slot) {
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);
+    size_t perturb = (size_t)hash;
+    size_t mask = DK_MASK(dk);
+    size_t i = (size_t)hash & mask;
+    size_t free_slot = SIZE_MAX;
+    DICT_STAT_PROBE_BEGIN;
+    for (; ; ) {
+        ix_t ix = _DictKeys_GetIndex(dk, i);
+        if (ix >= 0) {
+            if (dk->keyCmpFunc(ep0[ix].key, key) == 1) {
+                *slot = i;
+                DICT_STAT_PROBE_END(dk);
+                return ix;
+            }
+        } else if (ix == DKIX_EMPTY) {
+            *slot = (free_slot != SIZE_MAX) ? free_slot : i;
+            DICT_STAT_PROBE_END(dk);
+            return ix;
+        } else if (free_slot == SIZE_MAX) {
+            free_slot = i;
+        }
+        DICT_STAT_PROBE_NEXT;
+        perturb >>= PERTURB_SHIFT;
+        i = (i * 5 + perturb + 1) & mask;
+    }
+}
+
 static size_t
-_DictKeys_FindEmptySlot(DictKeys* dk, hash_t hash) {
+_DictKeys_FindEmptySlotGeneric(DictKeys* dk, hash_t hash) {
     assert(dk != NULL);
     const size_t mask = DK_MASK(dk);
     size_t i = hash & mask;
@@ -307,21 +2733,252 @@ _DictKeys_FindEmptySlot(DictKeys* dk, hash_t hash) {
     return i;
 }
 
-static size_t
-_DictKeys_GetHashPosition(DictKeys* dk, hash_t hash, ix_t index) {
-    size_t mask = DK_MASK(dk);
-    size_t perturb = (size_t)hash;
-    size_t i = (size_t)hash & mask;
-    for (; _DictKeys_GetIndex(dk, i) != index;) {
-        perturb >>= PERTURB_SHIFT;
-        i = mask & (i * 5 + perturb + 1);
+static void
+_DictKeys_BuildIndicesGeneric(DictKeys* dk, DictKeyEntry* ep, size_t nentries) {
+    for (size_t ix = 0; ix < nentries; ix++, ep++) {
+        size_t i = _DictKeys_FindEmptySlotGeneric(dk, DKE_HASH(dk, ep));
+        _DictKeys_SetIndex(dk, i, ix);
     }
-    return i;
 }
 
+static const struct _DictKeysOps _DictKeys_OpsGeneric = {
+    _DictKeys_LookupGeneric, _DictKeys_FindEmptySlotGeneric, _DictKeys_BuildIndicesGeneric,
+    _DictKeys_LookupSlotGeneric,
+};
+#endif  // DICT_GENERIC_PROBES
+
+// >> specialized probes
+// One set of routines per index width, the lookup also comes in a
+// variant comparing with == for the default key functions.
+
+#define DICT_KEY_EQ_GENERIC(dk, key1, key2) ((dk)->keyCmpFunc((key1), (key2)) == 1)
+#define DICT_KEY_EQ_DEFAULT(dk, key1, key2) ((key1) == (key2))
+
+#define DICT_DEFINE_LOOKUP(name, index_t, KEY_EQ)                           \
+static ix_t                                                                 \
+_DictKeys_Lookup_##name(DictKeys* dk, DictKeyType key, hash_t hash) {       \
+    const index_t* indices = (const index_t*)dk->dk_indices;                \
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);                                     \
+    size_t mask = DK_MASK(dk);                                              \
+    size_t perturb = (size_t)hash;                                          \
+    size_t i = (size_t)hash & mask;                                         \
+    DICT_STAT_PROBE_BEGIN;                                                  \
+    for (; ; ) {                                                            \
+        ix_t ix = (ix_t)indices[i];                                         \
+        if (ix >= 0) {                                                      \
+            if (KEY_EQ(dk, ep0[ix].key, key)) {                             \
+                DICT_STAT_PROBE_END(dk);                                    \
+                return ix;                                                  \
+            }                                                               \
+        } else if (ix == DKIX_EMPTY) {                                      \
+            DICT_STAT_PROBE_END(dk);                                        \
+            return ix;                                                      \
+        }                                                                   \
+        DICT_STAT_PROBE_NEXT;                                               \
+        perturb >>= PERTURB_SHIFT;                                          \
+        i = (i * 5 + perturb + 1) & mask;                                   \
+    }                                                                       \
+}
+
+// the first DKIX_DUMMY slot is reused for an insert
+#define DICT_DEFINE_LOOKUP_SLOT(name, index_t, KEY_EQ)                      \
+static ix_t                                                                 \
+_DictKeys_LookupSlot_##name(DictKeys* dk, DictKeyType key, hash_t hash, size_t* slot) { \
+    const index_t* indices = (const index_t*)dk->dk_indices;                \
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);                                     \
+    size_t mask = DK_MASK(dk);                                              \
+    size_t perturb = (size_t)hash;                                          \
+    size_t i = (size_t)hash & mask;                                         \
+    size_t free_slot = SIZE_MAX;                                            \
+    DICT_STAT_PROBE_BEGIN;                                                  \
+    for (; ; ) {                                                            \
+        ix_t ix = (ix_t)indices[i];                                         \
+        if (ix >= 0) {                                                      \
+            if (KEY_EQ(dk, ep0[ix].key, key)) {                             \
+                *slot = i;                                                  \
+                DICT_STAT_PROBE_END(dk);                                    \
+                return ix;                                                  \
+            }                                                               \
+        } else if (ix == DKIX_EMPTY) {                                      \
+            *slot = (free_slot != SIZE_MAX) ? free_slot : i;                \
+            DICT_STAT_PROBE_END(dk);                                        \
+            return ix;                                                      \
+        } else if (free_slot == SIZE_MAX) {                                 \
+            free_slot = i;                                                  \
+        }                                                                   \
+        DICT_STAT_PROBE_NEXT;                                               \
+        perturb >>= PERTURB_SHIFT;                                          \
+        i = (i * 5 + perturb + 1) & mask;                                   \
+    }                                                                       \
+}
+
+#define DICT_DEFINE_INDEX_PROBES(name, index_t)                             \
+static size_t                                                               \
+_DictKeys_FindEmptySlot_##name(DictKeys* dk, hash_t hash) {                 \
+    const index_t* indices = (const index_t*)dk->dk_indices;                \
+    const size_t mask = DK_MASK(dk);                                        \
+    size_t i = hash & mask;                                                 \
+    for (size_t perturb = hash; indices[i] >= 0;) {                         \
+        perturb >>= PERTURB_SHIFT;                                          \
+        i = (i * 5 + perturb + 1) & mask;                                   \
+    }                                                                       \
+    return i;                                                               \
+}                                                                           \
+static void                                                                 \
+_DictKeys_BuildIndices_##name(DictKeys* dk, DictKeyEntry* ep, size_t nentries) { \
+    index_t* indices = (index_t*)dk->dk_indices;                            \
+    for (size_t ix = 0; ix < nentries; ix++, ep++) {                        \
+        size_t i = _DictKeys_FindEmptySlot_##name(dk, DKE_HASH(dk, ep));    \
+        indices[i] = (index_t)ix;                                           \
+    }                                                                       \
+}
+
+#ifndef DICT_GENERIC_PROBES
+DICT_DEFINE_INDEX_PROBES(8, int8_t)
+DICT_DEFINE_INDEX_PROBES(16, int16_t)
+DICT_DEFINE_INDEX_PROBES(32, int32_t)
+DICT_DEFINE_INDEX_PROBES(64, int64_t)
+DICT_DEFINE_LOOKUP(8, int8_t, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_LOOKUP(16, int16_t, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_LOOKUP(32, int32_t, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_LOOKUP(64, int64_t, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_LOOKUP(8_default, int8_t, DICT_KEY_EQ_DEFAULT)
+DICT_DEFINE_LOOKUP(16_default, int16_t, DICT_KEY_EQ_DEFAULT)
+DICT_DEFINE_LOOKUP(32_default, int32_t, DICT_KEY_EQ_DEFAULT)
+DICT_DEFINE_LOOKUP(64_default, int64_t, DICT_KEY_EQ_DEFAULT)
+DICT_DEFINE_LOOKUP_SLOT(8, int8_t, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_LOOKUP_SLOT(16, int16_t, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_LOOKUP_SLOT(32, int32_t, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_LOOKUP_SLOT(64, int64_t, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_LOOKUP_SLOT(8_default, int8_t, DICT_KEY_EQ_DEFAULT)
+DICT_DEFINE_LOOKUP_SLOT(16_default, int16_t, DICT_KEY_EQ_DEFAULT)
+DICT_DEFINE_LOOKUP_SLOT(32_default, int32_t, DICT_KEY_EQ_DEFAULT)
+DICT_DEFINE_LOOKUP_SLOT(64_default, int64_t, DICT_KEY_EQ_DEFAULT)
+
+// indexed by log2(dk_index_bytes)
+static const struct _DictKeysOps _DictKeys_Ops[4] = {
+    {_DictKeys_Lookup_8, _DictKeys_FindEmptySlot_8, _DictKeys_BuildIndices_8,
+     _DictKeys_LookupSlot_8},
+    {_DictKeys_Lookup_16, _DictKeys_FindEmptySlot_16, _DictKeys_BuildIndices_16,
+     _DictKeys_LookupSlot_16},
+    {_DictKeys_Lookup_32, _DictKeys_FindEmptySlot_32, _DictKeys_BuildIndices_32,
+     _DictKeys_LookupSlot_32},
+    {_DictKeys_Lookup_64, _DictKeys_FindEmptySlot_64, _DictKeys_BuildIndices_64,
+     _DictKeys_LookupSlot_64},
+};
+static const struct _DictKeysOps _DictKeys_OpsDefault[4] = {
+    {_DictKeys_Lookup_8_default, _DictKeys_FindEmptySlot_8, _DictKeys_BuildIndices_8,
+     _DictKeys_LookupSlot_8_default},
+    {_DictKeys_Lookup_16_default, _DictKeys_FindEmptySlot_16, _DictKeys_BuildIndices_16,
+     _DictKeys_LookupSlot_16_default},
+    {_DictKeys_Lookup_32_default, _DictKeys_FindEmptySlot_32, _DictKeys_BuildIndices_32,
+     _DictKeys_LookupSlot_32_default},
+    {_DictKeys_Lookup_64_default, _DictKeys_FindEmptySlot_64, _DictKeys_BuildIndices_64,
+     _DictKeys_LookupSlot_64_default},
+};
+#endif  // DICT_GENERIC_PROBES
+// the swiss engine inserts through _DictKeys_SwissFindInsertSlot
+static const struct _DictKeysOps _DictKeys_OpsSwiss = {
+    _DictKeys_SwissLookup, NULL, NULL, _DictKeys_SwissLookupSlot,
+};
+static const struct _DictKeysOps _DictKeys_OpsSwissDefault = {
+    _DictKeys_SwissLookup_default, NULL, NULL, _DictKeys_SwissLookupSlot_default,
+};
+// read only
+static const struct _DictKeysOps _DictKeys_OpsFrozen = {
+    _DictKeys_FrozenLookup, NULL, NULL, NULL,
+};
+static const struct _DictKeysOps _DictKeys_OpsFrozenDefault = {
+    _DictKeys_FrozenLookup_default, NULL, NULL, NULL,
+};
+
+static const struct _DictKeysOps*
+_DictKeys_SelectOps(DictKeys* dk) {
+    bool is_default = (dk->keyCmpFunc == _DictKeys_DefaultKeyCmpFunc);
+    if (dk->dk_kind == DICT_KIND_SWISS) {
+        return is_default ? &_DictKeys_OpsSwissDefault : &_DictKeys_OpsSwiss;
+    }
+    if (dk->dk_kind == DICT_KIND_FROZEN) {
+        return is_default ? &_DictKeys_OpsFrozenDefault : &_DictKeys_OpsFrozen;
+    }
+#ifdef DICT_GENERIC_PROBES
+    return &_DictKeys_OpsGeneric;
+#else
+    size_t width = __builtin_ctz(dk->dk_index_bytes);
+    return is_default ? &_DictKeys_OpsDefault[width] : &_DictKeys_Ops[width];
+#endif
+}
+// << specialized probes
+
+// drops a reference, see dictNewSharedKeys
 static void
 _DictKeys_Free(DictKeys* dk) {
-    free(dk);
+    if (dk->dk_mapped) {
+        // released with the mapping by dictFree
+        return;
+    }
+    if (__atomic_sub_fetch(&dk->dk_refcnt, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    allocFree(dk->dk_alloc, dk, _DictKeys_Bytes(dk));
+}
+
+static void
+_DictKeys_FreeRetired(void* dk) {
+    _DictKeys_Free((DictKeys*)dk);
+}
+
+// size of the whole keys object allocated by _DictKeys_New
+static size_t
+_DictKeys_Bytes(DictKeys* dk) {
+    if (dk->dk_kind == DICT_KIND_FROZEN) {
+        DictFrozen* fz = DK_FROZEN(dk);
+        return _DictKeys_FrozenBytes(dk->dk_nentries, fz->nbuckets, fz->nbig, fz->nslots);
+    }
+    size_t nslots = USABLE_FRACTION(DK_SIZE(dk));
+    size_t live_bytes = DK_LIVE_BYTES(nslots);
+    if (dk->dk_kind == DICT_KIND_SWISS) {
+        nslots = DK_SIZE(dk);
+        live_bytes = 0;
+    }
+    return sizeof(DictKeys)
+           + DK_SIZE(dk) * dk->dk_index_bytes
+           + nslots * sizeof(DictKeyEntry)
+           + live_bytes;
+}
+
+static DictKeys*
+_DictKeys_Copy(DictKeys* dk, const Allocator* alloc) {
+    size_t nbytes = _DictKeys_Bytes(dk);
+    bool zeroed;
+    DictKeys* copy = (DictKeys*)allocBytes(alloc, nbytes, &zeroed);
+    assert(copy != NULL);
+    memcpy(copy, dk, nbytes);
+    copy->dk_mapped = 0;
+    copy->dk_alloc = alloc;
+    copy->dk_refcnt = 1;
+    return copy;
+}
+
+// Drop the deleted entries without reallocating: the live entries
+// slide down, keeping their order, and the indices are rebuilt.
+static void
+_DictKeys_Compact(DictKeys* dk) {
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);
+    size_t nentries = 0;
+    for (size_t i = 0; i < dk->dk_nentries; i++) {
+        if (!DKE_IS_DELETED(dk, i)) {
+            if (i != nentries) {
+                ep0[nentries] = ep0[i];
+            }
+            nentries++;
+        }
+    }
+    DKE_SET_LIVE_RANGE(dk, nentries);
+    dk->dk_usable += dk->dk_nentries - nentries;
+    dk->dk_nentries = nentries;
+    memset(&dk->dk_indices[0], 0xff, DK_SIZE(dk) * dk->dk_index_bytes);
+    _DictKeys_BuildIndices(dk, ep0, nentries);
 }
 
 static inline ix_t
@@ -365,6 +3022,614 @@ _DictKeys_SetIndex(DictKeys* dk, size_t i, ix_t ix) {
     }
 }
 
+// >> parallel build
+// Index writes of several threads, see dictNewFromArrays.
+
+static inline ix_t
+_DictKeys_LoadIndex(const DictKeys* dk, size_t i) {
+    ix_t ix;
+    uint8_t index_bytes = dk->dk_index_bytes;
+    if (index_bytes == 1) {
+        ix = __atomic_load_n(&((int8_t*)dk->dk_indices)[i], __ATOMIC_RELAXED);
+    } else if (index_bytes == 2) {
+        ix = __atomic_load_n(&((int16_t*)dk->dk_indices)[i], __ATOMIC_RELAXED);
+    } else if (index_bytes == 8) {
+        ix = __atomic_load_n(&((int64_t*)dk->dk_indices)[i], __ATOMIC_RELAXED);
+    } else {
+        ix = __atomic_load_n(&((int32_t*)dk->dk_indices)[i], __ATOMIC_RELAXED);
+    }
+    return ix;
+}
+
+// sets index i to ix if it is still *expected, else loads it into *expected
+static inline bool
+_DictKeys_CasIndex(DictKeys* dk, size_t i, ix_t* expected, ix_t ix) {
+    bool ok;
+    uint8_t index_bytes = dk->dk_index_bytes;
+    if (index_bytes == 1) {
+        int8_t old = (int8_t)*expected;
+        ok = __atomic_compare_exchange_n(&((int8_t*)dk->dk_indices)[i], &old, (int8_t)ix,
+                                         false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        *expected = old;
+    } else if (index_bytes == 2) {
+        int16_t old = (int16_t)*expected;
+        ok = __atomic_compare_exchange_n(&((int16_t*)dk->dk_indices)[i], &old, (int16_t)ix,
+                                         false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        *expected = old;
+    } else if (index_bytes == 8) {
+        int64_t old = *expected;
+        ok = __atomic_compare_exchange_n(&((int64_t*)dk->dk_indices)[i], &old, (int64_t)ix,
+                                         false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        *expected = (ix_t)old;
+    } else {
+        int32_t old = *expected;
+        ok = __atomic_compare_exchange_n(&((int32_t*)dk->dk_indices)[i], &old, (int32_t)ix,
+                                         false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        *expected = old;
+    }
+    return ok;
+}
+
+// Put entry ix in the first empty slot of its probe sequence. With dups,
+// an entry with the same key may be in the way: the smaller position
+// keeps the slot, the other one is returned. DKIX_EMPTY otherwise.
+static ix_t
+_DictKeys_CasInsert(DictKeys* dk, ix_t ix, hash_t hash, bool dups) {
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);
+    size_t mask = DK_MASK(dk);
+    size_t perturb = (size_t)hash;
+    size_t i = (size_t)hash & mask;
+    for (; ; ) {
+        ix_t cur = _DictKeys_LoadIndex(dk, i);
+        if (cur == DKIX_EMPTY) {
+            if (_DictKeys_CasIndex(dk, i, &cur, ix)) {
+                return DKIX_EMPTY;
+            }
+            // taken meanwhile, look at the new index of slot i
+            continue;
+        }
+        if (dups && ep0[cur].key == ep0[ix].key) {
+            if (ix > cur) {
+                return ix;
+            }
+            if (_DictKeys_CasIndex(dk, i, &cur, ix)) {
+                return cur;
+            }
+            continue;
+        }
+        perturb >>= PERTURB_SHIFT;
+        i = (i * 5 + perturb + 1) & mask;
+    }
+}
+
+// the share of one thread
+typedef struct {
+    DictKeys* dk;
+    const DictKeyType* keys;
+    const DictValueType* values;
+    size_t begin;
+    size_t end;
+    // the first pass writes the entries, the second one the indices
+    bool fill;
+    bool dups;
+    ix_t* found;
+    size_t nfound;
+    size_t capacity;
+} _DictBuildTask;
+
+static void*
+_DictKeys_BuildWorker(void* arg) {
+    _DictBuildTask* task = (_DictBuildTask*)arg;
+    DictKeys* dk = task->dk;
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);
+    if (task->fill) {
+        for (size_t ix = task->begin; ix < task->end; ix++) {
+            DictKeyEntry* ep = &ep0[ix];
+            ep->key = task->keys[ix];
+            ep->value = task->values[ix];
+            DKE_SET_HASH(ep, _DictKeys_Hash(dk, ep->key));
+        }
+        return NULL;
+    }
+    for (size_t ix = task->begin; ix < task->end; ix++) {
+        ix_t dup = _DictKeys_CasInsert(dk, (ix_t)ix, DKE_HASH(dk, &ep0[ix]), task->dups);
+        if (dup >= 0) {
+            if (task->nfound == task->capacity) {
+                task->capacity = task->capacity * 2 + 16;
+                task->found = (ix_t*)realloc(task->found, task->capacity * sizeof(ix_t));
+                assert(task->found != NULL);
+            }
+            task->found[task->nfound++] = dup;
+        }
+    }
+    return NULL;
+}
+
+static int
+_dictCompareIx(const void* a, const void* b) {
+    ix_t x = *(const ix_t*)a;
+    ix_t y = *(const ix_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Insert entries [0, n) of dk into its empty indices with nthreads
+// threads, after filling them from keys and values unless keys is NULL.
+// dk_usable and dk_nentries are left to the caller. With dups, keys may
+// repeat: returns the number of entries whose key is in an earlier one,
+// *dups gets their positions in increasing order (to be freed).
+static size_t
+_DictKeys_BuildParallel(DictKeys* dk, const DictKeyType* keys, const DictValueType* values,
+                        size_t n, size_t nthreads, ix_t** dups) {
+    assert(dk->dk_kind == DICT_KIND_COMBINED);
+    _DictBuildTask* tasks = (_DictBuildTask*)calloc(nthreads, sizeof(_DictBuildTask));
+    pthread_t* threads = (pthread_t*)malloc(nthreads * sizeof(pthread_t));
+    bool* started = (bool*)calloc(nthreads, sizeof(bool));
+    assert(tasks != NULL && threads != NULL && started != NULL);
+    for (size_t t = 0; t < nthreads; t++) {
+        tasks[t].dk = dk;
+        tasks[t].keys = keys;
+        tasks[t].values = values;
+        tasks[t].begin = n * t / nthreads;
+        tasks[t].end = n * (t + 1) / nthreads;
+        tasks[t].dups = (dups != NULL);
+    }
+    // the entries must all be written before the indices point to them
+    for (int pass = (keys != NULL) ? 0 : 1; pass < 2; pass++) {
+        for (size_t t = 0; t < nthreads; t++) {
+            tasks[t].fill = (pass == 0);
+        }
+        for (size_t t = 1; t < nthreads; t++) {
+            started[t] = (pthread_create(&threads[t], NULL, _DictKeys_BuildWorker, &tasks[t]) == 0);
+            if (!started[t]) {
+                _DictKeys_BuildWorker(&tasks[t]);
+            }
+        }
+        _DictKeys_BuildWorker(&tasks[0]);
+        for (size_t t = 1; t < nthreads; t++) {
+            if (started[t]) {
+                pthread_join(threads[t], NULL);
+            }
+        }
+    }
+
+    size_t ndups = 0;
+    for (size_t t = 0; t < nthreads; t++) {
+        ndups += tasks[t].nfound;
+    }
+    if (dups != NULL) {
+        *dups = (ix_t*)malloc((ndups + 1) * sizeof(ix_t));
+        assert(*dups != NULL);
+        size_t k = 0;
+        for (size_t t = 0; t < nthreads; t++) {
+            memcpy(&(*dups)[k], tasks[t].found, tasks[t].nfound * sizeof(ix_t));
+            k += tasks[t].nfound;
+        }
+        qsort(*dups, ndups, sizeof(ix_t), _dictCompareIx);
+    }
+    for (size_t t = 0; t < nthreads; t++) {
+        free(tasks[t].found);
+    }
+    free(tasks);
+    free(threads);
+    free(started);
+    return ndups;
+}
+// << parallel build
+
+// >> swiss engine
+// References:
+// https://abseil.io/about/design/swisstables
+
+// bit i of the result is set if ctrl byte i of the group equals `tag`
+static inline uint32_t
+_swissGroupMatch(const int8_t* group, int8_t tag) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+// bit i of the result is set if slot i of the group is empty or deleted
+static inline uint32_t
+_swissGroupMatchFree(const int8_t* group) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(ctrl);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+#define DICT_DEFINE_SWISS_LOOKUP(name, KEY_EQ)                              \
+static ix_t                                                                 \
+name(DictKeys* dk, DictKeyType key, hash_t hash) {                          \
+    const int8_t* ctrl = (const int8_t*)dk->dk_indices;                     \
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);                                     \
+    hash_t h = SWISS_MIX(hash);                                             \
+    int8_t tag = SWISS_H2(dk, h);                                           \
+    size_t gmask = DK_MASK(dk) >> SWISS_GROUP_SHIFT;                        \
+    size_t g = SWISS_H1(dk, h) >> SWISS_GROUP_SHIFT;                        \
+    /* triangular probing visits every group once */                        \
+    DICT_STAT_PROBE_BEGIN;                                                  \
+    for (size_t step = 1; ; step++) {                                       \
+        const int8_t* group = &ctrl[g << SWISS_GROUP_SHIFT];                \
+        for (uint32_t m = _swissGroupMatch(group, tag); m != 0; m &= m - 1) { \
+            ix_t ix = (ix_t)((g << SWISS_GROUP_SHIFT) + __builtin_ctz(m));  \
+            if (KEY_EQ(dk, ep0[ix].key, key)) {                             \
+                DICT_STAT_PROBE_END(dk);                                    \
+                return ix;                                                  \
+            }                                                               \
+        }                                                                   \
+        if (_swissGroupMatch(group, SWISS_CTRL_EMPTY) != 0) {               \
+            DICT_STAT_PROBE_END(dk);                                        \
+            return DKIX_EMPTY;                                              \
+        }                                                                   \
+        DICT_STAT_PROBE_NEXT;                                               \
+        g = (g + step) & gmask;                                             \
+    }                                                                       \
+}
+
+DICT_DEFINE_SWISS_LOOKUP(_DictKeys_SwissLookup, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_SWISS_LOOKUP(_DictKeys_SwissLookup_default, DICT_KEY_EQ_DEFAULT)
+
+/* the slot for an insert is the first free one, as with
+   _DictKeys_SwissFindInsertSlot */
+#define DICT_DEFINE_SWISS_LOOKUP_SLOT(name, KEY_EQ)                         \
+static ix_t                                                                 \
+name(DictKeys* dk, DictKeyType key, hash_t hash, size_t* slot) {            \
+    const int8_t* ctrl = (const int8_t*)dk->dk_indices;                     \
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);                                     \
+    hash_t h = SWISS_MIX(hash);                                             \
+    int8_t tag = SWISS_H2(dk, h);                                           \
+    size_t gmask = DK_MASK(dk) >> SWISS_GROUP_SHIFT;                        \
+    size_t g = SWISS_H1(dk, h) >> SWISS_GROUP_SHIFT;                        \
+    size_t free_slot = SIZE_MAX;                                            \
+    DICT_STAT_PROBE_BEGIN;                                                  \
+    for (size_t step = 1; ; step++) {                                       \
+        const int8_t* group = &ctrl[g << SWISS_GROUP_SHIFT];                \
+        for (uint32_t m = _swissGroupMatch(group, tag); m != 0; m &= m - 1) { \
+            ix_t ix = (ix_t)((g << SWISS_GROUP_SHIFT) + __builtin_ctz(m));  \
+            if (KEY_EQ(dk, ep0[ix].key, key)) {                             \
+                *slot = (size_t)ix;                                         \
+                DICT_STAT_PROBE_END(dk);                                    \
+                return ix;                                                  \
+            }                                                               \
+        }                                                                   \
+        if (free_slot == SIZE_MAX) {                                        \
+            uint32_t m = _swissGroupMatchFree(group);                       \
+            if (m != 0) {                                                   \
+                free_slot = (g << SWISS_GROUP_SHIFT) + __builtin_ctz(m);    \
+            }                                                               \
+        }                                                                   \
+        if (_swissGroupMatch(group, SWISS_CTRL_EMPTY) != 0) {               \
+            *slot = free_slot;                                              \
+            DICT_STAT_PROBE_END(dk);                                        \
+            return DKIX_EMPTY;                                              \
+        }                                                                   \
+        DICT_STAT_PROBE_NEXT;                                               \
+        g = (g + step) & gmask;                                             \
+    }                                                                       \
+}
+
+DICT_DEFINE_SWISS_LOOKUP_SLOT(_DictKeys_SwissLookupSlot, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_SWISS_LOOKUP_SLOT(_DictKeys_SwissLookupSlot_default, DICT_KEY_EQ_DEFAULT)
+
+/* Find the first empty or deleted slot along the probe sequence,
+   when it is known that the key is not present in the dict. */
+static size_t
+_DictKeys_SwissFindInsertSlot(DictKeys* dk, hash_t hash) {
+    const int8_t* ctrl = (const int8_t*)dk->dk_indices;
+    hash_t h = SWISS_MIX(hash);
+    size_t gmask = DK_MASK(dk) >> SWISS_GROUP_SHIFT;
+    size_t g = SWISS_H1(dk, h) >> SWISS_GROUP_SHIFT;
+    for (size_t step = 1; ; step++) {
+        uint32_t m = _swissGroupMatchFree(&ctrl[g << SWISS_GROUP_SHIFT]);
+        if (m != 0) {
+            return (g << SWISS_GROUP_SHIFT) + __builtin_ctz(m);
+        }
+        g = (g + step) & gmask;
+    }
+}
+
+// mark slot i full, the caller fills DK_ENTRIES(dk)[i]
+static void
+_DictKeys_SwissSetCtrl(DictKeys* dk, size_t i, hash_t hash) {
+    int8_t* ctrl = (int8_t*)dk->dk_indices;
+    if (ctrl[i] == SWISS_CTRL_EMPTY) {
+        dk->dk_usable--;
+        dk->dk_nentries++;
+    }
+    ctrl[i] = SWISS_H2(dk, SWISS_MIX(hash));
+}
+
+static void
+_DictKeys_SwissDelete(DictKeys* dk, size_t i) {
+    int8_t* ctrl = (int8_t*)dk->dk_indices;
+    const int8_t* group = &ctrl[i & ~(size_t)(SWISS_GROUP_WIDTH - 1)];
+    // A group that still has an empty slot has never been full,
+    // so no probe sequence has ever walked past it.
+    if (_swissGroupMatch(group, SWISS_CTRL_EMPTY) != 0) {
+        ctrl[i] = SWISS_CTRL_EMPTY;
+        dk->dk_usable++;
+        dk->dk_nentries--;
+    } else {
+        ctrl[i] = SWISS_CTRL_DELETED;
+    }
+}
+
+// The slots of the keys whose home group is g and that are not before
+// (hash, key), in the order of dictScan. The probe sequences starting at
+// g end at the first group with an empty slot, like a lookup. Fills up
+// to cap slots, returns how many there are.
+static size_t
+_DictKeys_SwissHomeSlots(DictKeys* dk, size_t g, hash_t hash, DictKeyType key, DictScanSlot* slots, size_t cap) {
+    const int8_t* ctrl = (const int8_t*)dk->dk_indices;
+    DictKeyEntry* ep0 = DK_ENTRIES(dk);
+    size_t gmask = DK_MASK(dk) >> SWISS_GROUP_SHIFT;
+    size_t home = g;
+    size_t m = 0;
+    for (size_t step = 1; step <= gmask + 1; step++) {
+        const int8_t* group = &ctrl[g << SWISS_GROUP_SHIFT];
+        uint32_t full = ~_swissGroupMatchFree(group) & ((1u << SWISS_GROUP_WIDTH) - 1);
+        for (; full != 0; full &= full - 1) {
+            size_t i = (g << SWISS_GROUP_SHIFT) + __builtin_ctz(full);
+            hash_t h = SWISS_MIX(DKE_HASH(dk, &ep0[i]));
+            if ((SWISS_H1(dk, h) >> SWISS_GROUP_SHIFT) != home) {
+                continue;
+            }
+            if (h < hash || (h == hash && ep0[i].key < key)) {
+                continue;
+            }
+            if (m < cap) {
+                slots[m].hash = h;
+                slots[m].key = ep0[i].key;
+                slots[m].slot = i;
+            }
+            m++;
+        }
+        if (_swissGroupMatch(group, SWISS_CTRL_EMPTY) != 0) {
+            break;
+        }
+        g = (g + step) & gmask;
+    }
+    return m;
+}
+
+// rebuild into a fresh table, which also drops the deleted slots
+static void
+_dictResizeSwiss(Dict* mp) {
+    // the cursors don't depend on the slots, see _dictScanSwiss
+    DictKeys* oldkeys = mp->keys;
+    const int8_t* old_ctrl = (const int8_t*)oldkeys->dk_indices;
+    DictKeyEntry* old_entries = DK_ENTRIES(oldkeys);
+
+    mp->keys = _DictKeys_New(_dictResizeLog2(mp), DICT_KIND_SWISS, oldkeys->dk_seed, _dictAlloc(mp));
+    DICT_STAT_LINK(mp->keys, oldkeys);
+    assert(mp->keys != NULL);
+    assert(mp->keys->dk_usable > mp->used);
+
+    DictKeyEntry* new_entries = DK_ENTRIES(mp->keys);
+    for (size_t i = 0; i < DK_SIZE(oldkeys); i++) {
+        if (old_ctrl[i] >= 0) {
+            hash_t hash = DKE_HASH(oldkeys, &old_entries[i]);
+            size_t j = _DictKeys_SwissFindInsertSlot(mp->keys, hash);
+            _DictKeys_SwissSetCtrl(mp->keys, j, hash);
+            memcpy(&new_entries[j], &old_entries[i], sizeof(DictKeyEntry));
+        }
+    }
+
+    _DictKeys_Free(oldkeys);
+}
+// << swiss engine
+
+// >> frozen engine
+// References:
+// https://arxiv.org/abs/2104.10402  (PTHash)
+
+// The keys are split into buckets by their hash, FROZEN_BUCKET_KEYS per
+// bucket on average. Going from the largest bucket to the smallest, each
+// one gets the first pilot that sends all its keys to free slots
+// (_frozenPosition); n/FROZEN_SLACK_RATIO extra slots keep the searches
+// of the last buckets short. A key that landed in one of the extra slots
+// is moved to a slot left free below n, through the remap array.
+// Small buckets make most pilots fit in a byte, the others (about 1.5%)
+// are looked up in the sorted big pilots.
+
+#define DICT_DEFINE_FROZEN_LOOKUP(name, KEY_EQ)                             \
+static ix_t                                                                 \
+name(DictKeys* dk, DictKeyType key, hash_t hash) {                          \
+    DICT_STAT_PROBE_BEGIN;                                                  \
+    DICT_STAT_PROBE_END(dk);                                                \
+    if (dk->dk_nentries == 0) {                                             \
+        return DKIX_EMPTY;                                                  \
+    }                                                                       \
+    size_t i = _DictKeys_FrozenSlot(dk, hash);                              \
+    return KEY_EQ(dk, DK_ENTRIES(dk)[i].key, key) ? (ix_t)i : DKIX_EMPTY;   \
+}
+
+DICT_DEFINE_FROZEN_LOOKUP(_DictKeys_FrozenLookup, DICT_KEY_EQ_GENERIC)
+DICT_DEFINE_FROZEN_LOOKUP(_DictKeys_FrozenLookup_default, DICT_KEY_EQ_DEFAULT)
+
+// keep in sync with DK_FROZEN, FROZEN_BIG and FROZEN_REMAP
+static size_t
+_DictKeys_FrozenBytes(size_t nentries, size_t nbuckets, size_t nbig, size_t nslots) {
+    size_t entry_bytes = (nentries * sizeof(DictKeyEntry) + 7) & ~(size_t)7;
+    size_t pilot_bytes = (nbuckets + 3) & ~(size_t)3;
+    size_t remap_bytes = (nslots > nentries) ? (nslots - nentries) * sizeof(uint32_t) : 0;
+    return sizeof(DictKeys) + entry_bytes + sizeof(DictFrozen) + pilot_bytes
+           + 2 * nbig * sizeof(uint32_t) + remap_bytes;
+}
+
+// Frozen keys of the n entries, whose keys are distinct and hash to
+// hashes[i]. NULL if the pilots run out FROZEN_ATTEMPTS times.
+static DictKeys*
+_DictKeys_NewFrozen(const DictKeyEntry* entries, const hash_t* hashes, size_t n, hash_t seed,
+                    const Allocator* alloc) {
+    assert(n <= INT32_MAX);
+    size_t nbuckets = n / FROZEN_BUCKET_KEYS + 1;
+    size_t nslots = n + n / FROZEN_SLACK_RATIO + 1;
+    uint64_t pilot_seed = 0;
+
+    // the keys of bucket b are bucket_keys[start[b], start[b + 1])
+    size_t* start = (size_t*)calloc(nbuckets + 1, sizeof(size_t));
+    size_t* fill = (size_t*)malloc(nbuckets * sizeof(size_t));
+    uint32_t* bucket_keys = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    assert(start != NULL && fill != NULL && bucket_keys != NULL);
+    for (size_t i = 0; i < n; i++) {
+        start[FROZEN_BUCKET(nbuckets, hashes[i]) + 1]++;
+    }
+    size_t max_size = 0;
+    for (size_t b = 0; b < nbuckets; b++) {
+        max_size = (start[b + 1] > max_size) ? start[b + 1] : max_size;
+        start[b + 1] += start[b];
+        fill[b] = start[b];
+    }
+    for (size_t i = 0; i < n; i++) {
+        bucket_keys[fill[FROZEN_BUCKET(nbuckets, hashes[i])]++] = (uint32_t)i;
+    }
+
+    // the buckets by decreasing size, sorted by counting
+    size_t* nsized = (size_t*)calloc(max_size + 2, sizeof(size_t));
+    uint32_t* order = (uint32_t*)malloc(nbuckets * sizeof(uint32_t));
+    assert(nsized != NULL && order != NULL);
+    for (size_t b = 0; b < nbuckets; b++) {
+        nsized[max_size - (start[b + 1] - start[b]) + 1]++;
+    }
+    for (size_t k = 0; k <= max_size; k++) {
+        nsized[k + 1] += nsized[k];
+    }
+    for (size_t b = 0; b < nbuckets; b++) {
+        order[nsized[max_size - (start[b + 1] - start[b])]++] = (uint32_t)b;
+    }
+
+    size_t nwords = (nslots + 63) >> 6;
+    uint64_t* taken = (uint64_t*)malloc(nwords * sizeof(uint64_t));
+    uint32_t* pilots = (uint32_t*)malloc(nbuckets * sizeof(uint32_t));
+    size_t* pos = (size_t*)malloc((max_size + 1) * sizeof(size_t));
+    assert(taken != NULL && pilots != NULL && pos != NULL);
+    bool ok = false;
+    for (size_t attempt = 0; attempt < FROZEN_ATTEMPTS && !ok; attempt++) {
+        pilot_seed = hashMix64(seed, attempt + 1);
+        memset(taken, 0, nwords * sizeof(uint64_t));
+        ok = true;
+        for (size_t k = 0; k < nbuckets && ok; k++) {
+            uint32_t b = order[k];
+            ok = _frozenPlaceBucket(pilot_seed, nslots, taken, hashes, &bucket_keys[start[b]],
+                                    start[b + 1] - start[b], pos, &pilots[b]);
+        }
+    }
+
+    DictKeys* dk = NULL;
+    if (ok) {
+        size_t nbig = 0;
+        for (size_t b = 0; b < nbuckets; b++) {
+            nbig += (pilots[b] >= FROZEN_PILOT_BIG);
+        }
+        // every byte is written below
+        bool zeroed;
+        dk = (DictKeys*)allocBytes(alloc, _DictKeys_FrozenBytes(n, nbuckets, nbig, nslots), &zeroed);
+        assert(dk != NULL);
+        dk->dk_log2_size = 0;
+        dk->dk_index_bytes = 0;
+        dk->dk_kind = DICT_KIND_FROZEN;
+        dk->dk_mapped = 0;
+        dk->dk_alloc = alloc;
+        dk->dk_refcnt = 1;
+        dk->dk_usable = 0;
+        dk->dk_nentries = n;
+        dk->keyCmpFunc = _DictKeys_DefaultKeyCmpFunc;
+        dk->keyHashFunc = _DictKeys_DefaultKeyHashFunc;
+        dk->dk_seed = seed;
+        dk->dk_ops = _DictKeys_SelectOps(dk);
+#ifdef DICT_STATS
+        // linked by the caller
+        dk->dk_stats = NULL;
+#endif
+        DictFrozen* fz = DK_FROZEN(dk);
+        fz->nbuckets = nbuckets;
+        fz->nslots = nslots;
+        fz->pilot_seed = pilot_seed;
+        fz->nbig = nbig;
+        uint32_t* big = FROZEN_BIG(fz);
+        size_t j = 0;
+        for (size_t b = 0; b < nbuckets; b++) {
+            if (pilots[b] >= FROZEN_PILOT_BIG) {
+                fz->pilots[b] = FROZEN_PILOT_BIG;
+                big[j] = (uint32_t)b;
+                big[nbig + j] = pilots[b];
+                j++;
+            } else {
+                fz->pilots[b] = (uint8_t)pilots[b];
+            }
+        }
+
+        uint32_t* remap = FROZEN_REMAP(fz);
+        size_t free_slot = 0;
+        for (size_t i = n; i < nslots; i++) {
+            remap[i - n] = 0;
+            if ((taken[i >> 6] >> (i & 63)) & 1) {
+                for (; (taken[free_slot >> 6] >> (free_slot & 63)) & 1; ) {
+                    free_slot++;
+                }
+                assert(free_slot < n);
+                remap[i - n] = (uint32_t)free_slot++;
+            }
+        }
+        DictKeyEntry* ep0 = DK_ENTRIES(dk);
+        for (size_t i = 0; i < n; i++) {
+            memcpy(&ep0[_DictKeys_FrozenSlot(dk, hashes[i])], &entries[i], sizeof(DictKeyEntry));
+        }
+    }
+    free(start);
+    free(fill);
+    free(bucket_keys);
+    free(nsized);
+    free(order);
+    free(taken);
+    free(pilots);
+    free(pos);
+    return dk;
+}
+
+// Find the first pilot sending the keys of a bucket to distinct free
+// slots, and take the slots. pos has room for the size of the bucket.
+static bool
+_frozenPlaceBucket(uint64_t pilot_seed, size_t nslots, uint64_t* taken, const hash_t* hashes,
+                   const uint32_t* keys, size_t size, size_t* pos, uint32_t* pilot) {
+    *pilot = 0;
+    for (uint32_t p = 0; p < FROZEN_MAX_PILOT; p++) {
+        size_t j = 0;
+        for (; j < size; j++) {
+            size_t i = _frozenPosition(pilot_seed, nslots, hashes[keys[j]], p);
+            if ((taken[i >> 6] >> (i & 63)) & 1) {
+                break;
+            }
+            // taken right away, two keys of the bucket may collide
+            taken[i >> 6] |= (uint64_t)1 << (i & 63);
+            pos[j] = i;
+        }
+        if (j == size) {
+            *pilot = p;
+            return true;
+        }
+        for (size_t u = 0; u < j; u++) {
+            taken[pos[u] >> 6] &= ~((uint64_t)1 << (pos[u] & 63));
+        }
+    }
+    return false;
+}
+// << frozen engine
+
 #ifdef DICT_TEST
 extern void
 dictTest1(void) {
@@ -433,4 +3698,948 @@ dictTest5(void) {
     printf("%d\n", d->keys->dk_index_bytes);
     printf("%d\n", d->keys->dk_usable);
 }
+
+extern void
+dictTest6(void) {
+    Dict *d = dictNewKind(DICT_KIND_SWISS);
+
+    for (int i = 0; i < 10000; i++) {
+        dictSet(d, i * 1024, i);
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        dictDel(d, i * 1024);
+    }
+    // refill over the deleted slots
+    for (int i = 10000; i < 15000; i++) {
+        dictSet(d, i * 1024, i);
+    }
+    assert(dictLen(d) == 10000);
+    assert(!dictHas(d, 0));
+    assert(dictHas(d, 1024));
+    assert(dictGet(d, 9999 * 1024) == 9999);
+    assert(dictGet(d, 14999 * 1024) == 14999);
+
+    size_t n = 0;
+    DictKeyType key;
+    DictValueType val;
+    DictIter iter = {d, 0};
+    while (dictIterNext(&iter, &key, &val)) {
+        assert(key == val * 1024);
+        n++;
+    }
+    assert(n == dictLen(d));
+    printf("len: %zu\n", dictLen(d));
+
+    dictFree(d);
+    d = NULL;
+}
+
+extern void
+dictTest7(void) {
+    Dict *d = dictNew();
+    dictSetIncrementalResize(d, true);
+
+    size_t nresizes = 0;
+    for (int i = 0; i < 100000; i++) {
+        DictKeys *dk = d->keys;
+        dictSet(d, i, i);
+        if (d->keys != dk) {
+            // the old keys are migrated by the following operations
+            assert(d->oldkeys == dk);
+            nresizes++;
+        }
+        if (i >= 1000 && i % 2 == 0) {
+            dictDel(d, i - 1000);
+        }
+        assert(dictHas(d, i));
+        if (i > 0) {
+            assert(dictGet(d, i / 2 | 1) == (i / 2 | 1));
+        }
+    }
+    printf("resizes: %zu, len: %zu\n", nresizes, dictLen(d));
+    assert(nresizes > 0);
+    assert(dictLen(d) == 50000 + 500);
+
+    dictSetIncrementalResize(d, false);
+    assert(d->oldkeys == NULL);
+    for (int i = 0; i < 100000; i++) {
+        assert(dictHas(d, i) == (i % 2 == 1 || i >= 99000));
+    }
+
+    dictFree(d);
+    d = NULL;
+}
+
+extern void
+dictTest8(void) {
+    Dict *d = dictNew();
+
+    // a sliding window of 1000 keys never needs more than 4096 slots
+    for (int i = 0; i < 1000000; i++) {
+        dictSet(d, i, i);
+        if (i >= 1000) {
+            dictDel(d, i - 1000);
+        }
+        // the first keys are stored inline
+        assert(d->keys == NULL || DK_SIZE(d->keys) <= 4096);
+    }
+    assert(dictLen(d) == 1000);
+    assert(dictGet(d, 999999) == 999999);
+#ifndef DICT_STATS
+    // nothing needed the rarely used state
+    assert(d->extra == NULL);
+#endif
+
+    size_t n = 0;
+    DictKeyType key;
+    DictValueType val;
+    DictIter iter = {d, 0};
+    while (dictIterNext(&iter, &key, &val)) {
+        assert(key == val && key >= 999000);
+        n++;
+    }
+    assert(n == 1000);
+
+    for (int i = 999000; i < 1000000; i++) {
+        dictDel(d, i);
+    }
+    printf("size: %zu\n", DK_SIZE(d->keys));
+    assert(DK_LOG_SIZE(d->keys) == DICT_LOG_MINSIZE);
+    dictFree(d);
+
+    // a presized dict keeps its table: deleting a missing key changes
+    // nothing, and emptying it doesn't go below the presize
+    d = dictNewPresized(1000000);
+    uint8_t log2_size = DK_LOG_SIZE(d->keys);
+    assert(dictDel(d, 1) == 0 && DK_LOG_SIZE(d->keys) == log2_size);
+    for (int i = 0; i < 100000; i++) {
+        dictSet(d, i, i);
+    }
+    for (int i = 0; i < 100000; i++) {
+        dictDel(d, i);
+    }
+    assert(dictLen(d) == 0 && DK_LOG_SIZE(d->keys) == log2_size);
+
+    dictFree(d);
+    d = NULL;
+}
+
+extern void
+dictTest9(void) {
+    uint8_t kinds[] = {DICT_KIND_COMBINED, DICT_KIND_SWISS};
+    DictKeyType keys[1000];
+    DictValueType values[1000];
+    bool found[1000];
+
+    for (int k = 0; k < 2; k++) {
+        Dict *d = dictNewKind(kinds[k]);
+        for (int i = 0; i < 1000; i++) {
+            keys[i] = i * 3;
+            values[i] = i;
+        }
+        dictSetMany(d, keys, values, 1000);
+        assert(dictLen(d) == 1000);
+
+        for (int i = 0; i < 1000; i++) {
+            keys[i] = i;
+            values[i] = -1;
+        }
+        assert(dictHasMany(d, keys, 1000, found) == 334);
+        assert(dictGetMany(d, keys, 1000, values, NULL) == 334);
+        for (int i = 0; i < 1000; i++) {
+            assert(found[i] == (i % 3 == 0));
+            assert(values[i] == (i % 3 == 0 ? i / 3 : -1));
+        }
+
+        dictFree(d);
+        d = NULL;
+    }
+}
+
+extern void
+dictTest10(void) {
+    const char *path = "dict_test10.bin";
+    uint8_t kinds[] = {DICT_KIND_COMBINED, DICT_KIND_SWISS};
+
+    for (int k = 0; k < 2; k++) {
+        Dict *d = dictNewKind(kinds[k]);
+        for (int i = 0; i < 100000; i++) {
+            dictSet(d, i, -i);
+        }
+        for (int i = 0; i < 100000; i += 3) {
+            dictDel(d, i);
+        }
+        assert(dictSave(d, path) == 0);
+
+        Dict *m = dictLoadMapped(path, DICT_MAP_READONLY | DICT_MAP_VERIFY);
+        assert(m != NULL);
+        assert(dictLen(m) == dictLen(d));
+        for (int i = 0; i < 100000; i++) {
+            assert(dictHas(m, i) == (i % 3 != 0));
+            assert(i % 3 == 0 || dictGet(m, i) == -i);
+        }
+        dictFree(m);
+
+        // writes, including a resize, go to private memory
+        m = dictLoadMapped(path, DICT_MAP_COPY_ON_WRITE);
+        assert(m != NULL);
+        for (int i = 100000; i < 300000; i++) {
+            dictSet(m, i, -i);
+        }
+        assert(dictGet(m, 299999) == -299999);
+        assert(dictGet(m, 1) == -1);
+        dictFree(m);
+
+        // a flipped byte is detected
+        FILE *f = fopen(path, "r+b");
+        fseek(f, -1, SEEK_END);
+        int last = fgetc(f);
+        fseek(f, -1, SEEK_END);
+        fputc(last ^ 0x5a, f);
+        fclose(f);
+        assert(dictLoadMapped(path, DICT_MAP_READONLY | DICT_MAP_VERIFY) == NULL);
+
+        // corrupt sizes are caught without the checksum
+        assert(dictSave(d, path) == 0);
+        size_t offsets[] = {offsetof(DictKeys, dk_log2_size), offsetof(DictKeys, dk_index_bytes),
+                            offsetof(DictKeys, dk_nentries) + sizeof(size_t) - 1};
+        for (size_t j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++) {
+            f = fopen(path, "r+b");
+            fseek(f, DICT_FILE_HEADER_BYTES + offsets[j], SEEK_SET);
+            int byte = fgetc(f);
+            fseek(f, DICT_FILE_HEADER_BYTES + offsets[j], SEEK_SET);
+            fputc(byte ^ 0x40, f);
+            fclose(f);
+            assert(dictLoadMapped(path, DICT_MAP_READONLY) == NULL);
+            f = fopen(path, "r+b");
+            fseek(f, DICT_FILE_HEADER_BYTES + offsets[j], SEEK_SET);
+            fputc(byte, f);
+            fclose(f);
+        }
+        // and a truncated file
+        assert(truncate(path, DICT_FILE_HEADER_BYTES + sizeof(DictKeys) + 64) == 0);
+        assert(dictLoadMapped(path, DICT_MAP_READONLY) == NULL);
+
+        dictFree(d);
+        d = NULL;
+    }
+    remove(path);
+}
+
+extern void
+dictTest11(void) {
+    DictStats stats;
+    Dict *d = dictNew();
+    for (int i = 0; i < 1000; i++) {
+        dictSet(d, i, i);
+    }
+    for (int i = 0; i < 100; i++) {
+        dictDel(d, i);
+    }
+    dictStats(d, &stats);
+    assert(stats.used == 900);
+    assert(stats.dummies == 100);
+    assert(stats.nentries == 1000);
+    assert(stats.load_factor > 0.0 && stats.load_factor < 1.0);
+    assert(stats.bytes > 1000 * sizeof(DictKeyEntry));
+#ifdef DICT_STATS
+    assert(stats.counted);
+    assert(stats.counters.resizes > 0);
+    assert(stats.counters.bytes_allocated >= stats.bytes);
+    uint64_t lookups = stats.counters.lookups;
+    for (int i = 0; i < 1000; i++) {
+        dictHas(d, i);
+    }
+    dictStats(d, &stats);
+    assert(stats.counters.lookups == lookups + 1000);
+    uint64_t total = 0;
+    for (size_t i = 0; i < DICT_STATS_PROBE_BUCKETS; i++) {
+        total += stats.counters.probe_hist[i];
+    }
+    assert(total == stats.counters.lookups);
+    assert(stats.counters.probes >= stats.counters.lookups);
+#else
+    assert(!stats.counted && stats.counters.lookups == 0);
+#endif
+    dictFree(d);
+
+    // the counters follow the keys through resizes
+    d = dictNewKind(DICT_KIND_SWISS);
+    for (int i = 0; i < 1000; i++) {
+        dictSet(d, i, i);
+    }
+    dictStats(d, &stats);
+    assert(stats.used == 1000 && stats.dummies == 0);
+#ifdef DICT_STATS
+    assert(stats.counters.resizes > 0);
+    assert(stats.counters.lookups >= 1000);
+#endif
+    dictFree(d);
+}
+
+static DictValueType
+dictTest12Add(DictValueType value, bool present, void* arg) {
+    return (present ? value : 0) + *(int*)arg;
+}
+
+extern void
+dictTest12(void) {
+    const int n = 5000;
+    int* counts = (int*)calloc(n, sizeof(int));
+    uint8_t kinds[] = {DICT_KIND_COMBINED, DICT_KIND_SWISS, DICT_KIND_COMBINED};
+
+    for (int k = 0; k < 3; k++) {
+        Dict *d = dictNewKind(kinds[k]);
+        // the last round resizes incrementally
+        dictSetIncrementalResize(d, k == 2);
+        memset(counts, 0, n * sizeof(int));
+        for (int i = 0; i < 8 * n; i++) {
+            int key = (i * 7919) % n;
+            bool inserted;
+            DictValueType* v = dictGetOrInsert(d, key, 0, &inserted);
+            assert(inserted == (counts[key] == 0));
+            (*v)++;
+            counts[key]++;
+        }
+        assert(dictLen(d) == (size_t)n);
+        for (int i = 0; i < n; i++) {
+            assert(dictGet(d, i) == counts[i]);
+            assert(dictSetDefault(d, i, -1) == counts[i]);
+        }
+        assert(dictSetDefault(d, n, -1) == -1);
+        assert(dictGet(d, n) == -1);
+
+        int delta = 10;
+        for (int i = 0; i <= n; i++) {
+            dictUpdateWith(d, i, dictTest12Add, &delta);
+        }
+        assert(dictUpdateWith(d, n + 1, dictTest12Add, &delta) == 10);
+        assert(dictGet(d, n) == 9);
+
+        // pop half, and reinsert into the freed slots
+        for (int i = 0; i < n; i += 2) {
+            DictValueType v;
+            assert(dictPop(d, i, &v) == 0);
+            assert(v == counts[i] + 10);
+            assert(dictPop(d, i, &v) == -1);
+        }
+        assert(dictLen(d) == (size_t)(n / 2 + 2));
+        for (int i = 0; i < n; i += 4) {
+            *dictGetOrInsert(d, i, 0, NULL) = -i;
+        }
+        for (int i = 0; i < n; i++) {
+            if (i % 4 == 0) {
+                assert(dictGet(d, i) == -i);
+            } else if (i % 2 == 0) {
+                assert(!dictHas(d, i));
+            } else {
+                assert(dictGet(d, i) == counts[i] + 10);
+            }
+        }
+        // down to empty, shrinking on the way
+        for (int i = 0; i < n + 2; i++) {
+            dictDel(d, i);
+        }
+        assert(dictLen(d) == 0);
+        dictFree(d);
+        d = NULL;
+    }
+    free(counts);
+}
+
+extern void
+dictTest13(void) {
+    const int nkeys = 20;
+    const int ndicts = 1000;
+    Dict *proto = dictNew();
+    for (int i = 0; i < nkeys; i++) {
+        dictSet(proto, i * 7, i);
+    }
+    dictDel(proto, 0);
+    Dict **dicts = (Dict **)malloc(ndicts * sizeof(Dict *));
+    for (int j = 0; j < ndicts; j++) {
+        dicts[j] = dictNewSharedKeys(proto);
+        assert(dicts[j]->keys == proto->keys);
+        assert(dictLen(dicts[j]) == (size_t)(nkeys - 1));
+        // values are per dict
+        for (int i = 1; i < nkeys; i++) {
+            dictSet(dicts[j], i * 7, i * j);
+            (*dictGetOrInsert(dicts[j], i * 7, 0, NULL))++;
+        }
+        assert(dicts[j]->keys == proto->keys);
+    }
+    assert(proto->keys->dk_refcnt == (uint32_t)ndicts + 1);
+    for (int j = 0; j < ndicts; j++) {
+        for (int i = 1; i < nkeys; i++) {
+            assert(dictGet(dicts[j], i * 7) == i * j + 1);
+        }
+        assert(!dictHas(dicts[j], 0));
+    }
+
+    // inserting or deleting a key unshares the keys
+    dictSet(dicts[1], 1000, 1);
+    assert(dicts[1]->keys != proto->keys && !dicts[1]->split);
+    assert(dictGet(dicts[1], 7) == 2);
+    assert(!dictHas(dicts[2], 1000));
+    assert(dictPop(dicts[2], 1000, NULL) == -1);
+    assert(dicts[2]->keys == proto->keys);
+    DictValueType v;
+    assert(dictPop(dicts[2], 7, &v) == 0 && v == 3);
+    assert(dicts[2]->keys != proto->keys);
+    assert(dictGet(dicts[3], 7) == 4);
+
+    // iteration keeps the shared insertion order
+    DictIter iter = {dicts[5], 0};
+    DictKeyType key;
+    int n = 0;
+    while (dictIterNext(&iter, &key, &v)) {
+        n++;
+        assert(key == (n * 7) && v == n * 5 + 1);
+    }
+    assert(n == nkeys - 1);
+
+    // the last owner takes the keys back in place
+    dictFree(proto);
+    for (int j = 0; j < ndicts; j++) {
+        if (j != 10) {
+            dictFree(dicts[j]);
+        }
+    }
+    DictKeys *shared = dicts[10]->keys;
+    assert(shared->dk_refcnt == 1);
+    dictSet(dicts[10], -1, -1);
+    assert(dicts[10]->keys == shared && !dicts[10]->split);
+    assert(dictGet(dicts[10], 14) == 21 && dictGet(dicts[10], -1) == -1);
+    dictFree(dicts[10]);
+    free(dicts);
+}
+
+extern void
+dictTest14(void) {
+    uint8_t kinds[] = {DICT_KIND_COMBINED, DICT_KIND_SWISS};
+
+    for (int k = 0; k < 2; k++) {
+        Dict *d = dictNewKind(kinds[k]);
+        assert(d->keys == NULL);
+        hash_t hashes[DICT_SMALL_SIZE + 1];
+        for (int i = 0; i < DICT_SMALL_SIZE; i++) {
+            dictSet(d, i * 10, i);
+            hashes[i] = dictHash(d, i * 10);
+        }
+        dictSet(d, 30, -3);
+        assert(dictGetOrInsert(d, 70, 0, NULL) == &d->small_values[7]);
+        assert(d->keys == NULL);
+        assert(dictLen(d) == DICT_SMALL_SIZE);
+        assert(dictGet(d, 30) == -3 && !dictHas(d, 31));
+
+        // a pop keeps the insertion order of the others
+        DictValueType v;
+        assert(dictPop(d, 20, &v) == 0 && v == 2);
+        assert(dictPop(d, 20, &v) == -1);
+        DictKeyType key;
+        DictKeyType order[] = {0, 10, 30, 40, 50, 60, 70};
+        int n = 0;
+        DictIter iter = {d, 0};
+        while (dictIterNext(&iter, &key, &v)) {
+            assert(key == order[n++]);
+        }
+        assert(n == DICT_SMALL_SIZE - 1);
+        DictKeyType keys[] = {0, 20, 30, 31};
+        bool found[4];
+        DictValueType values[4] = {-1, -1, -1, -1};
+        assert(dictGetMany(d, keys, 4, values, found) == 2);
+        assert(found[0] && !found[1] && found[2] && !found[3]);
+        assert(values[0] == 0 && values[1] == -1 && values[2] == -3);
+
+        // the 9th key moves all of them to a keys object
+        dictSet(d, 20, 2);
+        dictSet(d, 80, 8);
+        assert(d->keys != NULL);
+        assert(dictLen(d) == DICT_SMALL_SIZE + 1);
+        for (int i = 0; i <= DICT_SMALL_SIZE; i++) {
+            assert(dictGet(d, i * 10) == (i == 3 ? -3 : i));
+        }
+        for (int i = 0; i < DICT_SMALL_SIZE; i++) {
+            assert(dictHash(d, i * 10) == hashes[i]);
+        }
+        dictFree(d);
+        d = NULL;
+    }
+
+    // a presized dict doesn't start inline
+    Dict *d = dictNewPresized(DICT_SMALL_SIZE + 1);
+    assert(d->keys != NULL);
+    dictFree(d);
+}
+
+extern void
+dictTest15(void) {
+    const char *path = "dict_test15.bin";
+    uint8_t kinds[] = {DICT_KIND_COMBINED, DICT_KIND_SWISS};
+    int sizes[] = {0, 5, 1000, 100000};
+
+    for (int k = 0; k < 2; k++) {
+        for (int s = 0; s < 4; s++) {
+            int n = sizes[s];
+            Dict *d = dictNewKind(kinds[k]);
+            for (int i = 0; i < n; i++) {
+                dictSet(d, i * 3, i);
+            }
+            for (int i = 0; i < n; i += 7) {
+                dictDel(d, i * 3);
+            }
+            size_t len = dictLen(d);
+            hash_t hash = dictHash(d, 3);
+            assert(dictFreeze(d) == 0);
+            assert(dictFreeze(d) == 0);
+            assert(d->kind == DICT_KIND_FROZEN);
+            assert(dictLen(d) == len && dictHash(d, 3) == hash);
+            for (int i = -3; i < 3 * n + 3; i++) {
+                bool present = (i >= 0 && i % 3 == 0 && i / 3 < n && (i / 3) % 7 != 0);
+                assert(dictHas(d, i) == present);
+                assert(!present || dictGet(d, i) == i / 3);
+            }
+
+            // every entry once, in the order of the table
+            size_t count = 0;
+            DictKeyType key;
+            DictValueType v;
+            DictIter iter = {d, 0};
+            while (dictIterNext(&iter, &key, &v)) {
+                assert(key == v * 3);
+                count++;
+            }
+            assert(count == len);
+            DictKeyType keys[] = {3, 6, 21, -1};
+            DictValueType values[4];
+            bool found[4];
+            size_t nfound = dictGetMany(d, keys, 4, values, found);
+            assert(nfound == (n > 7 ? 2 : n > 2 ? 2 : n > 1 ? 1 : 0));
+            assert(found[0] == (n > 1) && !found[2] && !found[3]);
+
+            // pilots and remapped slots, about 3.4 bits per key
+            DictStats stats;
+            dictStats(d, &stats);
+            assert(stats.used == len && stats.dummies == 0);
+            size_t overhead = stats.bytes - len * sizeof(DictKeyEntry) - sizeof(DictKeys);
+            assert(overhead * 8 <= len * 4 + 512);
+#ifdef DICT_STATS
+            uint64_t lookups = stats.counters.lookups;
+            uint64_t probes = stats.counters.probes;
+            dictHas(d, 3);
+            dictHas(d, 4);
+            dictStats(d, &stats);
+            assert(stats.counters.lookups == lookups + 2 && stats.counters.probes == probes + 2);
+#endif
+
+            if (n == 100000) {
+                assert(dictSave(d, path) == 0);
+                Dict *m = dictLoadMapped(path, DICT_MAP_READONLY | DICT_MAP_VERIFY);
+                assert(m != NULL && m->kind == DICT_KIND_FROZEN);
+                assert(dictLen(m) == len);
+                for (int i = 0; i < 3 * n; i++) {
+                    assert(dictHas(m, i) == dictHas(d, i));
+                    assert(!dictHas(m, i) || dictGet(m, i) == i / 3);
+                }
+                dictFree(m);
+                remove(path);
+            }
+            printf("frozen: %zu keys, %zu bytes of pilots and remap\n", len, overhead);
+            dictFree(d);
+            d = NULL;
+        }
+    }
+}
+
+extern void
+dictTest16(void) {
+    const size_t n = 3 * DICT_PARALLEL_MIN;
+    DictKeyType* keys = (DictKeyType*)malloc(n * sizeof(DictKeyType));
+    DictValueType* values = (DictValueType*)malloc(n * sizeof(DictValueType));
+    // every 10th key repeats an earlier one
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (i % 10 == 9) ? (DictKeyType)(i * 7919 % (i - 1)) : (DictKeyType)i;
+        values[i] = (DictValueType)(n - i);
+    }
+
+    Dict* ref = dictNew();
+    for (size_t i = 0; i < n; i++) {
+        dictSet(ref, keys[i], values[i]);
+    }
+    size_t nthreads[] = {1, 4, 7};
+    for (int t = 0; t < 3; t++) {
+        Dict* d = dictNewFromArrays(keys, values, n, nthreads[t]);
+        assert(dictLen(d) == dictLen(ref));
+        // same order and values as the dictSet ones
+        DictIter it1 = {d, 0};
+        DictIter it2 = {ref, 0};
+        DictKeyType k1, k2;
+        DictValueType v1, v2;
+        size_t count = 0;
+        while (dictIterNext(&it1, &k1, &v1)) {
+            assert(dictIterNext(&it2, &k2, &v2));
+            assert(k1 == k2 && v1 == v2);
+            count++;
+        }
+        assert(count == dictLen(ref));
+        // still a regular dict
+        for (size_t i = 0; i < n; i += 3) {
+            dictDel(d, keys[i]);
+        }
+        dictSet(d, -1, -1);
+        assert(dictGet(d, -1) == -1 && !dictHas(d, keys[3]));
+        dictFree(d);
+    }
+
+    // resizes building the indices with several threads
+    Dict* d = dictNew();
+    dictSetResizeThreads(d, 4);
+    for (size_t i = 0; i < n; i++) {
+        dictSet(d, (DictKeyType)i, (DictValueType)i);
+        if (i % 4 == 0) {
+            dictDel(d, (DictKeyType)(i / 2));
+        }
+    }
+    // the even keys below n/2 were deleted along the way
+    for (size_t i = 0; i < n; i++) {
+        bool deleted = i % 2 == 0 && 2 * i < n;
+        assert(dictHas(d, (DictKeyType)i) == !deleted);
+        assert(deleted || dictGet(d, (DictKeyType)i) == (DictValueType)i);
+    }
+    assert(dictLen(d) == n - n / 4);
+    dictFree(d);
+    dictFree(ref);
+    free(keys);
+    free(values);
+}
+
+// counts the live bytes in its context
+static void*
+_testCountingAlloc(void* ctx, size_t nbytes, bool* zeroed) {
+    *(size_t*)ctx += nbytes;
+    return allocDefault.alloc(NULL, nbytes, zeroed);
+}
+
+static void*
+_testCountingRealloc(void* ctx, void* p, size_t old_nbytes, size_t nbytes) {
+    *(size_t*)ctx += nbytes - old_nbytes;
+    return allocDefault.realloc(NULL, p, old_nbytes, nbytes);
+}
+
+static void
+_testCountingFree(void* ctx, void* p, size_t nbytes) {
+    *(size_t*)ctx -= nbytes;
+    allocDefault.free(NULL, p, nbytes);
+}
+
+// counts the allocations instead
+static void*
+_testCountingNew(void* ctx, size_t nbytes, bool* zeroed) {
+    *(size_t*)ctx += 1;
+    return allocDefault.alloc(NULL, nbytes, zeroed);
+}
+
+extern void
+dictTest17(void) {
+    size_t live = 0;
+    Allocator counting = {_testCountingAlloc, _testCountingRealloc, _testCountingFree, &live};
+    Dict* d = dictNew();
+    dictSetAllocator(d, &counting);
+    for (int i = 0; i < 10000; i++) {
+        dictSet(d, i, i);
+        // the old keys object is freed right away
+        assert(live == (d->keys == NULL ? 0 : _DictKeys_Bytes(d->keys)));
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        dictDel(d, i);
+    }
+    dictFreeze(d);
+    assert(live == _DictKeys_Bytes(d->keys));
+    assert(dictGet(d, 9999) == 9999 && !dictHas(d, 9998));
+    dictFree(d);
+    assert(live == 0);
+
+    // moved to the allocator of the dict
+    d = dictNewPresized(1000);
+    dictSet(d, 1, 1);
+    dictSetAllocator(d, &counting);
+    assert(d->keys->dk_alloc == &counting && live == _DictKeys_Bytes(d->keys));
+    assert(dictGet(d, 1) == 1);
+    dictSetAllocator(d, NULL);
+    assert(live == 0 && dictGet(d, 1) == 1);
+    dictFree(d);
+
+    // a table of several huge pages, and its resizes
+    d = dictNewPresized(1 << 18);
+    dictSetAllocator(d, &allocHugePages);
+    assert((uintptr_t)d->keys % ALLOC_HUGE_PAGE_SIZE == 0);
+    for (int i = 0; i < 1 << 20; i++) {
+        dictSet(d, i, -i);
+    }
+    assert((uintptr_t)d->keys % ALLOC_HUGE_PAGE_SIZE == 0);
+    for (int i = 0; i < 1 << 20; i++) {
+        assert(dictGet(d, i) == -i);
+    }
+    dictFree(d);
+
+    d = dictNewKind(DICT_KIND_SWISS);
+    dictSetAllocator(d, &counting);
+    for (int i = 0; i < 10000; i++) {
+        dictSet(d, i, i);
+    }
+    assert(live == _DictKeys_Bytes(d->keys));
+    dictFree(d);
+    assert(live == 0);
+}
+
+// dictSumValues, dictMinMaxValues and dictSelectKeys against dictIterNext,
+// which completes a resize in progress: the scans go first and must not
+static void
+_testCheckScans(Dict* d) {
+    bool resizing = (d->oldkeys != NULL);
+    int64_t scan_sum = dictSumValues(d);
+    DictValueType min = 1, max = -1;
+    bool scan_found = dictMinMaxValues(d, &min, &max);
+    DictKeyType* keys = (DictKeyType*)malloc((dictLen(d) + 1) * sizeof(DictKeyType));
+    size_t nselected = dictSelectKeys(d, -1000, 1000, keys, dictLen(d));
+    // only counted past n
+    assert(dictSelectKeys(d, -1000, 1000, keys, nselected / 2) == nselected);
+    assert(resizing == (d->oldkeys != NULL));
+
+    int64_t sum = 0;
+    DictValueType lo = 0, hi = 0;
+    size_t count = 0;
+    DictKeyType* expected = (DictKeyType*)malloc((dictLen(d) + 1) * sizeof(DictKeyType));
+    size_t nexpected = 0;
+    DictIter it = {d, 0};
+    DictKeyType k;
+    DictValueType v;
+    while (dictIterNext(&it, &k, &v)) {
+        sum += v;
+        lo = (count == 0 || v < lo) ? v : lo;
+        hi = (count == 0 || v > hi) ? v : hi;
+        count++;
+        if (v >= -1000 && v <= 1000) {
+            expected[nexpected++] = k;
+        }
+    }
+    assert(scan_sum == sum);
+    assert(scan_found == (count > 0));
+    assert(count == 0 || (min == lo && max == hi));
+    assert(nselected == nexpected);
+    assert(memcmp(keys, expected, nexpected * sizeof(DictKeyType)) == 0);
+    free(keys);
+    free(expected);
+}
+
+extern void
+dictTest18(void) {
+    uint8_t kinds[] = {DICT_KIND_COMBINED, DICT_KIND_SWISS};
+    for (int t = 0; t < 2; t++) {
+        Dict* d = dictNewKind(kinds[t]);
+        _testCheckScans(d);
+        dictSet(d, 1, INT32_MIN);
+        dictSet(d, 2, 7);
+        _testCheckScans(d);
+        // wide values, the sum doesn't fit 32 bits
+        for (int i = 0; i < 5000; i++) {
+            int32_t value = (int32_t)((uint32_t)i * 2654435761u);
+            dictSet(d, i, (i % 7 == 0) ? value % 2000 : value);
+        }
+        dictSet(d, 4999, INT32_MAX);
+        for (int i = 0; i < 5000; i += 3) {
+            dictDel(d, i);
+        }
+        _testCheckScans(d);
+        if (kinds[t] == DICT_KIND_COMBINED) {
+            Dict* shared = dictNewSharedKeys(d);
+            dictSet(shared, 1, 12345);
+            _testCheckScans(shared);
+            dictFree(shared);
+            _testCheckScans(d);
+
+            dictSetIncrementalResize(d, true);
+            for (int i = 5000; i < 9000; i++) {
+                dictSet(d, i, -i);
+            }
+            _testCheckScans(d);
+            // halfway through a migration, with deletes on both sides of it
+            for (int i = 9000; d->oldkeys == NULL; i++) {
+                dictSet(d, i, i % 3000 - 1500);
+            }
+            for (int i = 0; i < 20 && d->oldkeys != NULL; i++) {
+                dictDel(d, 5001 + i * 3);
+                dictDel(d, 8999 - i * 3);
+            }
+            assert(d->oldkeys != NULL && d->extra->rehash_pos > 0);
+            _testCheckScans(d);
+        }
+        dictFreeze(d);
+        _testCheckScans(d);
+        dictFree(d);
+    }
+}
+
+// the moves of d so far, as its cursors see them
+static uint64_t
+_testScanEpoch(Dict* d) {
+    return (d->extra != NULL) ? d->extra->scan_epoch : 0;
+}
+
+// scans d in batches of n with churn inserts and ndel deletes of the
+// oldest inserted keys in between, the keys [0, nstable) are never
+// deleted and must all be returned
+static void
+_testScanChurn(Dict* d, int nstable, size_t n, int churn, int ndel) {
+    bool* seen = (bool*)calloc(nstable, sizeof(bool));
+    DictKeyType* keys = (DictKeyType*)malloc(n * sizeof(DictKeyType));
+    DictValueType* values = (DictValueType*)malloc(n * sizeof(DictValueType));
+    DictCursor cursor = {0};
+    int next = nstable;
+    int oldest = nstable;
+    size_t calls = 0;
+    for (size_t got; (got = dictScan(d, &cursor, keys, values, n)) > 0; ) {
+        assert(got <= n && ++calls < 100000);
+        for (size_t i = 0; i < got; i++) {
+            assert(dictGet(d, keys[i]) == values[i]);
+            if (keys[i] < nstable) {
+                seen[keys[i]] = true;
+            }
+        }
+        for (int i = 0; i < churn; i++) {
+            dictSet(d, next, next);
+            next++;
+        }
+        for (int i = 0; i < ndel && oldest < next; i++) {
+            dictDel(d, oldest);
+            oldest++;
+        }
+    }
+    for (int i = 0; i < nstable; i++) {
+        assert(seen[i]);
+    }
+    free(seen);
+    free(keys);
+    free(values);
+}
+
+extern void
+dictTest19(void) {
+    for (int incremental = 0; incremental < 2; incremental++) {
+        Dict* d = dictNew();
+        dictSetIncrementalResize(d, incremental);
+        for (int i = 0; i < 20000; i++) {
+            dictSet(d, i, i);
+        }
+        uint64_t epoch = _testScanEpoch(d);
+        _testScanChurn(d, 20000, 97, 300, 250);
+        // the scan went through moves
+        assert(_testScanEpoch(d) >= epoch + 2);
+        // no cursor is left: the second move on records nothing
+        epoch = _testScanEpoch(d);
+        for (int i = 0; _testScanEpoch(d) < epoch + 2; i++) {
+            dictSet(d, 1000000 + i, i);
+        }
+        assert(!d->extra->scan_remap && d->extra->scan_map == NULL);
+        dictFree(d);
+    }
+
+    // a scan doesn't complete the migration in progress, it reads
+    // both keys objects
+    Dict* d = dictNew();
+    dictSetIncrementalResize(d, true);
+    for (int i = 0; i < 20000 || d->oldkeys == NULL; i++) {
+        dictSet(d, i, i);
+    }
+    int nkeys = (int)dictLen(d);
+    // migrated, not yet, inserted during the migration
+    dictDel(d, 3);
+    dictDel(d, nkeys - 2);
+    dictDel(d, nkeys - 1);
+    dictSet(d, nkeys, nkeys);
+    size_t rehash_pos = d->extra->rehash_pos;
+    DictKeyType* keys = (DictKeyType*)malloc((nkeys + 1) * sizeof(DictKeyType));
+    DictValueType* values = (DictValueType*)malloc((nkeys + 1) * sizeof(DictValueType));
+    DictCursor cursor = {0};
+    size_t count = 0;
+    for (size_t got; (got = dictScan(d, &cursor, &keys[count], &values[count], 7)) > 0; ) {
+        count += got;
+    }
+    assert(d->oldkeys != NULL && d->extra->rehash_pos == rehash_pos);
+    assert(count == dictLen(d));
+    bool* seen = (bool*)calloc(nkeys + 1, sizeof(bool));
+    for (size_t i = 0; i < count; i++) {
+        assert(!seen[keys[i]] && dictGet(d, keys[i]) == values[i]);
+        seen[keys[i]] = true;
+    }
+    free(seen);
+    free(keys);
+    free(values);
+    dictFree(d);
+
+    // several moves between two calls
+    for (int incremental = 0; incremental < 2; incremental++) {
+        d = dictNew();
+        dictSetIncrementalResize(d, incremental);
+        for (int i = 0; i < 20000; i++) {
+            dictSet(d, i, i);
+        }
+        int* seen_count = (int*)calloc(20000, sizeof(int));
+        DictKeyType batch[97];
+        memset(&cursor, 0, sizeof(cursor));
+        int next = 20000;
+        for (size_t got; (got = dictScan(d, &cursor, batch, NULL, 97)) > 0; ) {
+            for (size_t i = 0; i < got; i++) {
+                if (batch[i] < 20000) {
+                    seen_count[batch[i]]++;
+                }
+            }
+            uint64_t epoch = _testScanEpoch(d);
+            for (; _testScanEpoch(d) < epoch + 3; next++) {
+                dictSet(d, next, next);
+                dictDel(d, next - 1000 >= 20000 ? next - 1000 : -1);
+            }
+        }
+        for (int i = 0; i < 20000; i++) {
+            assert(seen_count[i] == 1);
+        }
+        free(seen_count);
+        dictFree(d);
+    }
+
+    // small batches of a swiss table that rehashes under them,
+    // growing and then at the same size for the deleted slots
+    size_t nallocs = 0;
+    Allocator counting = {_testCountingNew, allocDefault.realloc, allocDefault.free, &nallocs};
+    for (int growing = 0; growing < 2; growing++) {
+        d = dictNewKind(DICT_KIND_SWISS);
+        dictSetAllocator(d, &counting);
+        for (int i = 0; i < 20000; i++) {
+            dictSet(d, i, i);
+        }
+        nallocs = 0;
+        if (growing) {
+            _testScanChurn(d, 20000, 16, 8, 0);
+        } else {
+            _testScanChurn(d, 20000, 7, 40, 35);
+        }
+        assert(nallocs >= 1);
+        dictFree(d);
+    }
+
+    // inline entries, moved down by the deletes
+    d = dictNew();
+    for (int i = 0; i < 5; i++) {
+        dictSet(d, i, i);
+    }
+    _testScanChurn(d, 3, 2, 1, 0);
+    dictFree(d);
+
+    // nothing to scan
+    d = dictNew();
+    memset(&cursor, 0, sizeof(cursor));
+    DictKeyType key;
+    assert(dictScan(d, &cursor, &key, NULL, 1) == 0);
+    dictFree(d);
+}
 #endif  // DICT_TEST
@@ -12,25 +12,87 @@
 #ifndef _DICT_H_
 #define _DICT_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "hash.h"
+#include "alloc.h"
 
 // >> settings
 #define DICT_TEST
 
+// #define DICT_GENERIC_PROBES  // don't specialize the probes by index width
+
+// #define DICT_STATS  // count probes and resizes, see dictStats
+
+// #define DICT_COMPACT_ENTRIES  // entries without the hash, which is recomputed
+
 #define DICT_LOG_MINSIZE 3
 
+// a dict of up to DICT_SMALL_SIZE keys stores them inline,
+// without a keys object (see Dict)
+#define DICT_SMALL_SIZE 8
+
+// layouts of DictKeys, chosen at dictNew time
+// DICT_KIND_COMBINED: cpython-like, indices + insertion ordered entries
+// DICT_KIND_SWISS: 1-byte control tags + slot-aligned entries, probed
+//                  16 slots (one group) at a time
+// DICT_KIND_FROZEN: made by dictFreeze, read only; packed entries placed
+//                   by a minimal perfect hash, one probe per lookup
+#define DICT_KIND_COMBINED 0
+#define DICT_KIND_SWISS    1
+#define DICT_KIND_FROZEN   2
+
+// number of old entries migrated by each operation
+// while a dict is being resized incrementally
+#define DICT_REHASH_STEP 64
+
+// number of keys whose probes are overlapped by the *Many functions
+#define DICT_BATCH_SIZE 16
+
+// dictNewFromArrays and the resizes of dictSetResizeThreads use
+// a single thread for fewer entries
+#define DICT_PARALLEL_MIN 65536
+
+// hash of the default key functions, seeded per dict (see hash.h)
+// hashMix64 | hashIdentity
+#define DICT_KEY_HASH hashMix64
+
 typedef int DictKeyType;
 typedef int DictValueType;
 typedef uint64_t hash_t;
 // << settings
 
+// lookups by the number of slots probed (groups for DICT_KIND_SWISS),
+// the last bucket also counts the longer probes
+#define DICT_STATS_PROBE_BUCKETS 16
+
+// updated on the hot paths when DICT_STATS is defined; the updates are
+// not atomic read-modify-writes, concurrent readers may lose a few counts
+typedef struct {
+    uint64_t probe_hist[DICT_STATS_PROBE_BUCKETS];
+    uint64_t lookups;
+    uint64_t probes;
+    uint64_t resizes;
+    uint64_t resize_ns;
+    // by dictNew and the resizes, not decreased by frees
+    uint64_t bytes_allocated;
+} DictStatsCounters;
+
+// With DICT_COMPACT_ENTRIES the hash of an entry is recomputed from the
+// key, and DICT_KIND_COMBINED keys mark the live entries in a bitmap
+// instead of with the hash.
 typedef struct {
+#ifndef DICT_COMPACT_ENTRIES
     hash_t hash;
+#endif
     DictKeyType key;
     DictValueType value;
 } DictKeyEntry;
 
+// probe routines of a DictKeys, see dict.c
+struct _DictKeysOps;
+
 typedef struct {
     uint8_t dk_log2_size;
 
@@ -40,9 +102,39 @@ typedef struct {
     // possible values: [ 1 | 2 | 4 | 8 ]
     uint8_t dk_index_bytes;
 
+    // DICT_KIND_COMBINED | DICT_KIND_SWISS | DICT_KIND_FROZEN
+    // for DICT_KIND_SWISS, dk_indices holds one control byte per slot
+    // and dk_entries has DK_SIZE(dk) slots instead of the usable fraction;
+    // DICT_KIND_FROZEN has no indices (dk_log2_size and dk_index_bytes
+    // are 0), the dk_nentries entries are followed by the perfect hash
+    uint8_t dk_kind;
+
+    // set when the keys object lives in a dictLoadMapped mapping,
+    // which is released by dictFree instead
+    uint8_t dk_mapped;
+
+    // released to it by _DictKeys_Free, see dictSetAllocator
+    const Allocator* dk_alloc;
+
+    // number of split dicts sharing the keys object, 1 if not shared
+    uint32_t dk_refcnt;
+
     int (*keyCmpFunc)(DictKeyType key1, DictKeyType key2);
 
-    hash_t (*keyHashFunc)(DictKeyType key);
+    hash_t (*keyHashFunc)(DictKeyType key, hash_t seed);
+
+    // drawn by dictNew, resized keys inherit it
+    // since the entries keep their hashes
+    hash_t dk_seed;
+
+    // specialized for dk_index_bytes and the key functions,
+    // selected once by _DictKeys_New
+    const struct _DictKeysOps* dk_ops;
+
+#ifdef DICT_STATS
+    // shared by all the keys objects of a dict, see dictStats
+    DictStatsCounters* dk_stats;
+#endif
 
     /* Number of usable entries in dk_entries. */
     size_t dk_usable;
@@ -56,26 +148,164 @@ typedef struct {
        see the DK_ENTRIES() macro */
 } DictKeys;
 
+// 64 entry positions of a move that keeps the live entries in order:
+// those whose bit is set in live went to base onwards
+typedef struct {
+    size_t base;
+    uint64_t live;
+} DictScanBlock;
+
+// The state of the dicts that are resized incrementally, scanned,
+// mapped from a file, or given an allocator or resize threads. Most
+// dicts never need it: it is allocated the first time, see _dictExtra.
+typedef struct {
+    // >> incremental resize (DICT_KIND_COMBINED only)
+    bool incremental_resize;
+    // while Dict.oldkeys is set, oldkeys entries
+    // [rehash_pos, oldkeys->dk_nentries) are not migrated yet
+    size_t rehash_pos;
+    // next position in keys for a migrated entry,
+    // keys entries [rehash_ix, rehash_end) are reserved for them
+    size_t rehash_ix;
+    size_t rehash_end;
+    // the migrated entries of oldkeys below rehash_pos, block by block
+    DictScanBlock* rehash_map;
+    // << incremental resize
+
+    // threads building the indices of a resize, see dictSetResizeThreads
+    uint32_t resize_threads;
+
+    // of the next keys objects, see dictSetAllocator
+    const Allocator* alloc;
+
+    // >> cursors (see dictScan)
+    // bumped whenever the entries change positions
+    uint64_t scan_epoch;
+    // a cursor is at scan_epoch: the next move of a DICT_KIND_COMBINED
+    // table records in scan_map where the entries went
+    bool scan_remap;
+    // where the positions of scan_map_epoch are now, NULL if unknown:
+    // those below scan_map_end by block of 64, position
+    // scan_map_end + i at scan_map_tail + i
+    DictScanBlock* scan_map;
+    uint64_t scan_map_epoch;
+    size_t scan_map_end;
+    size_t scan_map_tail;
+    // << cursors
+
+    // the file mapping of dictLoadMapped, or NULL
+    void* mapping;
+    size_t mapping_bytes;
+    bool mapping_readonly;
+
+#ifdef DICT_STATS
+    // allocated along with the dict in this build
+    DictStatsCounters stats;
+#endif
+} DictExtra;
+
 typedef struct {
     /* Number of items in the dictionary */
     uint32_t used;
 
-    // number of bytes needed for the dictkeys object
-    size_t dk_size;
+    // >> small dict
+    // While keys is NULL the dict holds its entries inline, in insertion
+    // order, and lookups scan small_keys. The first insert past
+    // DICT_SMALL_SIZE moves them to a keys object of the given kind and
+    // seed, the dict doesn't go back to inline storage afterwards.
+    uint8_t kind;
+    // equal to used while inline; kept apart since dictRcuWriteCommit
+    // changes used under readers still scanning the inline entries
+    uint8_t small_used;
+    // << small dict
+
+    // the table of dictNewPresized, resizes don't shrink below it
+    uint8_t min_log2_size;
+
+    // a split table, see values
+    bool split;
 
     DictKeys* keys;
+
+    // non-NULL while an incremental resize is in progress, the
+    // migration cursor is in extra
+    DictKeys* oldkeys;
+
+    // NULL until needed
+    DictExtra* extra;
+
+    union {
+        // while keys is NULL
+        struct {
+            hash_t seed;
+            DictKeyType small_keys[DICT_SMALL_SIZE];
+            DictValueType small_values[DICT_SMALL_SIZE];
+        };
+        // Split table (see dictNewSharedKeys): the values of the entries
+        // of keys, which is shared and never changed. Only set with split,
+        // so that a dict whose keys were just published by
+        // dictRcuWriteCommit keeps its inline entries for the readers.
+        DictValueType* values;
+    };
 } Dict;
 
+typedef struct {
+    // all zero unless built with DICT_STATS
+    DictStatsCounters counters;
+    bool counted;
+
+    size_t used;
+    // slots of the table, and the ones taken by live or deleted entries
+    size_t size;
+    size_t nentries;
+    // deleted entries (tombstones) still taking up a slot
+    size_t dummies;
+    // nentries / size
+    double load_factor;
+    // of the keys objects in use, including the old one of a resize
+    size_t bytes;
+} DictStats;
+
 typedef struct {
     Dict* mp;
     size_t pos;
 } DictIter;
 
+// dictScan state, zeroed to start a scan
+typedef struct {
+    uint64_t epoch;
+    size_t pos;
+    // the end of the entries when the scan started
+    size_t end;
+    // DICT_KIND_SWISS: the keys before (hash, key) are done, in the
+    // order of their mixed hashes and then of the keys, which unlike
+    // the slots doesn't change when the table is rehashed
+    hash_t hash;
+    DictKeyType key;
+} DictCursor;
+
+// dictUpdateWith callback, returns the new value of a key;
+// value is meaningless unless present
+typedef DictValueType (*DictUpdateFunc)(DictValueType value, bool present, void* arg);
+
+// dictLoadMapped flags
+#define DICT_MAP_READONLY      0  // the dict must not be written to
+#define DICT_MAP_COPY_ON_WRITE 1  // writes touch private copies of the pages
+#define DICT_MAP_VERIFY        2  // check the checksum, reading the whole file
+
+#define DICT_FILE_VERSION 3
+
 // >> external API
 extern Dict*
 dictNew(void);
 extern Dict*
 dictNewPresized(size_t size);
+extern Dict*
+dictNewKind(uint8_t kind);
+extern Dict*
+dictNewPresizedKind(size_t size, uint8_t kind);
+extern Dict*
+dictNewFromArrays(const DictKeyType* keys, const DictValueType* values, size_t n, size_t nthreads);
 extern DictValueType
 dictGet(Dict* mp, DictKeyType key);
 extern void
@@ -84,12 +314,60 @@ extern int
 dictHas(Dict* mp, DictKeyType key);
 extern int
 dictDel(Dict* mp, DictKeyType key);
+extern DictValueType*
+dictGetOrInsert(Dict* mp, DictKeyType key, DictValueType dflt, bool* inserted);
+extern DictValueType
+dictSetDefault(Dict* mp, DictKeyType key, DictValueType dflt);
+extern DictValueType
+dictUpdateWith(Dict* mp, DictKeyType key, DictUpdateFunc func, void* arg);
+extern int
+dictPop(Dict* mp, DictKeyType key, DictValueType* value);
+extern Dict*
+dictNewSharedKeys(Dict* mp);
+extern int
+dictFreeze(Dict* mp);
 extern size_t
 dictLen(Dict* mp);
+extern hash_t
+dictHash(Dict* mp, DictKeyType key);
 extern void
 dictFree(Dict* d);
+extern void
+dictSetIncrementalResize(Dict* mp, bool enable);
+extern void
+dictSetResizeThreads(Dict* mp, size_t nthreads);
+extern void
+dictSetAllocator(Dict* mp, const Allocator* alloc);
+extern void
+dictRcuReadBegin(Dict* mp);
+extern void
+dictRcuReadEnd(void);
+extern Dict*
+dictRcuWriteBegin(Dict* mp);
+extern void
+dictRcuWriteCommit(Dict* mp, Dict* copy);
+extern void
+dictStats(Dict* mp, DictStats* stats);
+extern int
+dictSave(Dict* mp, const char* path);
+extern Dict*
+dictLoadMapped(const char* path, int flags);
+extern size_t
+dictGetMany(Dict* mp, const DictKeyType* keys, size_t n, DictValueType* values, bool* found);
+extern void
+dictSetMany(Dict* mp, const DictKeyType* keys, const DictValueType* values, size_t n);
+extern size_t
+dictHasMany(Dict* mp, const DictKeyType* keys, size_t n, bool* found);
 extern bool
 dictIterNext(DictIter* iter, DictKeyType* key, DictValueType* value);
+extern size_t
+dictScan(Dict* mp, DictCursor* cursor, DictKeyType* keys, DictValueType* values, size_t n);
+extern int64_t
+dictSumValues(Dict* mp);
+extern bool
+dictMinMaxValues(Dict* mp, DictValueType* min, DictValueType* max);
+extern size_t
+dictSelectKeys(Dict* mp, DictValueType lo, DictValueType hi, DictKeyType* keys, size_t n);
 #ifdef DICT_TEST
 extern void
 dictTest1(void);
@@ -101,6 +379,34 @@ extern void
 dictTest4(void);
 extern void
 dictTest5(void);
+extern void
+dictTest6(void);
+extern void
+dictTest7(void);
+extern void
+dictTest8(void);
+extern void
+dictTest9(void);
+extern void
+dictTest10(void);
+extern void
+dictTest11(void);
+extern void
+dictTest12(void);
+extern void
+dictTest13(void);
+extern void
+dictTest14(void);
+extern void
+dictTest15(void);
+extern void
+dictTest16(void);
+extern void
+dictTest17(void);
+extern void
+dictTest18(void);
+extern void
+dictTest19(void);
 #endif
 // << external API
 
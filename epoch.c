@@ -0,0 +1,208 @@
+// References:
+// https://www.cl.cam.ac.uk/techreports/UCAM-CL-TR-579.pdf  (epoch-based reclamation)
+// https://lwn.net/Articles/728795/  (membarrier, asymmetric fences)
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#endif
+#include "epoch.h"
+
+#define CACHE_LINE_SIZE 64
+
+// one per reader thread, never freed: the record of an exited thread
+// goes to the next thread that registers
+typedef struct _epochRecord epochRecord;
+struct _epochRecord {
+    // 0 when outside of a section
+    uint64_t epoch;
+    unsigned nesting;
+    bool in_use;  // under records_lock
+    epochRecord *next;
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+typedef struct _retired retired;
+struct _retired {
+    void *ptr;
+    void (*free_func)(void *ptr);
+    uint64_t epoch;
+    retired *next;
+};
+
+static uint64_t global_epoch = 1;
+static epochRecord *records = NULL;
+static pthread_mutex_t records_lock = PTHREAD_MUTEX_INITIALIZER;
+static retired *retired_list = NULL;
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread epochRecord *thread_record = NULL;
+// its destructor gives the record of an exiting thread back
+static pthread_key_t record_key;
+
+// 1 if membarrier() lets readers get away with a compiler barrier,
+// set up along with record_key
+static int asymmetric_fences = -1;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+// >> internal functions
+static void _epochInit(void);
+static epochRecord* _epochRegister(void);
+static void _epochUnregister(void *arg);
+static void _epochHeavyFence(void);
+// << internal functions
+
+
+extern void epochEnter(void) {
+    epochRecord *rec = thread_record;
+    if (rec == NULL) {
+        rec = _epochRegister();
+    }
+    if (rec->nesting++ > 0) {
+        return;
+    }
+    __atomic_store_n(&rec->epoch, __atomic_load_n(&global_epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    // the announcement has to be visible before the protected loads
+    if (asymmetric_fences) {
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } else {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+extern void epochExit(void) {
+    epochRecord *rec = thread_record;
+    assert(rec != NULL && rec->nesting > 0);
+    if (--rec->nesting > 0) {
+        return;
+    }
+    __atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// ptr must already be unreachable for new readers
+extern void epochRetire(void *ptr, void (*free_func)(void *ptr)) {
+    retired *r = malloc(sizeof(retired));
+    assert(r != NULL);
+    r->ptr = ptr;
+    r->free_func = free_func;
+    // readers announcing a later epoch can't see ptr any more
+    r->epoch = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&retired_lock);
+    r->next = retired_list;
+    retired_list = r;
+    pthread_mutex_unlock(&retired_lock);
+}
+
+extern void epochReclaim(void) {
+    pthread_once(&init_once, _epochInit);
+    _epochHeavyFence();
+
+    uint64_t min_epoch = UINT64_MAX;
+    pthread_mutex_lock(&records_lock);
+    for (epochRecord *rec = records; rec != NULL; rec = rec->next) {
+        uint64_t e = __atomic_load_n(&rec->epoch, __ATOMIC_ACQUIRE);
+        if (e != 0 && e < min_epoch) {
+            min_epoch = e;
+        }
+    }
+    pthread_mutex_unlock(&records_lock);
+
+    retired *to_free = NULL;
+    pthread_mutex_lock(&retired_lock);
+    for (retired **pr = &retired_list; *pr != NULL; ) {
+        retired *r = *pr;
+        if (r->epoch < min_epoch) {
+            *pr = r->next;
+            r->next = to_free;
+            to_free = r;
+        } else {
+            pr = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&retired_lock);
+
+    for (retired *r = to_free; r != NULL; ) {
+        retired *next = r->next;
+        r->free_func(r->ptr);
+        free(r);
+        r = next;
+    }
+}
+
+extern void epochSynchronize(void) {
+    for (;;) {
+        epochReclaim();
+        pthread_mutex_lock(&retired_lock);
+        bool done = (retired_list == NULL);
+        pthread_mutex_unlock(&retired_lock);
+        if (done) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+static void _epochInit(void) {
+#if defined(__linux__) && defined(__NR_membarrier)
+    asymmetric_fences = (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0);
+#else
+    asymmetric_fences = 0;
+#endif
+    int ret = pthread_key_create(&record_key, _epochUnregister);
+    assert(ret == 0);
+    (void)ret;
+}
+
+static epochRecord* _epochRegister(void) {
+    pthread_once(&init_once, _epochInit);
+    pthread_mutex_lock(&records_lock);
+    epochRecord *rec = records;
+    for (; rec != NULL && rec->in_use; ) {
+        rec = rec->next;
+    }
+    if (rec == NULL) {
+        rec = aligned_alloc(CACHE_LINE_SIZE, sizeof(epochRecord));
+        assert(rec != NULL);
+        rec->epoch = 0;
+        rec->nesting = 0;
+        rec->next = records;
+        __atomic_store_n(&records, rec, __ATOMIC_RELEASE);
+    }
+    rec->in_use = true;
+    pthread_mutex_unlock(&records_lock);
+
+    thread_record = rec;
+    pthread_setspecific(record_key, rec);
+    return rec;
+}
+
+// at thread exit; a thread that enters again afterwards (from another
+// destructor) registers again
+static void _epochUnregister(void *arg) {
+    epochRecord *rec = (epochRecord *)arg;
+    // a thread exiting inside a section doesn't hold back reclamation
+    rec->nesting = 0;
+    __atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+    thread_record = NULL;
+
+    pthread_mutex_lock(&records_lock);
+    rec->in_use = false;
+    pthread_mutex_unlock(&records_lock);
+}
+
+// pairs with the compiler barrier of epochEnter when asymmetric fences are on
+static void _epochHeavyFence(void) {
+#if defined(__linux__) && defined(__NR_membarrier)
+    if (asymmetric_fences) {
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        return;
+    }
+#endif
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
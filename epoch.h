@@ -0,0 +1,21 @@
+// Epoch-based reclamation, for data structures whose readers don't lock.
+// Readers wrap their accesses in epochEnter/epochExit, writers unlink an
+// object and hand it to epochRetire, which frees it once no reader that
+// could have seen it is still inside.
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+// >> external API
+// neither call does an atomic read-modify-write once the thread is known
+// (the first epochEnter of a thread registers it); sections may nest
+extern void epochEnter(void);
+extern void epochExit(void);
+// writer side
+extern void epochRetire(void *ptr, void (*free_func)(void *ptr));
+extern void epochReclaim(void);
+// blocks until every retired object is freed
+extern void epochSynchronize(void);
+// << external API
+
+#endif  // _EPOCH_H_
@@ -0,0 +1,120 @@
+// References:
+// https://github.com/wangyi-fudan/wyhash  (wyhash, final version 4)
+// https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp  (fmix64)
+
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+#include "hash.h"
+
+#define WYP0 0xa0761d6478bd642full
+#define WYP1 0xe7037ed1a0b428dbull
+#define WYP2 0x8ebc6af09c88c6e3ull
+#define WYP3 0x589965cc75374cc3ull
+
+static inline uint64_t _wyMix(uint64_t a, uint64_t b);
+static inline uint64_t _wyRead8(const uint8_t *p);
+static inline uint64_t _wyRead4(const uint8_t *p);
+static inline uint64_t _wyRead3(const uint8_t *p, size_t k);
+static uint64_t _hashSystemSeed(void);
+
+
+uint64_t hashBytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t a, b;
+    seed ^= _wyMix(seed ^ WYP0, WYP1);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (_wyRead4(p) << 32) | _wyRead4(p + ((len >> 3) << 2));
+            b = (_wyRead4(p + len - 4) << 32) | _wyRead4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = _wyRead3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = _wyMix(_wyRead8(p) ^ WYP1, _wyRead8(p + 8) ^ seed);
+                see1 = _wyMix(_wyRead8(p + 16) ^ WYP2, _wyRead8(p + 24) ^ see1);
+                see2 = _wyMix(_wyRead8(p + 32) ^ WYP3, _wyRead8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = _wyMix(_wyRead8(p) ^ WYP1, _wyRead8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = _wyRead8(p + i - 16);
+        b = _wyRead8(p + i - 8);
+    }
+    a ^= WYP1;
+    b ^= seed;
+    // _wyMix without the final fold
+    __uint128_t r = (__uint128_t)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+    return _wyMix(a ^ WYP0 ^ len, b ^ WYP1);
+}
+
+// One system call per thread, the following seeds are a splitmix64
+// sequence from there: dictNew is called for every tiny dict.
+uint64_t hashRandomSeed(void) {
+    static __thread uint64_t state;
+    static __thread int seeded;
+    if (!seeded) {
+        state = _hashSystemSeed();
+        seeded = 1;
+    }
+    state += 0x9e3779b97f4a7c15ull;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// >> internal functions
+static inline uint64_t _wyMix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t _wyRead8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t _wyRead4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// 1 to 3 bytes
+static inline uint64_t _wyRead3(const uint8_t *p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static uint64_t _hashSystemSeed(void) {
+    uint64_t seed = 0;
+#ifdef __linux__
+    if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) == sizeof(seed)) {
+        return seed;
+    }
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    // the address of a stack variable adds ASLR entropy
+    seed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)(uintptr_t)&ts;
+    return hashMix64(seed, WYP2);
+}
+// << internal functions
@@ -0,0 +1,39 @@
+// Seeded hash functions for the hash tables.
+// hashMix64 is a multiply-xorshift finalizer for integer keys, hashBytes a
+// wyhash-style hash for byte strings. Each table draws its own seed with
+// hashRandomSeed, so a key set that collides in one instance (or one run)
+// doesn't collide in the next.
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// >> external API
+// the old unseeded behaviour, strided keys cluster
+static inline uint64_t
+hashIdentity(uint64_t x, uint64_t seed) {
+    (void)seed;
+    return x;
+}
+
+// the murmur3 finalizer (fmix64), every input bit affects every output bit
+static inline uint64_t
+hashMix64(uint64_t x, uint64_t seed) {
+    x ^= seed;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+extern uint64_t hashBytes(const void *data, size_t len, uint64_t seed);
+// from the OS (or from the clock if that fails) once per thread,
+// then from a generator
+extern uint64_t hashRandomSeed(void);
+// << external API
+
+#endif  // _HASH_H_
@@ -10,6 +10,10 @@ static size_t _calcMinSize(size_t used);
 
 
 set *setNew(void) {
+    return setNewWithAllocator(&allocDefault);
+}
+
+set *setNewWithAllocator(const Allocator *alloc) {
     set *s;
 
     s = malloc(sizeof(set));
@@ -18,6 +22,8 @@ set *setNew(void) {
 
     s->fill = 0;
     s->used = 0;
+    s->seed = hashRandomSeed();
+    s->alloc = alloc;
     s->slots = NULL;
     _slotsResize(s);
 
@@ -30,13 +36,14 @@ void setFree(set *s) {
     }
 
     if (s->slots != NULL) {
-        free(s->slots);
+        allocFree(s->alloc, s->slots, _slotsSize(s) * sizeof(setentry));
     }
     free(s);
 }
 
 bool setAdd(set* s, SetKeyType key) {
-    if (s->fill >= _slotsSize(s)) {
+    // keep an empty slot to end every probe sequence
+    if (s->fill * 3 >= _slotsSize(s) * 2) {
         _slotsResize(s);
     }
     size_t pos;
@@ -44,9 +51,11 @@ bool setAdd(set* s, SetKeyType key) {
         return false;
     }
 
-    s->slots[pos].status = 0;
+    if (s->slots[pos].status == SET_SLOT_EMPTY) {
+        ++s->fill;
+    }
+    s->slots[pos].status = SET_SLOT_ACTIVE;
     s->slots[pos].key = key;
-    ++s->fill;
     ++s->used;
     return true;
 }
@@ -66,26 +75,34 @@ bool setHas(set* s, SetKeyType key) {
 }
 
 static bool _setLookup(set *s, SetKeyType key, size_t *pos) {
-    size_t hash = (size_t)key;
+    size_t hash = (size_t)SET_KEY_HASH((uint64_t)key, s->seed);
 
     size_t perturb = hash;
     size_t i = hash & s->mask;
 
-    while (s->slots[i].status >= (char)0) {
-        if (s->slots[i].key == key) {
-            if (pos) *pos = i;
-            return true;
+    // a dummy slot doesn't end the probe sequence, the first one
+    // is where an absent key goes
+    size_t freeslot = SIZE_MAX;
+    while (s->slots[i].status != SET_SLOT_EMPTY) {
+        if (s->slots[i].status == SET_SLOT_ACTIVE) {
+            if (s->slots[i].key == key) {
+                if (pos) *pos = i;
+                return true;
+            }
+        } else if (freeslot == SIZE_MAX) {
+            freeslot = i;
         }
         perturb >>= PERTURB_SHIFT;
         i = (i * 5 + 1 + perturb) & s->mask;
     }
-    if (pos) *pos = i;
+    if (pos) *pos = (freeslot != SIZE_MAX) ? freeslot : i;
     return false;
 }
 
 static size_t _calcMinSize(size_t used) {
+    // the 2/3 load limit of setAdd
     size_t i = SET_MIN_SIZE;
-    while (i <= used) i <<= 1;
+    while (i * 2 <= used * 3) i <<= 1;
     return i;
 }
 
@@ -95,22 +112,25 @@ static void _slotsResize(set *s) {
 
     size_t size = _calcMinSize(s->used);
     s->mask = size - 1;
-    s->slots = malloc(size * sizeof(setentry));
-    memset(s->slots, 0xff, size * sizeof(setentry));
+    bool zeroed;
+    s->slots = allocBytes(s->alloc, size * sizeof(setentry), &zeroed);
+    if (!zeroed) {
+        memset(s->slots, 0, size * sizeof(setentry));
+    }
 
     if (old_slots == NULL) {
         return;
     }
 
     for (setentry *entry = old_slots; entry <= old_slots + old_mask; entry++) {
-        if (entry->status >= 0) {
+        if (entry->status == SET_SLOT_ACTIVE) {
             size_t pos;
             _setLookup(s, entry->key, &pos);
             s->slots[pos] = *entry;
         }
     }
 
-    free(old_slots);
+    allocFree(s->alloc, old_slots, (old_mask + 1) * sizeof(setentry));
     s->fill = s->used;
 }
 
@@ -6,15 +6,22 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include "hash.h"
+#include "alloc.h"
 
 typedef int SetKeyType;
 
 #define SET_MIN_SIZE 8
 
-#define SET_SLOT_EMPTY (-1)
-#define SET_SLOT_DUMMY (-2)
+// empty slots are all zero, so zero-filled memory needs no clearing
+#define SET_SLOT_EMPTY 0
+#define SET_SLOT_ACTIVE 1
+#define SET_SLOT_DUMMY (-1)
 #define PERTURB_SHIFT 5
 
+// hashMix64 | hashIdentity, see hash.h
+#define SET_KEY_HASH hashMix64
+
 typedef struct {
     SetKeyType key;
     char status;
@@ -24,11 +31,14 @@ typedef struct {
     size_t fill;  // Number active and dummy entries
     size_t used;  // Number active entries
     size_t mask;
+    uint64_t seed;  // drawn by setNew
+    const Allocator *alloc;  // of the slots
     setentry *slots;
 } set;
 
 
 set *setNew(void);
+set *setNewWithAllocator(const Allocator *alloc);
 void setFree(set* s);
 bool setAdd(set* s, SetKeyType key);
 bool setDel(set* s, SetKeyType key);
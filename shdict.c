@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include "shdict.h"
+
+#define CACHE_LINE_SIZE 64
+
+// Shards sit on their own cache lines, so that taking the lock of one
+// shard doesn't invalidate the line of its neighbour.
+typedef struct {
+    pthread_rwlock_t lock;
+    Dict *dict;
+} __attribute__ ((aligned (CACHE_LINE_SIZE))) shard;
+
+struct _shardedDict {
+    size_t nshards;  // a power of 2
+    uint8_t log2_nshards;
+    uint64_t seed;  // picks the shard of a key, apart from the seeds of the shards
+    shard *shards;
+};
+
+// >> internal functions
+static size_t _shardIndex(ShardedDict *sd, DictKeyType key);
+static size_t* _groupByShard(ShardedDict *sd, const DictKeyType *keys, size_t n, size_t *order);
+// << internal functions
+
+
+extern ShardedDict* shardedDictNew(size_t nshards) {
+    ShardedDict *sd = malloc(sizeof(ShardedDict));
+    if (sd == NULL)
+        return NULL;
+
+    sd->log2_nshards = 0;
+    for (; ((size_t)1 << sd->log2_nshards) < nshards; ) {
+        sd->log2_nshards++;
+    }
+    sd->nshards = (size_t)1 << sd->log2_nshards;
+    sd->seed = hashRandomSeed();
+    sd->shards = aligned_alloc(CACHE_LINE_SIZE, sd->nshards * sizeof(shard));
+    assert(sd->shards != NULL);
+    for (size_t i = 0; i < sd->nshards; i++) {
+        pthread_rwlock_init(&sd->shards[i].lock, NULL);
+        // Shards never resize incrementally: a rehash step in dictGet
+        // would write under the read lock.
+        sd->shards[i].dict = dictNew();
+    }
+
+    return sd;
+}
+
+extern void shardedDictFree(ShardedDict *sd) {
+    assert(sd != NULL);
+    for (size_t i = 0; i < sd->nshards; i++) {
+        pthread_rwlock_destroy(&sd->shards[i].lock);
+        dictFree(sd->shards[i].dict);
+    }
+    free(sd->shards);
+    free(sd);
+}
+
+// the key must exist, like dictGet
+extern DictValueType shardedDictGet(ShardedDict *sd, DictKeyType key) {
+    DictValueType value;
+    bool found = shardedDictTryGet(sd, key, &value);
+    assert(found);
+    return value;
+}
+
+extern bool shardedDictTryGet(ShardedDict *sd, DictKeyType key, DictValueType *value) {
+    shard *sh = &sd->shards[_shardIndex(sd, key)];
+    bool found;
+    pthread_rwlock_rdlock(&sh->lock);
+    found = (dictGetMany(sh->dict, &key, 1, value, NULL) == 1);
+    pthread_rwlock_unlock(&sh->lock);
+    return found;
+}
+
+extern void shardedDictSet(ShardedDict *sd, DictKeyType key, DictValueType value) {
+    shard *sh = &sd->shards[_shardIndex(sd, key)];
+    pthread_rwlock_wrlock(&sh->lock);
+    dictSet(sh->dict, key, value);
+    pthread_rwlock_unlock(&sh->lock);
+}
+
+extern int shardedDictHas(ShardedDict *sd, DictKeyType key) {
+    shard *sh = &sd->shards[_shardIndex(sd, key)];
+    pthread_rwlock_rdlock(&sh->lock);
+    int ret = dictHas(sh->dict, key);
+    pthread_rwlock_unlock(&sh->lock);
+    return ret;
+}
+
+extern int shardedDictDel(ShardedDict *sd, DictKeyType key) {
+    shard *sh = &sd->shards[_shardIndex(sd, key)];
+    pthread_rwlock_wrlock(&sh->lock);
+    int ret = dictDel(sh->dict, key);
+    pthread_rwlock_unlock(&sh->lock);
+    return ret;
+}
+
+// not a snapshot: the shards are counted one after another
+extern size_t shardedDictLen(ShardedDict *sd) {
+    size_t len = 0;
+    for (size_t i = 0; i < sd->nshards; i++) {
+        pthread_rwlock_rdlock(&sd->shards[i].lock);
+        len += dictLen(sd->shards[i].dict);
+        pthread_rwlock_unlock(&sd->shards[i].lock);
+    }
+    return len;
+}
+
+extern size_t shardedDictGetMany(ShardedDict *sd, const DictKeyType *keys, size_t n,
+                                 DictValueType *values, bool *found) {
+    size_t *order = malloc(n * sizeof(size_t));
+    DictKeyType *shard_keys = malloc(n * sizeof(DictKeyType));
+    DictValueType *shard_values = malloc(n * sizeof(DictValueType));
+    bool *shard_found = malloc(n * sizeof(bool));
+    size_t *starts = _groupByShard(sd, keys, n, order);
+    for (size_t j = 0; j < n; j++) {
+        shard_keys[j] = keys[order[j]];
+    }
+
+    size_t nfound = 0;
+    for (size_t i = 0; i < sd->nshards; i++) {
+        size_t begin = starts[i], end = starts[i + 1];
+        if (begin == end) {
+            continue;
+        }
+        pthread_rwlock_rdlock(&sd->shards[i].lock);
+        nfound += dictGetMany(sd->shards[i].dict, &shard_keys[begin], end - begin,
+                              &shard_values[begin], &shard_found[begin]);
+        pthread_rwlock_unlock(&sd->shards[i].lock);
+    }
+    for (size_t j = 0; j < n; j++) {
+        if (shard_found[j]) {
+            values[order[j]] = shard_values[j];
+        }
+        if (found != NULL) {
+            found[order[j]] = shard_found[j];
+        }
+    }
+
+    free(starts);
+    free(shard_found);
+    free(shard_values);
+    free(shard_keys);
+    free(order);
+    return nfound;
+}
+
+extern size_t shardedDictHasMany(ShardedDict *sd, const DictKeyType *keys, size_t n, bool *found) {
+    size_t *order = malloc(n * sizeof(size_t));
+    DictKeyType *shard_keys = malloc(n * sizeof(DictKeyType));
+    bool *shard_found = malloc(n * sizeof(bool));
+    size_t *starts = _groupByShard(sd, keys, n, order);
+    for (size_t j = 0; j < n; j++) {
+        shard_keys[j] = keys[order[j]];
+    }
+
+    size_t nfound = 0;
+    for (size_t i = 0; i < sd->nshards; i++) {
+        size_t begin = starts[i], end = starts[i + 1];
+        if (begin == end) {
+            continue;
+        }
+        pthread_rwlock_rdlock(&sd->shards[i].lock);
+        nfound += dictHasMany(sd->shards[i].dict, &shard_keys[begin], end - begin,
+                              &shard_found[begin]);
+        pthread_rwlock_unlock(&sd->shards[i].lock);
+    }
+    if (found != NULL) {
+        for (size_t j = 0; j < n; j++) {
+            found[order[j]] = shard_found[j];
+        }
+    }
+
+    free(starts);
+    free(shard_found);
+    free(shard_keys);
+    free(order);
+    return nfound;
+}
+
+// pairs are applied in order within a shard, so the last value of a key wins
+extern void shardedDictSetMany(ShardedDict *sd, const DictKeyType *keys,
+                               const DictValueType *values, size_t n) {
+    size_t *order = malloc(n * sizeof(size_t));
+    DictKeyType *shard_keys = malloc(n * sizeof(DictKeyType));
+    DictValueType *shard_values = malloc(n * sizeof(DictValueType));
+    size_t *starts = _groupByShard(sd, keys, n, order);
+    for (size_t j = 0; j < n; j++) {
+        shard_keys[j] = keys[order[j]];
+        shard_values[j] = values[order[j]];
+    }
+
+    for (size_t i = 0; i < sd->nshards; i++) {
+        size_t begin = starts[i], end = starts[i + 1];
+        if (begin == end) {
+            continue;
+        }
+        pthread_rwlock_wrlock(&sd->shards[i].lock);
+        dictSetMany(sd->shards[i].dict, &shard_keys[begin], &shard_values[begin], end - begin);
+        pthread_rwlock_unlock(&sd->shards[i].lock);
+    }
+
+    free(starts);
+    free(shard_values);
+    free(shard_keys);
+    free(order);
+}
+
+// The shard comes from the high bits of the hash, after a fibonacci
+// multiplication: the identity hash of int keys has no high bits.
+// The hash is our own, not one of a shard: the keys of a shard are only
+// read under its lock, and they go away when it resizes.
+static size_t _shardIndex(ShardedDict *sd, DictKeyType key) {
+    if (sd->log2_nshards == 0) {
+        return 0;
+    }
+    hash_t hash = DICT_KEY_HASH((uint64_t)key, sd->seed) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(hash >> (64 - sd->log2_nshards));
+}
+
+// A stable counting sort of the keys by shard: order[] receives the
+// positions of the keys grouped by shard, and the returned array
+// (nshards + 1 items, to be freed) where each group starts.
+static size_t* _groupByShard(ShardedDict *sd, const DictKeyType *keys, size_t n, size_t *order) {
+    size_t *starts = calloc(sd->nshards + 1, sizeof(size_t));
+    size_t *shard_ix = malloc(n * sizeof(size_t));
+    for (size_t j = 0; j < n; j++) {
+        shard_ix[j] = _shardIndex(sd, keys[j]);
+        starts[shard_ix[j] + 1]++;
+    }
+    for (size_t i = 0; i < sd->nshards; i++) {
+        starts[i + 1] += starts[i];
+    }
+    size_t *next = malloc(sd->nshards * sizeof(size_t));
+    for (size_t i = 0; i < sd->nshards; i++) {
+        next[i] = starts[i];
+    }
+    for (size_t j = 0; j < n; j++) {
+        order[next[shard_ix[j]]++] = j;
+    }
+    free(next);
+    free(shard_ix);
+    return starts;
+}
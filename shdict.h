@@ -0,0 +1,30 @@
+// A thread-safe Dict made of independent shards,
+// each one a Dict guarded by its own reader/writer lock.
+
+#ifndef _SHDICT_H_
+#define _SHDICT_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "dict.h"
+
+typedef struct _shardedDict ShardedDict;
+
+// >> external API
+extern ShardedDict* shardedDictNew(size_t nshards);
+extern void shardedDictFree(ShardedDict *sd);
+extern DictValueType shardedDictGet(ShardedDict *sd, DictKeyType key);
+extern bool shardedDictTryGet(ShardedDict *sd, DictKeyType key, DictValueType *value);
+extern void shardedDictSet(ShardedDict *sd, DictKeyType key, DictValueType value);
+extern int shardedDictHas(ShardedDict *sd, DictKeyType key);
+extern int shardedDictDel(ShardedDict *sd, DictKeyType key);
+extern size_t shardedDictLen(ShardedDict *sd);
+// batches take the lock of every shard they touch once
+extern size_t shardedDictGetMany(ShardedDict *sd, const DictKeyType *keys, size_t n,
+                                 DictValueType *values, bool *found);
+extern void shardedDictSetMany(ShardedDict *sd, const DictKeyType *keys,
+                               const DictValueType *values, size_t n);
+extern size_t shardedDictHasMany(ShardedDict *sd, const DictKeyType *keys, size_t n, bool *found);
+// << external API
+
+#endif  // _SHDICT_H_
@@ -0,0 +1,268 @@
+// References:
+// https://github.com/python/cpython/blob/main/Objects/dictobject.c  (unicode_eq, the cached hash of str keys)
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "hash.h"
+#include "strdict.h"
+
+typedef int64_t ix_t;
+
+#define DKIX_EMPTY (-1)
+#define DKIX_DUMMY (-2)
+
+#define USABLE_FRACTION(n) (((n) << 1)/3)
+#define GROWTH_RATE(sd)    ((sd)->used*3)
+#define PERTURB_SHIFT 5
+
+// marks a deleted entry, _strDictHash never returns it
+#define ENTRY_HASH_DELETED ((hash_t)-1)
+
+typedef struct {
+    hash_t hash;
+    uint32_t len;
+    union {
+        char *ptr;  // len > STRDICT_INLINE_LEN
+        char buf[STRDICT_INLINE_LEN];
+    } key;
+    DictValueType value;
+} strEntry;
+
+struct _strDict {
+    size_t used;
+    hash_t seed;
+    uint8_t log2_size;
+    uint8_t index_bytes;
+    size_t usable;
+    size_t nentries;  // used + deleted
+    // index_bytes << log2_size bytes of indices, then the entries
+    char *indices;
+    strEntry *entries;
+};
+
+// >> internal functions
+static hash_t _strDictHash(StrDict *sd, const char *key, size_t len);
+static ix_t _strDictLookup(StrDict *sd, const char *key, size_t len, hash_t hash, size_t *slot);
+static ix_t _strDictGetIndex(StrDict *sd, size_t i);
+static void _strDictSetIndex(StrDict *sd, size_t i, ix_t ix);
+static void _strDictResize(StrDict *sd, size_t minsize);
+static inline const char* _strEntryKey(const strEntry *ep);
+// << internal functions
+
+
+extern StrDict* strDictNew(void) {
+    StrDict *sd = malloc(sizeof(StrDict));
+    if (sd == NULL)
+        return NULL;
+
+    sd->used = 0;
+    sd->seed = hashRandomSeed();
+    sd->indices = NULL;
+    sd->entries = NULL;
+    _strDictResize(sd, 1);
+    return sd;
+}
+
+extern void strDictFree(StrDict *sd) {
+    assert(sd != NULL);
+    for (size_t i = 0; i < sd->nentries; i++) {
+        strEntry *ep = &sd->entries[i];
+        if (ep->hash != ENTRY_HASH_DELETED && ep->len > STRDICT_INLINE_LEN) {
+            free(ep->key.ptr);
+        }
+    }
+    free(sd->indices);
+    free(sd);
+}
+
+extern int strDictGet(StrDict *sd, const char *key, size_t len, DictValueType *value) {
+    size_t slot;
+    ix_t ix = _strDictLookup(sd, key, len, _strDictHash(sd, key, len), &slot);
+    if (ix < 0) {
+        return -1;
+    }
+    *value = sd->entries[ix].value;
+    return 0;
+}
+
+extern bool strDictHas(StrDict *sd, const char *key, size_t len) {
+    size_t slot;
+    return _strDictLookup(sd, key, len, _strDictHash(sd, key, len), &slot) >= 0;
+}
+
+extern void strDictSet(StrDict *sd, const char *key, size_t len, DictValueType value) {
+    *strDictGetOrInsert(sd, key, len, value, NULL) = value;
+}
+
+extern DictValueType* strDictGetOrInsert(StrDict *sd, const char *key, size_t len,
+                                         DictValueType dflt, bool *inserted) {
+    assert(len <= UINT32_MAX);
+    if (sd->usable == 0) {
+        _strDictResize(sd, GROWTH_RATE(sd));
+    }
+    hash_t hash = _strDictHash(sd, key, len);
+    size_t slot;
+    ix_t ix = _strDictLookup(sd, key, len, hash, &slot);
+    if (inserted != NULL) {
+        *inserted = (ix < 0);
+    }
+    if (ix >= 0) {
+        return &sd->entries[ix].value;
+    }
+
+    // the key is copied only now
+    strEntry *ep = &sd->entries[sd->nentries];
+    ep->hash = hash;
+    ep->len = (uint32_t)len;
+    if (len > STRDICT_INLINE_LEN) {
+        ep->key.ptr = malloc(len);
+        assert(ep->key.ptr != NULL);
+        memcpy(ep->key.ptr, key, len);
+    } else {
+        memcpy(ep->key.buf, key, len);
+    }
+    ep->value = dflt;
+    _strDictSetIndex(sd, slot, sd->nentries);
+    sd->nentries++;
+    sd->usable--;
+    sd->used++;
+    return &ep->value;
+}
+
+extern int strDictDel(StrDict *sd, const char *key, size_t len) {
+    size_t slot;
+    ix_t ix = _strDictLookup(sd, key, len, _strDictHash(sd, key, len), &slot);
+    if (ix < 0) {
+        return -1;
+    }
+    strEntry *ep = &sd->entries[ix];
+    if (ep->len > STRDICT_INLINE_LEN) {
+        free(ep->key.ptr);
+    }
+    ep->hash = ENTRY_HASH_DELETED;
+    _strDictSetIndex(sd, slot, DKIX_DUMMY);
+    sd->used--;
+    return 0;
+}
+
+extern size_t strDictLen(StrDict *sd) {
+    return sd->used;
+}
+
+extern bool strDictIterNext(StrDictIter *iter, const char **key, size_t *len, DictValueType *value) {
+    StrDict *sd = iter->sd;
+    for (; iter->pos < sd->nentries; iter->pos++) {
+        strEntry *ep = &sd->entries[iter->pos];
+        if (ep->hash != ENTRY_HASH_DELETED) {
+            *key = _strEntryKey(ep);
+            *len = ep->len;
+            *value = ep->value;
+            iter->pos++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static hash_t _strDictHash(StrDict *sd, const char *key, size_t len) {
+    hash_t hash = hashBytes(key, len, sd->seed);
+    return (hash == ENTRY_HASH_DELETED) ? hash - 1 : hash;
+}
+
+static inline const char* _strEntryKey(const strEntry *ep) {
+    return (ep->len > STRDICT_INLINE_LEN) ? ep->key.ptr : ep->key.buf;
+}
+
+// Like _DictKeys_LookupSlot: *slot is the slot of the key,
+// or the first free one of its probe sequence.
+// The cached hash and the length are compared before the bytes.
+static ix_t _strDictLookup(StrDict *sd, const char *key, size_t len, hash_t hash, size_t *slot) {
+    size_t mask = ((size_t)1 << sd->log2_size) - 1;
+    size_t perturb = (size_t)hash;
+    size_t i = (size_t)hash & mask;
+    size_t free_slot = SIZE_MAX;
+    for (; ; ) {
+        ix_t ix = _strDictGetIndex(sd, i);
+        if (ix >= 0) {
+            strEntry *ep = &sd->entries[ix];
+            if (ep->hash == hash && ep->len == len
+                    && memcmp(_strEntryKey(ep), key, len) == 0) {
+                *slot = i;
+                return ix;
+            }
+        } else if (ix == DKIX_EMPTY) {
+            *slot = (free_slot != SIZE_MAX) ? free_slot : i;
+            return ix;
+        } else if (free_slot == SIZE_MAX) {
+            free_slot = i;
+        }
+        perturb >>= PERTURB_SHIFT;
+        i = (i * 5 + perturb + 1) & mask;
+    }
+}
+
+static ix_t _strDictGetIndex(StrDict *sd, size_t i) {
+    switch (sd->index_bytes) {
+    case 1: return ((int8_t *)sd->indices)[i];
+    case 2: return ((int16_t *)sd->indices)[i];
+    case 4: return ((int32_t *)sd->indices)[i];
+    default: return ((int64_t *)sd->indices)[i];
+    }
+}
+
+static void _strDictSetIndex(StrDict *sd, size_t i, ix_t ix) {
+    switch (sd->index_bytes) {
+    case 1: ((int8_t *)sd->indices)[i] = (int8_t)ix; break;
+    case 2: ((int16_t *)sd->indices)[i] = (int16_t)ix; break;
+    case 4: ((int32_t *)sd->indices)[i] = (int32_t)ix; break;
+    default: ((int64_t *)sd->indices)[i] = ix; break;
+    }
+}
+
+// Rebuild into a table of at least minsize slots, which drops the
+// deleted entries. The keys move with their entries, no copies.
+static void _strDictResize(StrDict *sd, size_t minsize) {
+    uint8_t log2_size = STRDICT_LOG_MINSIZE;
+    for (; ((size_t)1 << log2_size) < minsize; ) {
+        log2_size++;
+    }
+    uint8_t index_bytes = (log2_size < 8) ? 1 : (log2_size < 16) ? 2 : (log2_size < 32) ? 4 : 8;
+    size_t size = (size_t)1 << log2_size;
+    size_t usable = USABLE_FRACTION(size);
+    size_t index_size = ((index_bytes * size + sizeof(strEntry) - 1) / sizeof(strEntry)) * sizeof(strEntry);
+    char *indices = malloc(index_size + usable * sizeof(strEntry));
+    assert(indices != NULL);
+    memset(indices, 0xff, index_bytes * size);  // DKIX_EMPTY
+    strEntry *entries = (strEntry *)&indices[index_size];
+
+    char *old_indices = sd->indices;
+    strEntry *old_entries = sd->entries;
+    size_t old_nentries = (old_indices != NULL) ? sd->nentries : 0;
+
+    sd->log2_size = log2_size;
+    sd->index_bytes = index_bytes;
+    sd->indices = indices;
+    sd->entries = entries;
+    size_t mask = size - 1;
+    size_t n = 0;
+    for (size_t j = 0; j < old_nentries; j++) {
+        strEntry *ep = &old_entries[j];
+        if (ep->hash == ENTRY_HASH_DELETED) {
+            continue;
+        }
+        size_t perturb = (size_t)ep->hash;
+        size_t i = (size_t)ep->hash & mask;
+        for (; _strDictGetIndex(sd, i) != DKIX_EMPTY; ) {
+            perturb >>= PERTURB_SHIFT;
+            i = (i * 5 + perturb + 1) & mask;
+        }
+        entries[n] = *ep;
+        _strDictSetIndex(sd, i, n);
+        n++;
+    }
+    assert(n == sd->used);
+    sd->nentries = n;
+    sd->usable = usable - n;
+    free(old_indices);
+}
@@ -0,0 +1,45 @@
+// A Dict keyed by byte strings, laid out like the combined Dict:
+// indices + insertion ordered entries. Entries keep the hash and length
+// of their key next to it, keys of up to STRDICT_INLINE_LEN bytes are
+// stored in the entry itself. Lookups take borrowed (pointer, length)
+// keys and never allocate; a key is copied only when inserted.
+
+#ifndef _STRDICT_H_
+#define _STRDICT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "dict.h"
+
+// >> settings
+#define STRDICT_LOG_MINSIZE 3
+// longest key stored without an allocation
+#define STRDICT_INLINE_LEN 16
+// << settings
+
+typedef struct _strDict StrDict;
+
+typedef struct {
+    StrDict *sd;
+    size_t pos;
+} StrDictIter;
+
+// >> external API
+extern StrDict* strDictNew(void);
+extern void strDictFree(StrDict *sd);
+// returns -1 if key is absent
+extern int strDictGet(StrDict *sd, const char *key, size_t len, DictValueType *value);
+extern bool strDictHas(StrDict *sd, const char *key, size_t len);
+extern void strDictSet(StrDict *sd, const char *key, size_t len, DictValueType value);
+// valid until sd is changed again, see dictGetOrInsert
+extern DictValueType* strDictGetOrInsert(StrDict *sd, const char *key, size_t len,
+                                         DictValueType dflt, bool *inserted);
+// returns -1 if key is absent
+extern int strDictDel(StrDict *sd, const char *key, size_t len);
+extern size_t strDictLen(StrDict *sd);
+// *key points into sd, valid until sd is changed
+extern bool strDictIterNext(StrDictIter *iter, const char **key, size_t *len, DictValueType *value);
+// << external API
+
+#endif  // _STRDICT_H_
@@ -0,0 +1,70 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "btree.h"
+
+// Node size sweep. Build with -DCMAKE_BUILD_TYPE=Release and compare with
+// btree_bench_binary, the same benchmark built with BTREE_BINARY_SEARCH.
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static btreeKeyType randKey(uint64_t *state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (btreeKeyType)*state;
+}
+
+static void bench(size_t order, size_t nkeys, size_t nops) {
+    btreeKeyType *keys = malloc(nkeys * sizeof(btreeKeyType));
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < nkeys; i++) {
+        keys[i] = randKey(&state);
+    }
+
+    btree *tree = btreeNewWithOrder(order);
+    double t0 = now();
+    for (size_t i = 0; i < nkeys; i++) {
+        btreeSet(tree, keys[i]);
+    }
+    double t_insert = (now() - t0) / nkeys;
+
+    size_t hits = 0;
+    t0 = now();
+    for (size_t i = 0; i < nops; i++) {
+        hits += btreeHas(tree, keys[(i * 7919) % nkeys]);
+    }
+    double t_hit = (now() - t0) / nops;
+
+    t0 = now();
+    for (size_t i = 0; i < nops; i++) {
+        hits += btreeHas(tree, randKey(&state));
+    }
+    double t_miss = (now() - t0) / nops;
+
+    printf("order %5zu, %8zu keys: insert %6.1f ns, hit %6.1f ns, miss %6.1f ns (%zu)\n",
+           order, nkeys, t_insert * 1e9, t_hit * 1e9, t_miss * 1e9, hits);
+
+    btreeFree(tree);
+    free(keys);
+}
+
+int main(void) {
+    size_t orders[] = {8, 16, 32, 64, 128, 256, 400, 512, 1024, 2048};
+    for (size_t i = 0; i < sizeof(orders) / sizeof(orders[0]); i++) {
+        bench(orders[i], 10000, 10000000);
+    }
+    for (size_t i = 0; i < sizeof(orders) / sizeof(orders[0]); i++) {
+        bench(orders[i], 4000000, 10000000);
+    }
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "dict.h"
+
+// Build with -DCMAKE_BUILD_TYPE=Release and compare with dict_bench_generic,
+// the same benchmark linked against the unspecialized probe routines,
+// or with dict_bench_compact, built with DICT_COMPACT_ENTRIES.
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static DictKeyType randKey(uint64_t *state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (DictKeyType)*state;
+}
+
+// with freeze, the lookups go to the dict made read only by dictFreeze;
+// the tables come from alloc
+static void bench(size_t nkeys, size_t nops, bool freeze, const Allocator *alloc) {
+    DictKeyType *keys = malloc(nkeys * sizeof(DictKeyType));
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < nkeys; i++) {
+        keys[i] = randKey(&state);
+    }
+
+    double t0 = now();
+    size_t nrounds = nops / nkeys + 1;
+    Dict *d = NULL;
+    for (size_t r = 0; r < nrounds; r++) {
+        if (d != NULL) {
+            dictFree(d);
+        }
+        d = dictNew();
+        dictSetAllocator(d, alloc);
+        for (size_t i = 0; i < nkeys; i++) {
+            dictSet(d, keys[i], (DictValueType)i);
+        }
+    }
+    double t_insert = (now() - t0) / (nrounds * nkeys);
+    char layout[48];
+    snprintf(layout, sizeof(layout), "%zu-byte indices%s", (size_t)d->keys->dk_index_bytes,
+             alloc == &allocHugePages ? ", 2MB pages" : "");
+    if (freeze) {
+        t0 = now();
+        dictFreeze(d);
+        snprintf(layout, sizeof(layout), "frozen in %.0f ms", (now() - t0) * 1e3);
+    }
+
+    size_t hits = 0;
+    t0 = now();
+    for (size_t i = 0; i < nops; i++) {
+        hits += dictHas(d, keys[(i * 7919) % nkeys]);
+    }
+    double t_hit = (now() - t0) / nops;
+
+    t0 = now();
+    for (size_t i = 0; i < nops; i++) {
+        hits += dictHas(d, randKey(&state));
+    }
+    double t_miss = (now() - t0) / nops;
+
+    printf("%10zu keys, %s: insert %6.1f ns, hit %6.1f ns, miss %6.1f ns (%zu)\n",
+           nkeys, layout,
+           t_insert * 1e9, t_hit * 1e9, t_miss * 1e9, hits);
+
+    dictFree(d);
+    free(keys);
+}
+
+// short-lived dicts: create, fill, read back, free
+static void benchTiny(size_t nkeys, size_t ndicts) {
+    size_t hits = 0;
+    double t0 = now();
+    for (size_t r = 0; r < ndicts; r++) {
+        Dict *d = dictNew();
+        for (size_t i = 0; i < nkeys; i++) {
+            dictSet(d, (DictKeyType)(r + i * 3), (DictValueType)i);
+        }
+        for (size_t i = 0; i < nkeys; i++) {
+            hits += dictHas(d, (DictKeyType)(r + i * 3));
+        }
+        dictFree(d);
+    }
+    printf("%10zu keys, %-11s: %6.1f ns per dict (%zu)\n",
+           nkeys, nkeys <= DICT_SMALL_SIZE ? "inline" : "keys object",
+           (now() - t0) / ndicts * 1e9, hits);
+}
+
+// dictNewFromArrays over the same arrays with several thread counts
+static void benchBuild(size_t nkeys, size_t nthreads) {
+    DictKeyType *keys = malloc(nkeys * sizeof(DictKeyType));
+    DictValueType *values = malloc(nkeys * sizeof(DictValueType));
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < nkeys; i++) {
+        keys[i] = randKey(&state);
+        values[i] = (DictValueType)i;
+    }
+
+    double t0 = now();
+    Dict *d = dictNewFromArrays(keys, values, nkeys, nthreads);
+    printf("%10zu keys, %zu threads: build %6.1f ns per key (%zu)\n",
+           nkeys, nthreads, (now() - t0) / nkeys * 1e9, dictLen(d));
+
+    dictFree(d);
+    free(keys);
+    free(values);
+}
+
+// summing the values with dictIterNext and with dictSumValues
+static void benchScan(size_t nkeys, uint8_t kind, size_t nrounds) {
+    Dict *d = dictNewKind(kind);
+    for (size_t i = 0; i < nkeys; i++) {
+        dictSet(d, (DictKeyType)i, (DictValueType)i);
+    }
+    for (size_t i = 0; i < nkeys; i += 10) {
+        dictDel(d, (DictKeyType)i);
+    }
+
+    int64_t sum = 0;
+    double t0 = now();
+    for (size_t r = 0; r < nrounds; r++) {
+        DictIter it = {d, 0};
+        DictKeyType key;
+        DictValueType value;
+        while (dictIterNext(&it, &key, &value)) {
+            sum += value;
+        }
+    }
+    double t_iter = (now() - t0) / (nrounds * nkeys);
+
+    t0 = now();
+    for (size_t r = 0; r < nrounds; r++) {
+        sum -= dictSumValues(d);
+    }
+    double t_sum = (now() - t0) / (nrounds * nkeys);
+
+    printf("%10zu keys, %-8s: iterate %5.2f ns, dictSumValues %5.2f ns per key (%lld)\n",
+           nkeys, kind == DICT_KIND_SWISS ? "swiss" : "combined",
+           t_iter * 1e9, t_sum * 1e9, (long long)sum);
+    dictFree(d);
+}
+
+int main(void) {
+    printf("%zu-byte entries\n", sizeof(DictKeyEntry));
+    bench(50, 10000000, false, &allocDefault);
+    bench(10000, 10000000, false, &allocDefault);
+    bench(1000000, 10000000, false, &allocDefault);
+    bench(10000, 10000000, true, &allocDefault);
+    bench(1000000, 10000000, true, &allocDefault);
+    bench(16000000, 10000000, false, &allocDefault);
+    bench(16000000, 10000000, false, &allocHugePages);
+    benchTiny(2, 2000000);
+    benchTiny(DICT_SMALL_SIZE, 2000000);
+    benchTiny(2 * DICT_SMALL_SIZE, 2000000);
+    benchBuild(4000000, 1);
+    benchBuild(4000000, 4);
+    benchScan(10000, DICT_KIND_COMBINED, 2000);
+    benchScan(4000000, DICT_KIND_COMBINED, 10);
+    benchScan(4000000, DICT_KIND_SWISS, 10);
+
+    return 0;
+}
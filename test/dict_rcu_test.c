@@ -0,0 +1,68 @@
+#include "dict.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define NREADERS 4
+#define NKEYS 10000
+#define NCOMMITS 200
+
+
+static Dict *d;
+static int done = 0;
+
+// every commit sets all the keys to the same value,
+// so a reader must never see two different values within one section
+static void *reader(void *arg) {
+    (void)arg;
+    size_t nreads = 0;
+    while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+        dictRcuReadBegin(d);
+        DictValueType first = dictGet(d, 0);
+        for (int i = 1; i < NKEYS; i++) {
+            assert(dictGet(d, i) == first);
+        }
+        dictRcuReadEnd();
+        nreads++;
+        assert(first >= 0 && first < NCOMMITS);
+    }
+    return (void *)nreads;
+}
+
+void test1(void) {
+    printf("[dict-rcu] test-1\n");
+    d = dictNew();
+    for (int i = 0; i < NKEYS; i++) {
+        dictSet(d, i, 0);
+    }
+
+    pthread_t threads[NREADERS];
+    for (size_t t = 0; t < NREADERS; t++) {
+        pthread_create(&threads[t], NULL, reader, NULL);
+    }
+    for (int c = 1; c < NCOMMITS; c++) {
+        Dict *w = dictRcuWriteBegin(d);
+        for (int i = 0; i < NKEYS; i++) {
+            dictSet(w, i, c);
+        }
+        // grow the table now and then, it is still a single publish
+        dictSet(w, NKEYS + c, c);
+        dictRcuWriteCommit(d, w);
+    }
+    __atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+    for (size_t t = 0; t < NREADERS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    assert(dictGet(d, NKEYS - 1) == NCOMMITS - 1);
+    assert(dictLen(d) == NKEYS + NCOMMITS - 1);
+    dictFree(d);
+}
+
+
+int main(void) {
+    test1();
+
+    printf("ok");
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "hash.h"
+#include "dict.h"
+
+// Probe lengths of the cpython-style open addressing used by Dict
+// (DICT_KIND_COMBINED) and set, per key distribution and hash function,
+// followed by the lookup time of a real Dict built with DICT_KEY_HASH.
+
+#define NKEYS (1 << 16)
+#define PERTURB_SHIFT 5
+
+typedef uint64_t (*hashFunc)(uint64_t x, uint64_t seed);
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void makeKeys(int *keys, const char *dist) {
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < NKEYS; i++) {
+        if (strcmp(dist, "sequential") == 0) {
+            keys[i] = (int)i;
+        } else if (strcmp(dist, "stride 64") == 0) {
+            keys[i] = (int)(i * 64);
+        } else if (strcmp(dist, "stride 1024") == 0) {
+            keys[i] = (int)(i * 1024);
+        } else if (strcmp(dist, "stride 32768") == 0) {
+            keys[i] = (int)(i * 32768);
+        } else {
+            // xorshift64, may repeat a key, which only shortens the probes
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            keys[i] = (int)state;
+        }
+    }
+}
+
+// slots probed by a successful lookup, averaged over the keys and maximum
+static void probeLengths(const uint64_t *hashes, size_t n, double *avg, size_t *max) {
+    size_t size = 8;
+    while (size * 2 < n * 3) {
+        // USABLE_FRACTION(size) = 2/3 * size
+        size <<= 1;
+    }
+    size_t mask = size - 1;
+    char *full = calloc(size, 1);
+    size_t total = 0;
+    *max = 0;
+    for (size_t k = 0; k < n; k++) {
+        size_t perturb = hashes[k];
+        size_t i = hashes[k] & mask;
+        size_t probes = 1;
+        while (full[i]) {
+            perturb >>= PERTURB_SHIFT;
+            i = (i * 5 + perturb + 1) & mask;
+            probes++;
+        }
+        full[i] = 1;
+        total += probes;
+        if (probes > *max) {
+            *max = probes;
+        }
+    }
+    *avg = (double)total / n;
+    free(full);
+}
+
+static double lookupTime(const int *keys, uint8_t kind) {
+    Dict *d = dictNewKind(kind);
+    for (size_t i = 0; i < NKEYS; i++) {
+        dictSet(d, keys[i], (int)i);
+    }
+    size_t nops = 1 << 22;
+    size_t hits = 0;
+    double t0 = now();
+    for (size_t i = 0; i < nops; i++) {
+        hits += dictHas(d, keys[(i * 7919) % NKEYS]);
+    }
+    double t = (now() - t0) / nops * 1e9;
+    dictFree(d);
+    return hits ? t : 0;
+}
+
+int main(void) {
+    const char *dists[] = {"sequential", "stride 64", "stride 1024", "stride 32768", "random"};
+    const char *names[] = {"identity", "mix64"};
+    hashFunc funcs[] = {hashIdentity, hashMix64};
+    uint64_t seed = hashRandomSeed();
+    int *keys = malloc(NKEYS * sizeof(int));
+    uint64_t *hashes = malloc(NKEYS * sizeof(uint64_t));
+
+    printf("%d keys\n", NKEYS);
+    printf("%-14s %-10s %8s %6s\n", "distribution", "hash", "avg", "max");
+    for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d++) {
+        makeKeys(keys, dists[d]);
+        for (size_t f = 0; f < 2; f++) {
+            for (size_t i = 0; i < NKEYS; i++) {
+                hashes[i] = funcs[f]((uint64_t)keys[i], seed);
+            }
+            double avg;
+            size_t max;
+            probeLengths(hashes, NKEYS, &avg, &max);
+            printf("%-14s %-10s %8.2f %6zu\n", dists[d], names[f], avg, max);
+        }
+    }
+
+    // byte keys, "key:<n>"
+    char buf[32];
+    for (size_t i = 0; i < NKEYS; i++) {
+        int len = snprintf(buf, sizeof(buf), "key:%zu", i);
+        hashes[i] = hashBytes(buf, (size_t)len, seed);
+    }
+    double avg;
+    size_t max;
+    probeLengths(hashes, NKEYS, &avg, &max);
+    printf("%-14s %-10s %8.2f %6zu\n", "strings", "bytes", avg, max);
+
+    printf("\nDict lookups with DICT_KEY_HASH\n");
+    for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d++) {
+        makeKeys(keys, dists[d]);
+        printf("%-14s combined %6.1f ns, swiss %6.1f ns\n", dists[d],
+               lookupTime(keys, DICT_KIND_COMBINED), lookupTime(keys, DICT_KIND_SWISS));
+    }
+
+    free(keys);
+    free(hashes);
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include "set.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdint.h>
 
 
 void test1(void) {
@@ -33,10 +34,51 @@ void test2(void) {
     setFree(s);
 }
 
+// counts the live bytes in its context
+static void *countingAlloc(void *ctx, size_t nbytes, bool *zeroed) {
+    *(size_t *)ctx += nbytes;
+    return allocDefault.alloc(NULL, nbytes, zeroed);
+}
+
+static void *countingRealloc(void *ctx, void *p, size_t old_nbytes, size_t nbytes) {
+    *(size_t *)ctx += nbytes - old_nbytes;
+    return allocDefault.realloc(NULL, p, old_nbytes, nbytes);
+}
+
+static void countingFree(void *ctx, void *p, size_t nbytes) {
+    *(size_t *)ctx -= nbytes;
+    allocDefault.free(NULL, p, nbytes);
+}
+
+void test3(void) {
+    printf("[set] test-3\n");
+    size_t live = 0;
+    Allocator counting = {countingAlloc, countingRealloc, countingFree, &live};
+    set *s = setNewWithAllocator(&counting);
+    for (int i = 0; i < 1000; i++) {
+        setAdd(s, i);
+    }
+    assert(live == (s->mask + 1) * sizeof(setentry));
+    setFree(s);
+    assert(live == 0);
+
+    // big enough for mapped huge pages
+    s = setNewWithAllocator(&allocHugePages);
+    for (int i = 0; i < 1000000; i++) {
+        setAdd(s, i * 7);
+    }
+    assert((uintptr_t)s->slots % ALLOC_HUGE_PAGE_SIZE == 0);
+    for (int i = 0; i < 1000000; i++) {
+        assert(setHas(s, i * 7) && !setHas(s, i * 7 + 1));
+    }
+    setFree(s);
+}
+
 
 int main(void) {
     test1();
     test2();
+    test3();
 
     printf("ok");
     return 0;
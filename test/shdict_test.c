@@ -0,0 +1,121 @@
+#include "shdict.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define NTHREADS 8
+#define NKEYS_PER_THREAD 100000
+
+
+static ShardedDict *sd;
+
+static void *worker(void *arg) {
+    int base = (int)(size_t)arg * NKEYS_PER_THREAD;
+    for (int i = base; i < base + NKEYS_PER_THREAD; i++) {
+        shardedDictSet(sd, i, i * 2);
+    }
+    for (int i = base; i < base + NKEYS_PER_THREAD; i++) {
+        assert(shardedDictGet(sd, i) == i * 2);
+        if (i % 2) {
+            shardedDictDel(sd, i);
+        }
+    }
+    return NULL;
+}
+
+void test1(void) {
+    printf("[shdict] test-1\n");
+    sd = shardedDictNew(16);
+
+    pthread_t threads[NTHREADS];
+    for (size_t t = 0; t < NTHREADS; t++) {
+        pthread_create(&threads[t], NULL, worker, (void *)t);
+    }
+    for (size_t t = 0; t < NTHREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    assert(shardedDictLen(sd) == NTHREADS * NKEYS_PER_THREAD / 2);
+    assert(shardedDictHas(sd, 0));
+    assert(!shardedDictHas(sd, 1));
+    shardedDictFree(sd);
+}
+
+void test2(void) {
+    printf("[shdict] test-2\n");
+    sd = shardedDictNew(5);
+
+    DictKeyType keys[1000];
+    DictValueType values[1000];
+    bool found[1000];
+    for (int i = 0; i < 1000; i++) {
+        keys[i] = i % 500;
+        values[i] = i;
+    }
+    shardedDictSetMany(sd, keys, values, 1000);
+    assert(shardedDictLen(sd) == 500);
+    // the later value wins
+    assert(shardedDictGet(sd, 7) == 507);
+
+    for (int i = 0; i < 1000; i++) {
+        keys[i] = i;
+    }
+    assert(shardedDictGetMany(sd, keys, 1000, values, found) == 500);
+    assert(shardedDictHasMany(sd, keys, 1000, NULL) == 500);
+    for (int i = 0; i < 1000; i++) {
+        assert(found[i] == (i < 500));
+        assert(!found[i] || values[i] == i + 500);
+    }
+    shardedDictFree(sd);
+}
+
+#define NCHURN_KEYS 200000
+#define NCHURN_ROUNDS 5
+
+// grows and shrinks every shard, shard 0 among them, while the workers
+// of test3 pick the shards of their own keys
+static void *churner(void *arg) {
+    (void)arg;
+    int base = NTHREADS * NKEYS_PER_THREAD;
+    for (int round = 0; round < NCHURN_ROUNDS; round++) {
+        for (int i = base; i < base + NCHURN_KEYS; i++) {
+            shardedDictSet(sd, i, i);
+        }
+        for (int i = base; i < base + NCHURN_KEYS; i++) {
+            shardedDictDel(sd, i);
+        }
+    }
+    return NULL;
+}
+
+void test3(void) {
+    printf("[shdict] test-3\n");
+    sd = shardedDictNew(4);
+
+    pthread_t churn;
+    pthread_t threads[NTHREADS];
+    pthread_create(&churn, NULL, churner, NULL);
+    for (size_t t = 0; t < NTHREADS; t++) {
+        pthread_create(&threads[t], NULL, worker, (void *)t);
+    }
+    for (size_t t = 0; t < NTHREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_join(churn, NULL);
+
+    assert(shardedDictLen(sd) == NTHREADS * NKEYS_PER_THREAD / 2);
+    for (int i = 0; i < NTHREADS * NKEYS_PER_THREAD; i++) {
+        assert(shardedDictHas(sd, i) == !(i % 2));
+    }
+    shardedDictFree(sd);
+}
+
+
+int main(void) {
+    test1();
+    test2();
+    test3();
+
+    printf("ok");
+    return 0;
+}
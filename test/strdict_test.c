@@ -0,0 +1,80 @@
+#include "strdict.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+
+void test1(void) {
+    printf("[strdict] test-1\n");
+    StrDict *sd = strDictNew();
+    char key[64];
+    for (int i = 0; i < 100000; i++) {
+        // short keys are stored inline, long ones allocated
+        int len = snprintf(key, sizeof(key), (i % 2) ? "k%d" : "a-rather-long-key-%d", i);
+        strDictSet(sd, key, len, i);
+    }
+    assert(strDictLen(sd) == 100000);
+    for (int i = 0; i < 100000; i++) {
+        int len = snprintf(key, sizeof(key), (i % 2) ? "k%d" : "a-rather-long-key-%d", i);
+        DictValueType value;
+        assert(strDictGet(sd, key, len, &value) == 0 && value == i);
+        // same hash prefix of the bytes, different length
+        key[len] = '#';
+        assert(!strDictHas(sd, key, len + 1));
+    }
+    assert(!strDictHas(sd, "", 0));
+    strDictSet(sd, "", 0, -1);
+    assert(strDictHas(sd, "", 0));
+
+    // lookups borrow the key, it doesn't have to be terminated
+    const char *text = "k1k3k5";
+    assert(strDictHas(sd, text, 2) && strDictHas(sd, text + 4, 2));
+    strDictFree(sd);
+}
+
+void test2(void) {
+    printf("[strdict] test-2\n");
+    StrDict *sd = strDictNew();
+    const char *words[] = {"the", "quick", "brown", "fox", "jumps", "over", "the", "lazy", "dog",
+                           "the", "fox"};
+    size_t nwords = sizeof(words) / sizeof(words[0]);
+    for (size_t i = 0; i < nwords; i++) {
+        (*strDictGetOrInsert(sd, words[i], strlen(words[i]), 0, NULL))++;
+    }
+    assert(strDictLen(sd) == 8);
+    DictValueType value;
+    assert(strDictGet(sd, "the", 3, &value) == 0 && value == 3);
+    assert(strDictGet(sd, "fox", 3, &value) == 0 && value == 2);
+    assert(strDictGet(sd, "cat", 3, &value) == -1);
+
+    // churn through deleted entries
+    char key[64];
+    for (int i = 0; i < 50000; i++) {
+        int len = snprintf(key, sizeof(key), "temporary-key-number-%d", i);
+        strDictSet(sd, key, len, i);
+        assert(strDictDel(sd, key, len) == 0);
+        assert(strDictDel(sd, key, len) == -1);
+    }
+    assert(strDictLen(sd) == 8);
+
+    // insertion order
+    StrDictIter iter = {sd, 0};
+    const char *k;
+    size_t len;
+    size_t n = 0;
+    while (strDictIterNext(&iter, &k, &len, &value)) {
+        assert(n != 0 || (len == 3 && memcmp(k, "the", 3) == 0));
+        n++;
+    }
+    assert(n == 8);
+    strDictFree(sd);
+}
+
+
+int main(void) {
+    test1();
+    test2();
+
+    printf("ok");
+    return 0;
+}